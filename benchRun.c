@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <time.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "benchRun.h"
+
+/* Returns the current time in seconds on a monotonic clock */
+double now_s(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Returns whether a line of the server's transcript is a chat message, i.e.
+ * not a client entering or leaving the chat
+ */
+int is_chat_line(const char *line, size_t len) {
+    const char *suffixes[] = {" has entered the chat)\n",
+            " has left the chat)\n"};
+    for (int i = 0; i < 2; ++i) {
+        size_t suffixLen = strlen(suffixes[i]);
+        if (len >= suffixLen &&
+                !strcmp(line + len - suffixLen, suffixes[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Runs the server in binDir with the given options against configPath,
+ * counting the chat messages in its transcript, and returns the results.
+ * Exits with code 1 if the server can't be run.
+ */
+RunResult run_server(const char *binDir, char **serverOpts,
+        int numServerOpts, char *configPath) {
+    char serverPath[PATH_MAX];
+    sprintf(serverPath, "%s/server", binDir);
+    char **argv = calloc(numServerOpts + 3, sizeof(char *));
+    argv[0] = serverPath;
+    memcpy(argv + 1, serverOpts, numServerOpts * sizeof(char *));
+    argv[numServerOpts + 1] = configPath;
+
+    int fds[2];
+    if (pipe(fds)) {
+        perror("pipe");
+        exit(1);
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null",
+            O_WRONLY, 0);
+    posix_spawn_file_actions_addclose(&actions, fds[0]);
+    posix_spawn_file_actions_addclose(&actions, fds[1]);
+
+    RunResult result = {0};
+    double start = now_s();
+    pid_t pid;
+    extern char **environ;
+    if (posix_spawn(&pid, serverPath, &actions, NULL, argv, environ)) {
+        perror(serverPath);
+        exit(1);
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+    free(argv);
+
+    FILE *transcript = fdopen(fds[0], "r");
+    char *line = NULL;
+    size_t lineCap = 0;
+    ssize_t lineLen;
+    while ((lineLen = getline(&line, &lineCap, transcript)) > 0) {
+        result.messages += is_chat_line(line, lineLen);
+    }
+    free(line);
+    fclose(transcript);
+
+    int status;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    result.elapsed = now_s() - start;
+    result.userTime = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+    result.sysTime = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    result.maxRss = usage.ru_maxrss;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "server exited abnormally\n");
+    }
+
+    return result;
+}
+
+/* Prints the results of a run of the server, one per line */
+void print_run_result(RunResult *result) {
+    printf("messages     %10ld\n", result->messages);
+    printf("messages/sec %10.0f\n", result->messages / result->elapsed);
+    printf("elapsed      %10.3f s\n", result->elapsed);
+    printf("cpu user     %10.3f s\n", result->userTime);
+    printf("cpu sys      %10.3f s\n", result->sysTime);
+    printf("peak rss     %10ld KiB\n", result->maxRss);
+}
@@ -0,0 +1,25 @@
+#ifndef BENCH_RUN_H
+#define BENCH_RUN_H
+
+#include <stddef.h>
+
+/* Results of a single run of the server */
+typedef struct {
+    /* Number of chat messages in the server's transcript */
+    long messages;
+    /* Wall clock time of the run in seconds */
+    double elapsed;
+    /* CPU time spent by the server in user and kernel mode in seconds */
+    double userTime;
+    double sysTime;
+    /* Peak resident set size of the server in KiB */
+    long maxRss;
+} RunResult;
+
+double now_s(void);
+int is_chat_line(const char *line, size_t len);
+RunResult run_server(const char *binDir, char **serverOpts,
+        int numServerOpts, char *configPath);
+void print_run_result(RunResult *result);
+
+#endif
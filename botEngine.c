@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lineList.h"
+#include "commands.h"
+#include "clientbotUtils.h"
+#include "lineBuffer.h"
+#include "serverUtils.h"
+#include "frame.h"
+#include "botEngine.h"
+
+/* Base name of every in-process bot, as for the clientbot program */
+#define BOT_NAME "clientbot"
+
+/* Commands a bot can receive, in the order of clientCmdWords in commands.c */
+typedef enum {
+    WHO,
+    NAME_TAKEN,
+    YT,
+    KICK,
+    MSG,
+    LEFT
+} BotCmds;
+
+static SharedDict *load_shared_dict(BotEngine *engine, char *path);
+static void match_line(SharedDict *dict, char *line);
+static void handle_bot_line(BotEngine *engine, ClientInstance *client,
+        char *line);
+static void set_bot_no(ClientBot *bot, int clientNo);
+static void bot_reply(ClientInstance *client, const char *format,
+        const char *arg);
+static void exit_bot(ClientInstance *client);
+
+/* Initializes and allocates memory for a new BotEngine struct with no bots
+ * and returns a pointer to it.
+ */
+BotEngine *init_bot_engine() {
+    BotEngine *engine = malloc(sizeof(BotEngine));
+    engine->dicts = NULL;
+    engine->numDicts = 0;
+    engine->firstUnknownNo = -1;
+    engine->isReadyOffered = has_capability(getenv(FRAME_CAPS_ENV),
+            READY_CAPABILITY);
+
+    return engine;
+}
+
+/* Frees memory allocated to a BotEngine struct and every responsefile it
+ * loaded. Its bots must be freed separately. (see free_bot())
+ */
+void free_bot_engine(BotEngine *engine) {
+    for (int i = 0; i < engine->numDicts; ++i) {
+        SharedDict *dict = engine->dicts[i];
+        if (dict->dict != NULL) {
+            free_dict(dict->dict);
+        }
+        free(dict->path);
+        free(dict->lastLine);
+        free(dict->lastSender);
+        free(dict);
+    }
+    free(engine->dicts);
+    free(engine);
+}
+
+/* Starts an in-process bot for a client using the responsefile at
+ * responsePath, loading the file unless another bot already did, and returns
+ * a pointer to the bot.
+ *
+ * As with the clientbot program, a bot whose responsefile can't be opened
+ * exits at once, i.e. its client's stdout is closed.
+ */
+ClientBot *start_bot(BotEngine *engine, ClientInstance *client,
+        char *responsePath) {
+    ClientBot *bot = malloc(sizeof(ClientBot));
+    bot->dict = load_shared_dict(engine, responsePath);
+    bot->clientNo = -1;
+    bot->name = strdup(BOT_NAME);
+    bot->buff = init_buffer();
+    bot->hasExited = false;
+    bot->signalsReady = false;
+
+    client->bot = bot;
+    if (bot->dict->dict == NULL) {
+        exit_bot(client);
+    }
+
+    return bot;
+}
+
+/* Frees memory allocated to a ClientBot struct. Its responsefile stays
+ * loaded for other bots.
+ */
+void free_bot(ClientBot *bot) {
+    free(bot->name);
+    free_buffer(bot->buff);
+    free(bot);
+}
+
+/* Delivers the len bytes at msg, one or more '\n' terminated lines, to the
+ * in-process bot of a client as if they were written to its stdin. Any
+ * replies are appended to the client's input at once.
+ */
+void deliver_to_bot(BotEngine *engine, ClientInstance *client,
+        const char *msg, size_t len) {
+    const char *end = msg + len;
+
+    while (msg < end) {
+        const char *newline = memchr(msg, '\n', end - msg);
+        size_t lineLen = newline == NULL ? (size_t) (end - msg) :
+                (size_t) (newline - msg);
+        char *line = strndup(msg, lineLen);
+        handle_bot_line(engine, client, line);
+        free(line);
+        msg += lineLen + 1;
+    }
+}
+
+/* Returns the SharedDict for the responsefile at path, loading it if no bot
+ * has yet. The dict of the SharedDict is NULL if the file can't be opened.
+ */
+static SharedDict *load_shared_dict(BotEngine *engine, char *path) {
+    for (int i = 0; i < engine->numDicts; ++i) {
+        if (!strcmp(engine->dicts[i]->path, path)) {
+            return engine->dicts[i];
+        }
+    }
+
+    SharedDict *dict = malloc(sizeof(SharedDict));
+    dict->path = strdup(path);
+    dict->dict = NULL;
+    dict->lastLine = NULL;
+    dict->lastCmd = -1;
+    dict->lastSender = NULL;
+    dict->lastMatch = -1;
+
+    FILE *responseFile = fopen(path, "r");
+    if (responseFile != NULL) {
+        LineList *responseLines = file_to_line_list(responseFile);
+        dict->dict = lines_to_dict(responseLines);
+        free_line_list(responseLines);
+        fclose(responseFile);
+    }
+
+    engine->dicts = realloc(engine->dicts,
+            sizeof(SharedDict *) * (engine->numDicts + 1));
+    engine->dicts[engine->numDicts++] = dict;
+
+    return dict;
+}
+
+/* Parses a line sent to the bots of a SharedDict as a client command and
+ * matches its message (if it is MSG:) against the stimuli of the dict,
+ * keeping the results as the dict's last line. Nothing is done if the line is
+ * the dict's last line already.
+ *
+ * Lines are checked as the generic client checks them. (see handle_cmd() in
+ * genericClient.c)
+ */
+static void match_line(SharedDict *dict, char *line) {
+    if (dict->lastLine != NULL && !strcmp(dict->lastLine, line)) {
+        return;
+    }
+    free(dict->lastLine);
+    free(dict->lastSender);
+    dict->lastLine = strdup(line);
+    dict->lastSender = NULL;
+    dict->lastMatch = -1;
+
+    /* Number of arguments, including command name, expected for WHO,
+     * NAME_TAKEN, YT, KICK, MSG and LEFT respectively */
+    const int numCmdArgs[] = {1, 1, 1, 1, 3, 2};
+    bool invalidCmd = false;
+    LineList *cmd = get_cmd_str(line, &invalidCmd);
+    int cmdNum = cmd->numLines < 1 ? -1 : get_cmd(cmd->lines[0], CLIENT);
+
+    if (invalidCmd || cmdNum < 0 || numCmdArgs[cmdNum] != cmd->numLines) {
+        cmdNum = -1;
+    } else if (cmdNum == MSG || cmdNum == LEFT) {
+        dict->lastSender = strdup(cmd->lines[1]);
+        if (cmdNum == MSG) {
+            dict->lastMatch = pattern_match_lines(cmd->lines[2],
+                    dict->dict->stimuli);
+        }
+    }
+    dict->lastCmd = cmdNum;
+
+    free_line_list(cmd);
+}
+
+/* Handles a single line sent to the in-process bot of a client, as the
+ * clientbot program would handle it on its stdin. (see clientbot.c)
+ */
+static void handle_bot_line(BotEngine *engine, ClientInstance *client,
+        char *line) {
+    ClientBot *bot = client->bot;
+    if (bot->hasExited) {
+        return;
+    }
+
+    SharedDict *dict = bot->dict;
+    match_line(dict, line);
+
+    switch (dict->lastCmd) {
+        case WHO:
+            // The bot's first reply takes up READY_CAPABILITY if offered
+            if (engine->isReadyOffered && !bot->signalsReady) {
+                bot_reply(client, "NAME:%s:" READY_CAPABILITY "\n",
+                        bot->name);
+                bot->signalsReady = true;
+            } else {
+                bot_reply(client, "NAME:%s\n", bot->name);
+            }
+            break;
+        case NAME_TAKEN:
+            // Every name up to the bot's own is taken
+            if (bot->clientNo + 1 > engine->firstUnknownNo) {
+                engine->firstUnknownNo = bot->clientNo + 1;
+            }
+            set_bot_no(bot, engine->firstUnknownNo);
+            break;
+        case YT:
+            for (int i = 0; i < bot->buff->bufferLen; ++i) {
+                bot_reply(client, "CHAT:%s\n",
+                        dict->dict->responses->lines[bot->buff->responses[i]]);
+            }
+            bot_reply(client, "DONE:\n", NULL);
+            bot->buff->bufferLen = 0;
+            break;
+        case MSG:
+            // Bots don't reply to themselves
+            if (dict->lastMatch > -1 && strcmp(bot->name, dict->lastSender)) {
+                append_buffer(dict->lastMatch, bot->buff);
+                if (bot->signalsReady && bot->buff->bufferLen == 1) {
+                    bot_reply(client, "READY:\n", NULL);
+                }
+            }
+            break;
+        case LEFT:
+            break;
+        default:
+            // KICK: or an invalid command
+            exit_bot(client);
+            break;
+    }
+}
+
+/* Sets the number appended to a bot's name and updates its name to match */
+static void set_bot_no(ClientBot *bot, int clientNo) {
+    bot->clientNo = clientNo;
+    free(bot->name);
+    bot->name = malloc(strlen(BOT_NAME) + 12);
+    sprintf(bot->name, "%s%d", BOT_NAME, clientNo);
+}
+
+/* Appends a line the bot of a client sends, formatted from format and the
+ * string arg (if not NULL) as per printf(), to the client's input.
+ */
+static void bot_reply(ClientInstance *client, const char *format,
+        const char *arg) {
+    int len = snprintf(NULL, 0, format, arg);
+    char *dest = reserve_line_buffer(&client->input, len + 1);
+    snprintf(dest, len + 1, format, arg);
+    commit_line_buffer(&client->input, len);
+}
+
+/* Makes the bot of a client exit, which the server sees as the client
+ * closing its stdout.
+ */
+static void exit_bot(ClientInstance *client) {
+    client->bot->hasExited = true;
+    client->inputClosed = true;
+}
@@ -0,0 +1,88 @@
+#ifndef BOTENGINE_H
+#define BOTENGINE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "clientbotUtils.h"
+#include "serverUtils.h"
+
+/* Program given in a configfile line to run a clientbot inside the server,
+ * i.e. @clientbot:responsefile
+ */
+#define BOT_PROGRAM "@clientbot"
+
+/* A responsefile loaded once and shared by every in-process bot using it.
+ *
+ * Every bot of a room is sent the same MSG: lines, so the result of
+ * matching the last one against the stimuli is kept and reused by every
+ * other bot it is delivered to.
+ */
+typedef struct {
+    /* Path of the responsefile, as given in the configfile */
+    char *path;
+    /* Stimuli and responses of the file, NULL if it couldn't be opened */
+    ResponseDict *dict;
+    /* Last line matched against dict, NULL if none has been yet */
+    char *lastLine;
+    /* Client command number of lastLine, -1 if it is invalid */
+    int lastCmd;
+    /* Name of the client lastLine is from, for MSG: and LEFT: lines */
+    char *lastSender;
+    /* Index in dict of the stimulus lastLine's message matched, or -1 */
+    int lastMatch;
+} SharedDict;
+
+/* State of a single in-process clientbot.
+ *
+ * The bot mirrors the clientbot program (see clientbot.c) as a state
+ * machine driven by the lines the server sends it. Its replies are appended
+ * straight to its client's input LineBuffer, where the server reads them as
+ * it would read a clientbot process's stdout. A bot that would have exited
+ * marks its client's stdout as closed instead.
+ */
+struct ClientBot {
+    /* Responsefile of the bot */
+    SharedDict *dict;
+    /* Number appended to the bot's name, -1 for none (see get_name()) */
+    int clientNo;
+    /* Name the bot gives when sent WHO: */
+    char *name;
+    /* Responses the bot sends on its next turn */
+    ResponseBuffer *buff;
+    /* Whether the bot has exited, i.e. was kicked or sent a bad command */
+    bool hasExited;
+    /* Whether the bot took up READY_CAPABILITY when it replied to WHO:, so
+     * it sends READY: once it has something to say (see frame.h)
+     */
+    bool signalsReady;
+};
+
+/* Every in-process bot of a server.
+ *
+ * firstUnknownNo is the lowest number n for which the name clientbot<n> isn't
+ * known to be taken. A bot sent NAME_TAKEN: has been refused every name up to
+ * its own, and names are never given up (see retire_name()), so bots skip
+ * straight to it rather than being refused each of them in turn.
+ */
+struct BotEngine {
+    /* Responsefiles loaded so far */
+    SharedDict **dicts;
+    /* Number of elements in dicts */
+    int numDicts;
+    /* Lowest bot number whose name isn't known to be taken */
+    int firstUnknownNo;
+    /* Whether the server offers READY_CAPABILITY, as read from FRAME_CAPS_ENV
+     * like the clientbot program does
+     */
+    bool isReadyOffered;
+};
+
+BotEngine *init_bot_engine();
+void free_bot_engine(BotEngine *engine);
+ClientBot *start_bot(BotEngine *engine, ClientInstance *client,
+        char *responsePath);
+void free_bot(ClientBot *bot);
+void deliver_to_bot(BotEngine *engine, ClientInstance *client,
+        const char *msg, size_t len);
+
+#endif
@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/uio.h>
+#include "outputQueue.h"
+
+/* Default number of clients each message is broadcast to */
+#define DEFAULT_CLIENTS 64
+/* Default number of broadcasts made between clients reading their stdin */
+#define DEFAULT_BURST 16
+/* Default number of bursts */
+#define DEFAULT_ROUNDS 2000
+
+/* Benchmark comparing the cost of broadcasting chat messages the way the
+ * classic server does (one fprintf() and fflush() per recipient) with
+ * SharedMsg broadcasts queued by reference and written with writev().
+ *
+ * Every client is a pipe drained by the benchmark itself. A burst of
+ * broadcasts is made between drains, as happens in the server whenever
+ * clients haven't read their stdin yet. The write syscalls of each method
+ * are counted by wrapping fflush() and writev() at link time. (see the
+ * bench-broadcast target in the makefile)
+ *
+ * Usage: broadcastBench [clients [burst [rounds]]]
+ */
+
+/* Number of fflush() calls made, each being one write() of a dirty stream */
+static long numFlushes = 0;
+/* Number of writev() calls made */
+static long numWritevs = 0;
+
+int __real_fflush(FILE *stream);
+ssize_t __real_writev(int fd, const struct iovec *iov, int iovcnt);
+
+/* Counts calls to fflush() (see -Wl,--wrap) */
+int __wrap_fflush(FILE *stream) {
+    numFlushes++;
+    return __real_fflush(stream);
+}
+
+/* Counts calls to writev() (see -Wl,--wrap) */
+ssize_t __wrap_writev(int fd, const struct iovec *iov, int iovcnt) {
+    numWritevs++;
+    return __real_writev(fd, iov, iovcnt);
+}
+
+/* A single benchmark client, the read and write ends of a pipe */
+typedef struct {
+    int readFd;
+    int writeFd;
+    FILE *writeEnd;
+    OutputQueue output;
+} BenchClient;
+
+/* Returns the current time in nanoseconds */
+static long long now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/* Reads everything written to a client so far */
+static void drain_client(BenchClient *client) {
+    char buffer[4096];
+    while (read(client->readFd, buffer, sizeof(buffer)) > 0) {
+        ;
+    }
+}
+
+/* Broadcasts as the classic server does: the message is formatted once, then
+ * copied into and flushed from each recipient's stdio stream.
+ */
+static void broadcast_classic(BenchClient *clients, int numClients,
+        const char *name, const char *text) {
+    char *msg = calloc(strlen("MSG::\n") + strlen(name) + strlen(text) + 1,
+            sizeof(char));
+    sprintf(msg, "MSG:%s:%s\n", name, text);
+    for (int i = 0; i < numClients; ++i) {
+        fprintf(clients[i].writeEnd, "%s", msg);
+        fflush(clients[i].writeEnd);
+    }
+    free(msg);
+}
+
+/* Broadcasts by queueing a reference to a single SharedMsg on each
+ * recipient. Queues are written when clients next read their stdin.
+ */
+static void broadcast_shared(BenchClient *clients, int numClients,
+        const char *name, const char *text) {
+    SharedMsg *msg = format_shared_msg("MSG:%s:%s\n", name, text);
+    for (int i = 0; i < numClients; ++i) {
+        enqueue_output(&clients[i].output, msg);
+    }
+    release_shared_msg(msg);
+}
+
+/* Runs rounds bursts of burst broadcasts to every client with the given
+ * method and prints the results.
+ */
+static void run_bench(const char *label, BenchClient *clients,
+        int numClients, int burst, int rounds, bool isShared) {
+    numFlushes = 0;
+    numWritevs = 0;
+    long long start = now_ns();
+
+    for (int round = 0; round < rounds; ++round) {
+        for (int i = 0; i < burst; ++i) {
+            if (isShared) {
+                broadcast_shared(clients, numClients, "bench", "hello there");
+            } else {
+                broadcast_classic(clients, numClients, "bench",
+                        "hello there");
+            }
+        }
+        for (int i = 0; i < numClients; ++i) {
+            if (isShared) {
+                flush_output(&clients[i].output, clients[i].writeFd);
+            }
+            drain_client(&clients[i]);
+        }
+    }
+
+    long long elapsed = now_ns() - start;
+    long broadcasts = (long) burst * rounds;
+    long syscalls = isShared ? numWritevs : numFlushes;
+    printf("%-8s %10.2f syscalls/broadcast %10.1f ns/broadcast\n", label,
+            (double) syscalls / broadcasts, (double) elapsed / broadcasts);
+}
+
+/* Parses the positive integer argument at index i of argv, or returns
+ * defaultValue if it wasn't given.
+ */
+static int parse_arg(int argc, char **argv, int i, int defaultValue) {
+    if (argc <= i) {
+        return defaultValue;
+    }
+    char *end;
+    long value = strtol(argv[i], &end, 10);
+    if (*argv[i] == '\0' || *end != '\0' || value <= 0 || value > 1000000) {
+        fprintf(stderr, "Usage: broadcastBench [clients [burst [rounds]]]\n");
+        exit(1);
+    }
+    return value;
+}
+
+int main(int argc, char **argv) {
+    int numClients = parse_arg(argc, argv, 1, DEFAULT_CLIENTS);
+    int burst = parse_arg(argc, argv, 2, DEFAULT_BURST);
+    int rounds = parse_arg(argc, argv, 3, DEFAULT_ROUNDS);
+
+    BenchClient *clients = calloc(numClients, sizeof(BenchClient));
+    for (int i = 0; i < numClients; ++i) {
+        int fds[2];
+        if (pipe(fds)) {
+            perror("pipe");
+            return 1;
+        }
+        fcntl(fds[0], F_SETFL, O_NONBLOCK);
+        fcntl(fds[1], F_SETFL, O_NONBLOCK);
+        clients[i].readFd = fds[0];
+        clients[i].writeFd = fds[1];
+        clients[i].writeEnd = fdopen(fds[1], "w");
+        init_output_queue(&clients[i].output);
+    }
+
+    printf("%d clients, %d broadcasts per burst, %d bursts\n", numClients,
+            burst, rounds);
+    run_bench("classic", clients, numClients, burst, rounds, false);
+    run_bench("writev", clients, numClients, burst, rounds, true);
+
+    for (int i = 0; i < numClients; ++i) {
+        free_output_queue(&clients[i].output);
+        fclose(clients[i].writeEnd);
+        close(clients[i].readFd);
+    }
+    free(clients);
+
+    return 0;
+}
@@ -3,6 +3,7 @@
 #include "commands.h"
 #include "clientData.h"
 #include "genericClient.h"
+#include "probes.h"
 
 static void client_yt_handler();
 
@@ -12,6 +13,7 @@ int main(int argc, char **argv) {
     config.defaultName = "client";
     config.msgAndLeftHandler = NULL;
     config.ytHandler = client_yt_handler;
+    config.tellsReady = false;
 
     // Declare the ClientData struct data to be used by the client
     ClientData *data = init_client_data(config);
@@ -33,6 +35,9 @@ static void client_yt_handler(ClientData *data) {
     bool done = false;
     /* If QUIT: was reached in the script on this turn of YT */
     bool normalExit = false;
+    /* Number of commands emitted on this turn of YT */
+    int numEmitted = 0;
+    PROBE0(yt_begin);
 
     while(!done) {
         
@@ -50,11 +55,19 @@ static void client_yt_handler(ClientData *data) {
         char *cmdName = currentScriptCmd->lines[0];
         int cmdIndex = find_word(cmdName, validCmds, numValidCmds);
 
-        // Check if current line is a valid command and emit it to stdout if so
+        /* Check if current line is a valid command and emit it to stdout if
+         * so, as a frame if the client has switched to them
+         */
         if (!invalidCmd && (cmdIndex > -1) &&
             (currentScriptCmd->numLines == numCmdArgs[cmdIndex])) {
-            printf("%s\n", currentLine);
+            if (data->isFramed) {
+                emit_cmd(data, cmdName, currentScriptCmd->numLines > 1 ?
+                        currentScriptCmd->lines[1] : NULL);
+            } else {
+                printf("%s\n", currentLine);
+            }
             fflush(stdout);
+            numEmitted++;
         } else {
             invalidCmd = true;
         }
@@ -73,6 +86,7 @@ static void client_yt_handler(ClientData *data) {
 
         free_line_list(currentScriptCmd);
     }
+    PROBE1(yt_end, numEmitted);
 
     // Make client exit if needed
     if (normalExit) {
@@ -18,6 +18,10 @@ ClientData *init_client_data(ClientConfig givenConfig) {
     data->script = NULL;
     data->dict = NULL;
     data->buff = NULL;
+    data->isFramingOffered = false;
+    data->isFramed = false;
+    data->isReadyOffered = false;
+    data->signalsReady = false;
 
     return data;
 }
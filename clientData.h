@@ -21,6 +21,10 @@ struct ClientConfig {
      * data
      */
     void (*ytHandler)(ClientData *data);
+    /* Whether the client can tell the server when it has something to say,
+     * i.e. takes up READY_CAPABILITY if offered (see frame.h)
+     */
+    bool tellsReady;
 };
 
 struct ClientData {
@@ -46,6 +50,20 @@ struct ClientData {
      * a clientbot to output on the next YT: commands it receives.
      */
     ResponseBuffer *buff;
+    /* Whether the server accepts frames, i.e. it named FRAME_CAPABILITY in
+     * the client's environment (see frame.h)
+     */
+    bool isFramingOffered;
+    /* Whether the client switched to frames when it replied to WHO: */
+    bool isFramed;
+    /* Whether the server offered READY_CAPABILITY and the client tells it
+     * when it has something to say
+     */
+    bool isReadyOffered;
+    /* Whether the client took up READY_CAPABILITY when it replied to WHO:,
+     * so it sends READY: once it has something to say
+     */
+    bool signalsReady;
 };
 
 ClientData *init_client_data(struct ClientConfig givenConfig);
@@ -0,0 +1,352 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/signalfd.h>
+#include "clientSpawn.h"
+
+extern char **environ;
+
+static char **shm_environ();
+static void run_spawn_helper(SpawnHelper *helper, int sockFd);
+static void send_spawned_client(int sockFd, SpawnedClient *spawned);
+
+/* Sets up a SpawnedClient with the given pid and pipe ends and no
+ * ShmChannel, e.g. for a client that isn't a process the server started.
+ */
+void init_spawned_client(SpawnedClient *spawned, pid_t pid, int readFd,
+        int writeFd) {
+    spawned->pid = pid;
+    spawned->readFd = readFd;
+    spawned->writeFd = writeFd;
+    for (int i = 0; i < SHM_NUM_FDS; ++i) {
+        spawned->shmFds[i] = -1;
+    }
+}
+
+/* Starts the client program with the single argument arg, connecting its
+ * stdin and stdout to new pipes and its stderr to the null device.
+ *
+ * The client is started with posix_spawnp(), which doesn't copy the server's
+ * page tables as fork() does. Both pipes are close-on-exec, so the client
+ * inherits no file descriptors but its own stdin, stdout and stderr.
+ *
+ * The client starts with no signals blocked, whatever the server blocks.
+ * (see start_reaping())
+ *
+ * If offerShm is set, the client is also offered a new ShmChannel, passed
+ * to it from SHM_BASE_FD onwards and named by SHM_FD_ENV in its environment.
+ * Clients that don't take it up are unaffected.
+ *
+ * If the client can't be started, its pid is set to -1 and its pipes are
+ * left with no other end, so the server sees it close its stdout at once.
+ * Exits with code 1 if the pipes can't be created.
+ */
+void spawn_client(char *program, char *arg, bool offerShm,
+        SpawnedClient *spawned) {
+    init_spawned_client(spawned, -1, -1, -1);
+    if (offerShm) {
+        open_shm_channel(spawned->shmFds);
+    }
+
+    int readPipe[2];
+    int writePipe[2];
+    if (pipe2(readPipe, O_CLOEXEC) || pipe2(writePipe, O_CLOEXEC)) {
+        perror("pipe2");
+        exit(1);
+    }
+
+    // dup2() clears close-on-exec on the client's copies
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, readPipe[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, writePipe[0], STDIN_FILENO);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null",
+            O_WRONLY, 0);
+    bool hasShm = spawned->shmFds[SHM_MEMORY] >= 0;
+    for (int i = 0; hasShm && i < SHM_NUM_FDS; ++i) {
+        posix_spawn_file_actions_adddup2(&actions, spawned->shmFds[i],
+                SHM_BASE_FD + i);
+    }
+
+    posix_spawnattr_t attributes;
+    sigset_t noSignals;
+    sigemptyset(&noSignals);
+    posix_spawnattr_init(&attributes);
+    posix_spawnattr_setsigmask(&attributes, &noSignals);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK);
+
+    char *argv[] = {program, arg, NULL};
+    char **envp = hasShm ? shm_environ() : environ;
+    if (posix_spawnp(&spawned->pid, program, &actions, &attributes, argv,
+            envp)) {
+        spawned->pid = -1;
+        close_shm_fds(spawned->shmFds);
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attributes);
+    if (hasShm) {
+        free(envp[0]);
+        free(envp);
+    }
+
+    close(readPipe[1]);
+    close(writePipe[0]);
+    spawned->readFd = readPipe[0];
+    spawned->writeFd = writePipe[1];
+}
+
+/* Forks a new SpawnHelper process and returns a pointer to a newly allocated
+ * SpawnHelper struct for it, which offers every client it starts a
+ * ShmChannel if offerShm is set. Exits with code 1 if it can't be started.
+ */
+SpawnHelper *start_spawn_helper(bool offerShm) {
+    int sockFds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockFds)) {
+        perror("socketpair");
+        exit(1);
+    }
+
+    SpawnHelper *helper = malloc(sizeof(SpawnHelper));
+    helper->numPending = 0;
+    helper->offerShm = offerShm;
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    } else if (pid == 0) {
+        close(sockFds[0]);
+        run_spawn_helper(helper, sockFds[1]);
+        // Leave the server's stdio buffers alone
+        _exit(0);
+    }
+
+    close(sockFds[1]);
+    helper->pid = pid;
+    helper->sockFd = sockFds[0];
+
+    return helper;
+}
+
+/* Asks a SpawnHelper to start the client program with the single argument
+ * arg. (see spawn_client())
+ *
+ * Never blocks: returns false without sending the request if the helper's
+ * socket is full, in which case the helper is waiting for its replies to be
+ * taken. (see take_spawned_client()) Exits with code 1 if the request can't
+ * be sent at all.
+ */
+bool request_spawn(SpawnHelper *helper, char *program, char *arg) {
+    // Requests are the program and arg, each '\0' terminated
+    size_t programLen = strlen(program) + 1;
+    size_t argLen = strlen(arg) + 1;
+    char *request = malloc(programLen + argLen);
+    memcpy(request, program, programLen);
+    memcpy(request + programLen, arg, argLen);
+
+    ssize_t sent;
+    do {
+        sent = send(helper->sockFd, request, programLen + argLen,
+                MSG_DONTWAIT);
+    } while (sent < 0 && errno == EINTR);
+    free(request);
+
+    if (sent < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return false;
+        }
+        perror("send");
+        exit(1);
+    }
+    helper->numPending++;
+
+    return true;
+}
+
+/* Waits for a SpawnHelper's reply to its oldest pending request and stores
+ * the client it started in spawned. Returns false if no requests are pending
+ * or the helper died.
+ */
+bool take_spawned_client(SpawnHelper *helper, SpawnedClient *spawned) {
+    if (helper->numPending == 0) {
+        return false;
+    }
+
+    // Pipe ends, followed by the ShmChannel if the helper offered one
+    int fds[2 + SHM_NUM_FDS];
+    union {
+        char buffer[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = {&spawned->pid, sizeof(pid_t)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(struct msghdr));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    ssize_t received;
+    do {
+        received = recvmsg(helper->sockFd, &msg, MSG_CMSG_CLOEXEC);
+    } while (received < 0 && errno == EINTR);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    size_t numFds = helper->offerShm ? 2 + SHM_NUM_FDS : 2;
+    if (received != sizeof(pid_t) || cmsg == NULL ||
+            cmsg->cmsg_type != SCM_RIGHTS) {
+        return false;
+    } else if (cmsg->cmsg_len != CMSG_LEN(sizeof(int) * numFds)) {
+        // The helper couldn't offer this client a ShmChannel
+        numFds = 2;
+        if (cmsg->cmsg_len != CMSG_LEN(sizeof(int) * numFds)) {
+            return false;
+        }
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * numFds);
+    init_spawned_client(spawned, spawned->pid, fds[0], fds[1]);
+    for (size_t i = 2; i < numFds; ++i) {
+        spawned->shmFds[i - 2] = fds[i];
+    }
+    helper->numPending--;
+
+    return true;
+}
+
+/* Tells a SpawnHelper there are no more requests, waits for it to exit and
+ * frees the memory allocated to it. Replies not yet taken are discarded.
+ */
+void stop_spawn_helper(SpawnHelper *helper) {
+    shutdown(helper->sockFd, SHUT_WR);
+    close(helper->sockFd);
+    waitpid(helper->pid, NULL, 0);
+    free(helper);
+}
+
+/* Blocks SIGCHLD and returns a signalfd it is read from instead, so clients
+ * that exit can be reaped between rounds. (see reap_children()) Must be
+ * called before the server starts any threads, so that none of them is sent
+ * SIGCHLD. Exits with code 1 if the signalfd can't be created.
+ */
+int start_reaping() {
+    sigset_t childSignal;
+    sigemptyset(&childSignal);
+    sigaddset(&childSignal, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &childSignal, NULL);
+
+    int reapFd = signalfd(-1, &childSignal, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (reapFd < 0) {
+        perror("signalfd");
+        exit(1);
+    }
+
+    return reapFd;
+}
+
+/* Reaps every child of the server that has exited, if reapFd (see
+ * start_reaping()) says any has since this was last called. Costs a single
+ * read() otherwise.
+ */
+void reap_children(int reapFd) {
+    struct signalfd_siginfo info;
+    bool hasExited = false;
+    while (read(reapFd, &info, sizeof(struct signalfd_siginfo)) > 0) {
+        hasExited = true;
+    }
+
+    // Signals of children that exit together are merged, so reap them all
+    while (hasExited && waitpid(-1, NULL, WNOHANG) > 0) {
+        ;
+    }
+}
+
+/* Returns a newly allocated copy of the environment in which SHM_FD_ENV names
+ * SHM_BASE_FD, for a client offered a ShmChannel. Only the array and its
+ * first string are allocated.
+ */
+static char **shm_environ() {
+    int numVars = 0;
+    while (environ[numVars] != NULL) {
+        numVars++;
+    }
+
+    char **envp = malloc(sizeof(char *) * (numVars + 2));
+    envp[0] = malloc(strlen(SHM_FD_ENV) + 12);
+    sprintf(envp[0], "%s=%d", SHM_FD_ENV, SHM_BASE_FD);
+    memcpy(envp + 1, environ, sizeof(char *) * (numVars + 1));
+
+    return envp;
+}
+
+/* Body of a SpawnHelper process. Starts a client for each request read from
+ * sockFd and replies with it, until the server shuts down its end.
+ */
+static void run_spawn_helper(SpawnHelper *helper, int sockFd) {
+    while (1) {
+        // Find the length of the next request before reading it
+        ssize_t len = recv(sockFd, NULL, 0, MSG_PEEK | MSG_TRUNC);
+        if (len < 0 && errno == EINTR) {
+            continue;
+        } else if (len <= 0) {
+            break;
+        }
+
+        char *request = malloc(len);
+        if (recv(sockFd, request, len, 0) != len ||
+                request[len - 1] != '\0') {
+            free(request);
+            break;
+        }
+        char *program = request;
+        char *arg = request + strlen(program) + 1;
+
+        SpawnedClient spawned;
+        spawn_client(program, arg, helper->offerShm, &spawned);
+        send_spawned_client(sockFd, &spawned);
+        close(spawned.readFd);
+        close(spawned.writeFd);
+        close_shm_fds(spawned.shmFds);
+        free(request);
+    }
+}
+
+/* Sends the pid and pipe ends of a client a SpawnHelper started to the
+ * server.
+ */
+static void send_spawned_client(int sockFd, SpawnedClient *spawned) {
+    int fds[2 + SHM_NUM_FDS] = {spawned->readFd, spawned->writeFd};
+    size_t numFds = spawned->shmFds[SHM_MEMORY] < 0 ? 2 : 2 + SHM_NUM_FDS;
+    for (size_t i = 2; i < numFds; ++i) {
+        fds[i] = spawned->shmFds[i - 2];
+    }
+    union {
+        char buffer[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct iovec iov = {&spawned->pid, sizeof(pid_t)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(struct msghdr));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * numFds);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * numFds);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * numFds);
+
+    while (sendmsg(sockFd, &msg, 0) < 0 && errno == EINTR) {
+        ;
+    }
+}
+
@@ -0,0 +1,55 @@
+#ifndef CLIENTSPAWN_H
+#define CLIENTSPAWN_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include "shmRing.h"
+
+/* Struct describing a newly spawned client process, as seen by the server */
+typedef struct {
+    /* Process ID of the client, -1 if it couldn't be started */
+    pid_t pid;
+    /* Read end of a pipe from the client's stdout */
+    int readFd;
+    /* Write end of a pipe to the client's stdin */
+    int writeFd;
+    /* Server's end of the ShmChannel offered to the client, in the order of
+     * ShmFd, or all -1 if none was (see shmRing.h)
+     */
+    int shmFds[SHM_NUM_FDS];
+} SpawnedClient;
+
+/* Struct for a helper process that spawns clients on behalf of the server.
+ *
+ * The helper is forked before the server reads its configfile, while the
+ * server is still small. The server passes it one spawn request per client
+ * through a socket as it parses the configfile, and the helper starts each
+ * client and passes back the client's pid and pipe ends (as SCM_RIGHTS), in
+ * the order they were requested. Spawning so overlaps with parsing, and
+ * neither process ever forks from a large address space.
+ *
+ * Clients started by the helper are its children, not the server's.
+ */
+typedef struct {
+    /* Process ID of the helper */
+    pid_t pid;
+    /* Server's end of the socket connected to the helper */
+    int sockFd;
+    /* Number of requests the helper hasn't replied to yet */
+    int numPending;
+    /* Whether the helper offers every client it starts a ShmChannel */
+    bool offerShm;
+} SpawnHelper;
+
+void init_spawned_client(SpawnedClient *spawned, pid_t pid, int readFd,
+        int writeFd);
+void spawn_client(char *program, char *arg, bool offerShm,
+        SpawnedClient *spawned);
+SpawnHelper *start_spawn_helper(bool offerShm);
+bool request_spawn(SpawnHelper *helper, char *program, char *arg);
+bool take_spawned_client(SpawnHelper *helper, SpawnedClient *spawned);
+void stop_spawn_helper(SpawnHelper *helper);
+int start_reaping();
+void reap_children(int reapFd);
+
+#endif
@@ -4,6 +4,7 @@
 #include "lineList.h"
 #include "clientbotUtils.h"
 #include "genericClient.h"
+#include "probes.h"
 
 static void clientbot_handle_msg_n_left(ClientData *data, LineList *cmd);
 static void clientbot_yt_handler(ClientData *data);
@@ -14,6 +15,7 @@ int main(int argc, char **argv) {
     config.defaultName = "clientbot";
     config.msgAndLeftHandler = clientbot_handle_msg_n_left;
     config.ytHandler = clientbot_yt_handler;
+    config.tellsReady = true;
 
     // Declare the ClientData struct data to be used by the client
     ClientData *data = init_client_data(config);
@@ -39,6 +41,9 @@ int main(int argc, char **argv) {
  * contains a stimulus in the clientbot's responsefile and the corresponding
  * response is added to a ResponseBuffer and queued to be emitted to stdout
  * when the next YT: command is handled
+ *
+ * If the clientbot tells the server when it has something to say, it sends
+ * READY: once its first response of a turn is queued. (see READY_CAPABILITY)
  */
 static void clientbot_handle_msg_n_left(ClientData *data, LineList *cmd) {
     /* If the command was MSG, check if the message is in the clientbot's
@@ -54,6 +59,10 @@ static void clientbot_handle_msg_n_left(ClientData *data, LineList *cmd) {
         if ((responseIndex = pattern_match_lines(cmd->lines[2],
                 data->dict->stimuli)) > -1) {
             append_buffer(responseIndex, data->buff);
+            if (data->signalsReady && data->buff->bufferLen == 1) {
+                emit_cmd(data, "READY", NULL);
+                fflush(stdout);
+            }
         }
     }
 
@@ -69,13 +78,15 @@ static void clientbot_handle_msg_n_left(ClientData *data, LineList *cmd) {
  * (buff) to stdout. Then frees buff and freshly reinitializes it.
  */
 static void clientbot_yt_handler(ClientData *data) {
+    PROBE0(yt_begin);
     for (int i = 0; i < data->buff->bufferLen; ++i) {
-        printf("CHAT:%s\n",
+        emit_cmd(data, "CHAT",
                 data->dict->responses->lines[data->buff->responses[i]]);
         fflush(stdout);
     }
-    printf("DONE:\n");
+    emit_cmd(data, "DONE", NULL);
     fflush(stdout);
+    PROBE1(yt_end, data->buff->bufferLen + 1);
     free_buffer(data->buff);
     data->buff = init_buffer();
 }
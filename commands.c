@@ -16,22 +16,36 @@ static const char *clientCmdWords[] = {
         };
 
 /* Strings corresponding to commands that can be sent to a server.
- * "NAME" is not included here as name negotiation is handled separately
- * from the other commands. (see server.c)*/
+ * "NAME" is only valid during name negotiation, which is handled separately
+ * from the other commands, and "READY" only from clients that named
+ * READY_CAPABILITY then. (see server.c)*/
 static const char *serverCmdWords[] = {
         "CHAT",
         "KICK",
         "DONE",
-        "QUIT"
+        "QUIT",
+        "NAME",
+        "READY"
         };
 
+/* Number of fields following the name of each command in clientCmdWords and
+ * serverCmdWords respectively
+ */
+static const int clientCmdFields[] = {0, 0, 0, 0, 2, 1};
+static const int serverCmdFields[] = {1, 1, 0, 0, 1, 0};
+
 /* Number of possible commands for client and server respectively*/
-static const int cmdCount[] = {6, 5};
+static const int cmdCount[] = {6, 6};
 
 /* List of list of commands that can be sent to client and server respectively
  */
 static const char **cmds[] = {clientCmdWords, serverCmdWords};
 
+/* Number of fields of each command that can be sent to client and server
+ * respectively
+ */
+static const int *cmdFields[] = {clientCmdFields, serverCmdFields};
+
 /* Converts command cmd given as a string to the index of that string
  * in either clientCmdWords or serverCmdWords if it is in the array.
  * If sentTo is 0, the string is looked for in clientCmdWords whilst if it 
@@ -54,6 +68,28 @@ int get_cmd(char *cmd, int sentTo) {
     return matchedCmd;
 }
 
+/* Returns the name of the command at index cmdNum of clientCmdWords (if
+ * sentTo is 0) or serverCmdWords (if sentTo is 1), or NULL if there is no
+ * such command.
+ */
+const char *get_cmd_word(int cmdNum, int sentTo) {
+    if (cmdNum < 0 || cmdNum >= cmdCount[sentTo]) {
+        return NULL;
+    }
+    return cmds[sentTo][cmdNum];
+}
+
+/* Returns the number of fields following the name of the command at index
+ * cmdNum of clientCmdWords (if sentTo is 0) or serverCmdWords (if sentTo is
+ * 1), i.e. NAME:<name> has one. -1 is returned if there is no such command.
+ */
+int get_cmd_num_fields(int cmdNum, int sentTo) {
+    if (cmdNum < 0 || cmdNum >= cmdCount[sentTo]) {
+        return -1;
+    }
+    return cmdFields[sentTo][cmdNum];
+}
+
 /*
  * Reads a command from a single line of stdin and returns it represented
  * as a LineList struct using the function get_cmd_str().
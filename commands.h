@@ -14,6 +14,8 @@ typedef enum {
 } CmdSentTo;
 
 int get_cmd(char *cmd, int sentTo);
+const char *get_cmd_word(int cmdNum, int sentTo);
+int get_cmd_num_fields(int cmdNum, int sentTo);
 LineList *get_cmd_str(char *cmd, bool *invalidCmd);
 LineList *get_cmd_stdin(bool *invalidCmd, bool *isLineEmpty);
 bool is_comment(char *line);
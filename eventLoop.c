@@ -0,0 +1,533 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "commands.h"
+#include "serverUtils.h"
+#include "eventLoop.h"
+#include "listener.h"
+#include "frame.h"
+
+/* Maximum number of events handled per call to epoll_wait() */
+#define MAX_EVENTS_PER_POLL 1024
+
+/* Number of bytes read from a client per read() call */
+#define CLIENT_READ_SIZE 4096
+
+static void read_client_input(EventLoop *loop, ClientInstance *client);
+static void read_shm_input(EventLoop *loop, ClientInstance *client);
+static int output_wait_fd(ClientInstance *client);
+static bool watch_fd(EventLoop *loop, int fd, uint32_t events,
+        EventSource *source);
+static void unwatch_fd(EventLoop *loop, int fd);
+static void mark_client_ready(EventLoop *loop, ClientInstance *client);
+
+/* Initializes and allocates memory for a new EventLoop struct and returns a
+ * pointer to it. Exits with code 1 if the epoll instance can't be created.
+ */
+EventLoop *init_event_loop() {
+    EventLoop *loop = malloc(sizeof(EventLoop));
+    if ((loop->epollFd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        perror("epoll_create1");
+        exit(1);
+    }
+    loop->maxEvents = 0;
+    loop->events = NULL;
+    loop->numWatched = 0;
+    loop->trackReady = false;
+    loop->readyClients = NULL;
+    loop->numReady = 0;
+    loop->heldClients = NULL;
+    loop->numHeld = 0;
+    init_timer_wheel(&loop->timers);
+    loop->wakeFd = -1;
+
+    return loop;
+}
+
+/* Frees memory allocated to an EventLoop struct and closes its epoll
+ * instance. Watched file descriptors are not closed.
+ */
+void free_event_loop(EventLoop *loop) {
+    close(loop->epollFd);
+    if (loop->wakeFd >= 0) {
+        close(loop->wakeFd);
+    }
+    free(loop->events);
+    free(loop->readyClients);
+    free(loop->heldClients);
+    free_timer_wheel(&loop->timers);
+    free(loop);
+}
+
+/* Starts watching the readFd of a client for input. The file descriptor is
+ * made non-blocking as it is only ever read once epoll reports it readable.
+ * The client's writeFd is also made non-blocking so writes to it never stall
+ * the server; it is only watched while output to it is pending.
+ *
+ * If the client was offered a ShmChannel, the doorbell it rings as it writes
+ * to the channel is watched too. The doorbell is edge-triggered, so it never
+ * has to be reset.
+ */
+void watch_client(EventLoop *loop, ClientInstance *client) {
+    fcntl(client->readFd, F_SETFL,
+            fcntl(client->readFd, F_GETFL) | O_NONBLOCK);
+    fcntl(client->writeFd, F_SETFL,
+            fcntl(client->writeFd, F_GETFL) | O_NONBLOCK);
+
+    client->inputSource.type = CLIENT_INPUT;
+    client->inputSource.client = client;
+    client->inputSource.listener = NULL;
+    client->outputSource.type = CLIENT_OUTPUT;
+    client->outputSource.client = client;
+    client->outputSource.listener = NULL;
+    client->shmSource.type = CLIENT_SHM_INPUT;
+    client->shmSource.client = client;
+    client->shmSource.listener = NULL;
+
+    // A client that can't be watched is treated as if it closed stdout
+    if (!watch_fd(loop, client->readFd, EPOLLIN, &client->inputSource)) {
+        client->inputClosed = true;
+    }
+    if (client->shm != NULL) {
+        watch_fd(loop, client->shmFds[SHM_DATA_BELL], EPOLLIN | EPOLLET,
+                &client->shmSource);
+    }
+}
+
+/* Stops watching the readFd of a client, and its ShmChannel if it was
+ * offered one. Does nothing if it isn't watched, i.e. if its stdout was
+ * already closed.
+ */
+void unwatch_client(EventLoop *loop, ClientInstance *client) {
+    unwatch_fd(loop, client->readFd);
+    if (client->shm != NULL) {
+        unwatch_fd(loop, client->shmFds[SHM_DATA_BELL]);
+    }
+}
+
+/* Starts watching a listener's socket for connections. (see
+ * accept_connections() in listener.c) Exits with code 1 if it can't be
+ * watched.
+ */
+void watch_listener(EventLoop *loop, Listener *listener) {
+    listener->source.type = LISTENER;
+    listener->source.client = NULL;
+    listener->source.listener = listener;
+    if (!watch_fd(loop, listener->fd, EPOLLIN, &listener->source)) {
+        perror("epoll_ctl");
+        exit(1);
+    }
+}
+
+/* Stops watching a listener's socket */
+void unwatch_listener(EventLoop *loop, Listener *listener) {
+    unwatch_fd(loop, listener->fd);
+}
+
+/* Writes as much of a client's pending output as its stdin can take without
+ * blocking. If output is still pending afterwards, the client's writeFd is
+ * watched so the rest is written once it becomes writable.
+ *
+ * Output to a client that attached to its ShmChannel is written to the
+ * channel instead, from the first message not yet partly written to its
+ * stdin onwards. Once the channel is full, the doorbell the client rings as
+ * it makes space is watched rather than writeFd.
+ *
+ * If the client closed its stdin, its pending output is discarded.
+ */
+void flush_client_output(EventLoop *loop, ClientInstance *client) {
+    if (client->shm != NULL && !client->isOutputOnRing &&
+            client->output.headOffset == 0 &&
+            __atomic_load_n(&client->shm->isAttached, __ATOMIC_ACQUIRE)) {
+        if (client->isWatchingOutput) {
+            unwatch_fd(loop, client->writeFd);
+            client->isWatchingOutput = false;
+        }
+        client->isOutputOnRing = true;
+    }
+
+    int status;
+    if (client->writeFd < 0) {
+        status = -1;
+    } else if (client->isOutputOnRing) {
+        status = flush_output_to_ring(&client->output, &client->shm->toClient,
+                client->shmFds[SHM_CLIENT_BELL]);
+    } else {
+        status = flush_output(&client->output, client->writeFd);
+    }
+
+    if (status < 0) {
+        free_output_queue(&client->output);
+    }
+
+    if (status == 1 && !client->isWatchingOutput) {
+        watch_fd(loop, output_wait_fd(client), client->isOutputOnRing ?
+                EPOLLIN | EPOLLET : EPOLLOUT, &client->outputSource);
+        client->isWatchingOutput = true;
+    } else if (status != 1 && client->isWatchingOutput) {
+        unwatch_fd(loop, output_wait_fd(client));
+        client->isWatchingOutput = false;
+    }
+}
+
+/* Discards all output pending for a client, e.g. once it has left the chat,
+ * and stops watching its writeFd.
+ */
+void discard_client_output(EventLoop *loop, ClientInstance *client) {
+    free_output_queue(&client->output);
+    if (client->isWatchingOutput) {
+        unwatch_fd(loop, output_wait_fd(client));
+        client->isWatchingOutput = false;
+    }
+}
+
+/* Stops an event loop writing a client's pending output, which is left
+ * queued for another thread's event loop to write from then on. (see
+ * join_shard() in shard.c)
+ */
+void hand_over_client_output(EventLoop *loop, ClientInstance *client) {
+    if (client->isWatchingOutput) {
+        unwatch_fd(loop, output_wait_fd(client));
+        client->isWatchingOutput = false;
+    }
+    if (!client->isOutputHeld) {
+        return;
+    }
+
+    client->isOutputHeld = false;
+    for (int i = 0; i < loop->numHeld; ++i) {
+        if (loop->heldClients[i] == client) {
+            loop->heldClients[i] = loop->heldClients[--loop->numHeld];
+            break;
+        }
+    }
+}
+
+/* Holds back a client's pending output instead of writing it, until
+ * release_held_output() is next called for the event loop. Output already
+ * being written as the client's stdin becomes writable isn't held.
+ */
+void hold_client_output(EventLoop *loop, ClientInstance *client) {
+    if (client->isOutputHeld || client->isWatchingOutput) {
+        return;
+    }
+
+    client->isOutputHeld = true;
+    loop->heldClients = realloc(loop->heldClients,
+            sizeof(ClientInstance *) * (loop->numHeld + 1));
+    loop->heldClients[loop->numHeld++] = client;
+}
+
+/* Writes the output held back for every client of an event loop, with a
+ * single writev() per client in most cases. (see flush_client_output())
+ */
+void release_held_output(EventLoop *loop) {
+    for (int i = 0; i < loop->numHeld; ++i) {
+        ClientInstance *client = loop->heldClients[i];
+        client->isOutputHeld = false;
+        flush_client_output(loop, client);
+    }
+    loop->numHeld = 0;
+}
+
+/* Lets other threads wake a thread waiting in an event loop by creating an
+ * eventfd the loop watches. Exits with code 1 if it can't be created.
+ */
+void enable_wakeups(EventLoop *loop) {
+    if ((loop->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        perror("eventfd");
+        exit(1);
+    }
+    loop->wakeSource.type = LOOP_WAKE;
+    loop->wakeSource.client = NULL;
+    loop->wakeSource.listener = NULL;
+    watch_fd(loop, loop->wakeFd, EPOLLIN, &loop->wakeSource);
+}
+
+/* Wakes the thread waiting in an event loop, or makes its next wait return
+ * at once if it isn't waiting. May be called from any thread once
+ * enable_wakeups() has been called for the loop.
+ */
+void wake_event_loop(EventLoop *loop) {
+    uint64_t count = 1;
+    write(loop->wakeFd, &count, sizeof(uint64_t));
+}
+
+/* Waits up to timeoutMs milliseconds (-1 to wait indefinitely) for any
+ * watched file descriptor to become ready and handles each one that does.
+ * Everything available from a readable client is read into its input
+ * LineBuffer and pending output is written to a writable client.
+ *
+ * Connections waiting on a watched listener are accepted once every event
+ * has been handled, as accepting them watches more file descriptors.
+ *
+ * The wait also ends once the next deadline armed in the loop's timer wheel
+ * is due, and every deadline due by the time the wait ends is expired.
+ *
+ * Returns the number of events handled.
+ */
+int poll_events(EventLoop *loop, int timeoutMs) {
+    TimerWheel *timers = &loop->timers;
+    if (loop->numWatched == 0 && timers->numArmed == 0) {
+        return 0;
+    }
+
+    /* The wheel is brought up to date first, as timers armed since it was
+     * last advanced may be due further on than a revolution from then.
+     * Should that expire any, the wait doesn't block so they are seen.
+     */
+    if (timers->numArmed > 0) {
+        int numArmed = timers->numArmed;
+        long long nowMs = current_time_ms();
+        advance_timer_wheel(timers, nowMs);
+        int timerMs = timers->numArmed < numArmed ? 0 :
+                next_timer_timeout(timers, nowMs);
+        if (timeoutMs < 0 || (timerMs >= 0 && timerMs < timeoutMs)) {
+            timeoutMs = timerMs;
+        }
+    }
+
+    int numEvents = epoll_wait(loop->epollFd, loop->events,
+            loop->maxEvents > 0 ? loop->maxEvents : 1, timeoutMs);
+    Listener *readyListener = NULL;
+    for (int i = 0; i < numEvents; ++i) {
+        EventSource *source = loop->events[i].data.ptr;
+        if (source->type == CLIENT_INPUT) {
+            read_client_input(loop, source->client);
+        } else if (source->type == CLIENT_SHM_INPUT) {
+            read_shm_input(loop, source->client);
+        } else if (source->type == CLIENT_OUTPUT) {
+            flush_client_output(loop, source->client);
+        } else if (source->type == LOOP_WAKE) {
+            uint64_t count;
+            read(loop->wakeFd, &count, sizeof(uint64_t));
+        } else if (source->type == LISTENER) {
+            readyListener = source->listener;
+        }
+    }
+    if (readyListener != NULL) {
+        accept_connections(readyListener);
+    }
+    if (timers->numArmed > 0) {
+        advance_timer_wheel(timers, current_time_ms());
+    }
+
+    return numEvents < 0 ? 0 : numEvents;
+}
+
+/* Sets whether clients that receive input are added to the event loop's
+ * list of ready clients. Any clients still in the list when tracking is
+ * turned off are removed from it.
+ */
+void track_ready_clients(EventLoop *loop, bool trackReady) {
+    loop->trackReady = trackReady;
+    if (!trackReady) {
+        while (take_ready_client(loop) != NULL) {
+            ;
+        }
+    }
+}
+
+/* Removes a client from the event loop's list of clients that received
+ * input and returns it. Returns NULL if the list is empty.
+ */
+ClientInstance *take_ready_client(EventLoop *loop) {
+    if (loop->numReady == 0) {
+        return NULL;
+    }
+
+    ClientInstance *client = loop->readyClients[--loop->numReady];
+    client->isInputReady = false;
+    return client;
+}
+
+/* Returns the next command a client has sent to the server as a newly
+ * allocated Frame if it has already been read, without waiting. NULL is
+ * returned if it hasn't arrived yet.
+ *
+ * Clients that switched to frames send commands as frames, others as lines
+ * of text. (see text_to_frame()) Mirroring read_file_line(), if the client
+ * closed its stdout, any unterminated last line is handled as a command,
+ * then invalid commands are returned.
+ */
+Frame *take_client_cmd(ClientInstance *client) {
+    if (client->isFramed) {
+        Frame *frame = pop_frame(&client->input, SERVER, client->inputClosed);
+        return frame == NULL && client->inputClosed ? new_invalid_frame() :
+                frame;
+    }
+
+    char *line = pop_line(&client->input);
+    if (line == NULL && client->inputClosed) {
+        if ((line = pop_remainder(&client->input)) == NULL) {
+            line = calloc(1, sizeof(char));
+        }
+    }
+    if (line == NULL) {
+        return NULL;
+    }
+
+    Frame *cmd = text_to_frame(line, SERVER);
+    free(line);
+    return cmd;
+}
+
+/* Returns whether the next command a client has sent to the server has
+ * already been read and is the command opcode given without any fields,
+ * e.g. READY:, without taking it.
+ */
+bool peek_bare_cmd(ClientInstance *client, int opcode) {
+    LineBuffer *input = &client->input;
+    const char *word = get_cmd_word(opcode, SERVER);
+    if (input->len == 0 || word == NULL) {
+        return false;
+    }
+
+    char *next = input->data + input->start;
+    if (client->isFramed) {
+        return next[0] == opcode;
+    }
+    size_t wordLen = strlen(word);
+    return input->len >= wordLen + 2 && !memcmp(next, word, wordLen) &&
+            next[wordLen] == ':' && next[wordLen + 1] == '\n';
+}
+
+/* Returns the next command a client has sent to the server, handling events
+ * for every other watched client until that command has arrived. (see
+ * take_client_cmd())
+ *
+ * NULL is returned instead if the client's turn or line deadline passes
+ * before the command arrives.
+ */
+Frame *wait_client_cmd(EventLoop *loop, ClientInstance *client) {
+    Frame *cmd;
+
+    while ((cmd = take_client_cmd(client)) == NULL) {
+        if (client->turnTimer.hasExpired || client->lineTimer.hasExpired) {
+            return NULL;
+        }
+        poll_events(loop, -1);
+    }
+
+    return cmd;
+}
+
+/* Reads everything currently available from a client's readFd into its
+ * input LineBuffer. If the client closed its stdout, the client is marked as
+ * such and no longer watched, once anything it wrote to its ShmChannel
+ * beforehand has been read too.
+ */
+static void read_client_input(EventLoop *loop, ClientInstance *client) {
+    while (1) {
+        char *dest = reserve_line_buffer(&client->input, CLIENT_READ_SIZE);
+        ssize_t numRead = read(client->readFd, dest, CLIENT_READ_SIZE);
+
+        if (numRead > 0) {
+            commit_line_buffer(&client->input, numRead);
+            mark_client_ready(loop, client);
+        } else if (numRead < 0 && errno == EINTR) {
+            continue;
+        } else {
+            if (numRead == 0 || errno != EAGAIN) {
+                if (client->shm != NULL) {
+                    read_shm_input(loop, client);
+                }
+                client->inputClosed = true;
+                unwatch_fd(loop, client->readFd);
+                mark_client_ready(loop, client);
+            }
+            break;
+        }
+    }
+}
+
+/* Reads everything a client has written to its ShmChannel into its input
+ * LineBuffer, then asks the client to ring its doorbell once it writes more.
+ * The client is woken if it was waiting for space in the channel.
+ */
+static void read_shm_input(EventLoop *loop, ClientInstance *client) {
+    ShmRing *ring = &client->shm->toServer;
+
+    while (1) {
+        char *dest = reserve_line_buffer(&client->input, CLIENT_READ_SIZE);
+        size_t numRead = read_ring(ring, dest, CLIENT_READ_SIZE);
+
+        if (numRead > 0) {
+            commit_line_buffer(&client->input, numRead);
+            mark_client_ready(loop, client);
+            if (take_waiting(&ring->writerWaiting)) {
+                ring_bell(client->shmFds[SHM_CLIENT_BELL]);
+            }
+            continue;
+        }
+
+        // The client may have written more before it saw the flag
+        set_waiting(&ring->readerWaiting);
+        if (is_ring_empty(ring)) {
+            break;
+        }
+    }
+}
+
+/* Returns the file descriptor watched while a client's output is pending,
+ * i.e. its writeFd or, once its output is written to its ShmChannel, the
+ * doorbell it rings as it makes space
+ */
+static int output_wait_fd(ClientInstance *client) {
+    return client->isOutputOnRing ? client->shmFds[SHM_SPACE_BELL] :
+            client->writeFd;
+}
+
+/* Adds a file descriptor to an event loop's epoll instance, reporting the
+ * given events for it with source as their data. Returns false if the file
+ * descriptor couldn't be added.
+ */
+static bool watch_fd(EventLoop *loop, int fd, uint32_t events,
+        EventSource *source) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(struct epoll_event));
+    event.events = events;
+    event.data.ptr = source;
+    if (epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, fd, &event)) {
+        return false;
+    }
+
+    // Grow the events array with the number of watched fds up to a cap
+    if (++loop->numWatched > loop->maxEvents &&
+            loop->maxEvents < MAX_EVENTS_PER_POLL) {
+        loop->maxEvents = loop->numWatched;
+        loop->events = realloc(loop->events,
+                loop->maxEvents * sizeof(struct epoll_event));
+    }
+
+    return true;
+}
+
+/* Removes a file descriptor from an event loop's epoll instance. Does nothing
+ * if it isn't watched.
+ */
+static void unwatch_fd(EventLoop *loop, int fd) {
+    if (fd >= 0 && !epoll_ctl(loop->epollFd, EPOLL_CTL_DEL, fd, NULL)) {
+        loop->numWatched--;
+    }
+}
+
+/* Adds a client to the event loop's list of clients that received input if
+ * the loop is tracking them and the client isn't already in the list.
+ */
+static void mark_client_ready(EventLoop *loop, ClientInstance *client) {
+    if (!loop->trackReady || client->isInputReady) {
+        return;
+    }
+
+    client->isInputReady = true;
+    loop->readyClients = realloc(loop->readyClients,
+            sizeof(ClientInstance *) * (loop->numReady + 1));
+    loop->readyClients[loop->numReady++] = client;
+}
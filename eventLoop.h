@@ -0,0 +1,83 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <stdbool.h>
+#include <sys/epoll.h>
+#include "serverUtils.h"
+#include "timerWheel.h"
+
+/* Struct for the epoll based event loop of a server.
+ *
+ * Every active client's readFd is watched by a single epoll instance, so
+ * output from any client is read into that client's input LineBuffer as soon
+ * as it arrives, regardless of whose turn it is. A client that is slow to
+ * reply therefore never stops the server from draining every other pipe.
+ *
+ * Clients' writeFds are only watched while they have pending output, which
+ * is written as soon as the client's stdin can take it.
+ *
+ * While trackReady is set, every client that receives input (or closes its
+ * stdout) is added once to readyClients, so code waiting on many clients at
+ * once only needs to look at the ones that have something new to say.
+ *
+ * Output can also be held back, i.e. queued without being written, until
+ * release_held_output() writes it all at once. (see --coalesce)
+ *
+ * Deadlines are kept in the loop's timer wheel. Waiting in the loop never
+ * outlasts the next armed deadline, and deadlines that pass are expired as
+ * soon as the loop wakes.
+ *
+ * A listening socket can be watched too, in which case connections are
+ * accepted as they arrive. (see listener.c)
+ *
+ * Once enable_wakeups() has been called, other threads can interrupt a
+ * thread waiting in the loop with wake_event_loop().
+ */
+struct EventLoop {
+    /* File descriptor of the epoll instance */
+    int epollFd;
+    /* Array that epoll_wait() fills with ready events */
+    struct epoll_event *events;
+    /* Number of elements in events */
+    int maxEvents;
+    /* Number of file descriptors currently watched */
+    int numWatched;
+    /* Whether clients receiving input are added to readyClients */
+    bool trackReady;
+    /* Clients that received input since they were last taken */
+    ClientInstance **readyClients;
+    /* Number of clients in readyClients */
+    int numReady;
+    /* Clients whose output is held back until it is released */
+    ClientInstance **heldClients;
+    /* Number of clients in heldClients */
+    int numHeld;
+    /* Deadlines of the loop's clients */
+    TimerWheel timers;
+    /* eventfd used to wake the loop from other threads, -1 if not enabled */
+    int wakeFd;
+    /* Event loop registration for wakeFd */
+    EventSource wakeSource;
+};
+
+EventLoop *init_event_loop();
+void free_event_loop(EventLoop *loop);
+void watch_client(EventLoop *loop, ClientInstance *client);
+void unwatch_client(EventLoop *loop, ClientInstance *client);
+void watch_listener(EventLoop *loop, Listener *listener);
+void unwatch_listener(EventLoop *loop, Listener *listener);
+void flush_client_output(EventLoop *loop, ClientInstance *client);
+void discard_client_output(EventLoop *loop, ClientInstance *client);
+void hand_over_client_output(EventLoop *loop, ClientInstance *client);
+void hold_client_output(EventLoop *loop, ClientInstance *client);
+void release_held_output(EventLoop *loop);
+void enable_wakeups(EventLoop *loop);
+void wake_event_loop(EventLoop *loop);
+int poll_events(EventLoop *loop, int timeoutMs);
+void track_ready_clients(EventLoop *loop, bool trackReady);
+ClientInstance *take_ready_client(EventLoop *loop);
+Frame *take_client_cmd(ClientInstance *client);
+bool peek_bare_cmd(ClientInstance *client, int opcode);
+Frame *wait_client_cmd(EventLoop *loop, ClientInstance *client);
+
+#endif
@@ -0,0 +1,331 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "commands.h"
+#include "frame.h"
+
+static Frame *alloc_frame(int opcode, int numFields, size_t *fieldLens);
+static int decode_len(const unsigned char *bytes, size_t numBytes,
+        size_t *len);
+static size_t encode_len(unsigned char *dest, size_t len);
+static Frame *pop_invalid_frame(LineBuffer *buffer);
+static Frame *reject_line_breaks(Frame *frame);
+
+/* Removes the first complete frame sent to a client (if sentTo is 0) or
+ * server (if sentTo is 1) from a LineBuffer and returns it decoded as a
+ * newly allocated Frame.
+ *
+ * NULL is returned if the buffer doesn't contain a complete frame. If
+ * isClosed is set, i.e. no more bytes will be added to the buffer, an
+ * incomplete frame is removed and returned as an invalid one instead. A
+ * frame with an unknown opcode or malformed length can't be skipped, so
+ * everything buffered is removed along with it. A frame with a '\n' in a
+ * field is removed and returned as an invalid one too.
+ */
+Frame *pop_frame(LineBuffer *buffer, int sentTo, bool isClosed) {
+    if (buffer->len == 0) {
+        return NULL;
+    }
+
+    const unsigned char *bytes = (unsigned char *) buffer->data +
+            buffer->start;
+    int opcode = bytes[0];
+    int numFields = get_cmd_num_fields(opcode, sentTo);
+    if (numFields < 0) {
+        return pop_invalid_frame(buffer);
+    }
+
+    // Find every field from the lengths before it, without copying anything
+    size_t fieldStarts[FRAME_MAX_FIELDS];
+    size_t fieldLens[FRAME_MAX_FIELDS];
+    size_t frameLen = 1;
+    for (int i = 0; i < numFields; ++i) {
+        int lenBytes = decode_len(bytes + frameLen, buffer->len - frameLen,
+                &fieldLens[i]);
+        if (lenBytes < 0) {
+            return pop_invalid_frame(buffer);
+        }
+        fieldStarts[i] = frameLen + lenBytes;
+        if (lenBytes == 0 || buffer->len - fieldStarts[i] < fieldLens[i]) {
+            return isClosed ? pop_invalid_frame(buffer) : NULL;
+        }
+        frameLen = fieldStarts[i] + fieldLens[i];
+    }
+
+    Frame *frame = alloc_frame(opcode, numFields, fieldLens);
+    for (int i = 0; i < numFields; ++i) {
+        memcpy(frame->fields[i], bytes + fieldStarts[i], fieldLens[i]);
+    }
+    frame->wireLen = frameLen;
+    skip_line_buffer(buffer, frameLen);
+
+    return reject_line_breaks(frame);
+}
+
+/* Reads a frame sent to a client (if sentTo is 0) or server (if sentTo is 1)
+ * from stream and returns it as a newly allocated Frame, waiting for all of
+ * it to arrive.
+ *
+ * NULL is returned if stream reached EOF before the frame began. A frame cut
+ * short by EOF, with an unknown opcode, with a malformed length or with a
+ * '\n' in a field is returned as an invalid frame.
+ */
+Frame *read_frame(FILE *stream, int sentTo) {
+    int opcode = getc(stream);
+    if (opcode == EOF) {
+        return NULL;
+    }
+
+    int numFields = get_cmd_num_fields(opcode, sentTo);
+    if (numFields < 0) {
+        return new_invalid_frame();
+    }
+
+    // Fields are read into a growing buffer, as lengths only come one by one
+    size_t fieldLens[FRAME_MAX_FIELDS];
+    char *fieldData = NULL;
+    size_t dataLen = 0;
+    bool isValid = true;
+    for (int i = 0; isValid && i < numFields; ++i) {
+        unsigned char lenBytes[FRAME_MAX_LEN_BYTES];
+        int numLenBytes = 0;
+        int nextByte;
+        do {
+            nextByte = getc(stream);
+            if (nextByte != EOF) {
+                lenBytes[numLenBytes++] = nextByte;
+            }
+        } while (nextByte != EOF && (nextByte & 0x80) &&
+                numLenBytes < FRAME_MAX_LEN_BYTES);
+
+        isValid = decode_len(lenBytes, numLenBytes, &fieldLens[i]) > 0;
+        if (isValid) {
+            fieldData = realloc(fieldData, dataLen + fieldLens[i]);
+            isValid = fread(fieldData + dataLen, 1, fieldLens[i], stream) ==
+                    fieldLens[i];
+            dataLen += fieldLens[i];
+        }
+    }
+
+    if (!isValid) {
+        free(fieldData);
+        return new_invalid_frame();
+    }
+
+    Frame *frame = alloc_frame(opcode, numFields, fieldLens);
+    size_t offset = 0;
+    for (int i = 0; i < numFields; ++i) {
+        memcpy(frame->fields[i], fieldData + offset, fieldLens[i]);
+        offset += fieldLens[i];
+    }
+    frame->wireLen = frame_size(numFields, fieldLens);
+    free(fieldData);
+
+    return reject_line_breaks(frame);
+}
+
+/* Parses a command sent as a line of text to a client (if sentTo is 0) or
+ * server (if sentTo is 1) into a newly allocated Frame, so commands are
+ * handled the same way whichever form they arrive in.
+ *
+ * The line is split on ':' exactly as per get_cmd_str(). The frame is
+ * invalid if the command is empty, unknown, or one word long and not
+ * terminated with a ':'. Its number of fields is left for the caller to
+ * check.
+ */
+Frame *text_to_frame(char *line, int sentTo) {
+    size_t lineLen = strlen(line);
+    Frame *frame = malloc(sizeof(Frame) + lineLen + 1);
+    memcpy(frame->data, line, lineLen + 1);
+    frame->numFields = 0;
+    frame->wireLen = lineLen + 1;
+
+    char *savePtr;
+    char *cmdName = strtok_r(frame->data, ":", &savePtr);
+    if (cmdName == NULL) {
+        frame->opcode = -1;
+        return frame;
+    }
+    frame->opcode = get_cmd(cmdName, sentTo);
+
+    char *field;
+    while ((field = strtok_r(NULL, ":", &savePtr)) != NULL) {
+        if (frame->numFields < FRAME_MAX_FIELDS) {
+            frame->fields[frame->numFields] = field;
+        }
+        frame->numFields++;
+    }
+
+    if (frame->numFields == 0 && line[lineLen - 1] != ':') {
+        frame->opcode = -1;
+    }
+
+    return frame;
+}
+
+/* Returns a newly allocated invalid Frame, i.e. for a command that couldn't
+ * be read
+ */
+Frame *new_invalid_frame() {
+    Frame *frame = malloc(sizeof(Frame));
+    frame->opcode = -1;
+    frame->numFields = 0;
+    frame->wireLen = 0;
+
+    return frame;
+}
+
+/* Returns the number of bytes a frame with numFields fields, of the lengths
+ * in fieldLens, takes up on the wire
+ */
+size_t frame_size(int numFields, size_t *fieldLens) {
+    unsigned char lenBytes[FRAME_MAX_LEN_BYTES];
+    size_t size = 1;
+
+    for (int i = 0; i < numFields; ++i) {
+        size += encode_len(lenBytes, fieldLens[i]) + fieldLens[i];
+    }
+
+    return size;
+}
+
+/* Encodes a frame with the given opcode and numFields fields, of the lengths
+ * in fieldLens, into dest and returns the number of bytes written. dest must
+ * have room for frame_size() bytes.
+ */
+size_t encode_frame(char *dest, int opcode, int numFields, char **fields,
+        size_t *fieldLens) {
+    size_t size = 0;
+    dest[size++] = opcode;
+
+    for (int i = 0; i < numFields; ++i) {
+        size += encode_len((unsigned char *) dest + size, fieldLens[i]);
+        memcpy(dest + size, fields[i], fieldLens[i]);
+        size += fieldLens[i];
+    }
+
+    return size;
+}
+
+/* Writes a frame with the given opcode and numFields fields, each a string,
+ * to stream. The stream isn't flushed.
+ */
+void write_frame(FILE *stream, int opcode, int numFields, char **fields) {
+    unsigned char lenBytes[FRAME_MAX_LEN_BYTES];
+    putc(opcode, stream);
+
+    for (int i = 0; i < numFields; ++i) {
+        size_t fieldLen = strlen(fields[i]);
+        fwrite(lenBytes, 1, encode_len(lenBytes, fieldLen), stream);
+        fwrite(fields[i], 1, fieldLen, stream);
+    }
+}
+
+/* Returns whether caps, a comma-separated list of capabilities such as the
+ * value of FRAME_CAPS_ENV, names the capability cap. caps may be NULL, i.e.
+ * if no capabilities are offered.
+ */
+bool has_capability(const char *caps, const char *cap) {
+    size_t capLen = strlen(cap);
+
+    while (caps != NULL && *caps != '\0') {
+        const char *end = strchr(caps, ',');
+        size_t len = end == NULL ? strlen(caps) : (size_t) (end - caps);
+        if (len == capLen && !strncmp(caps, cap, capLen)) {
+            return true;
+        }
+        caps = end == NULL ? NULL : end + 1;
+    }
+    return false;
+}
+
+/* Allocates a Frame with room for numFields fields of the lengths in
+ * fieldLens, each already terminated by a '\0', for the caller to copy the
+ * fields into.
+ */
+static Frame *alloc_frame(int opcode, int numFields, size_t *fieldLens) {
+    size_t dataLen = 0;
+    for (int i = 0; i < numFields; ++i) {
+        dataLen += fieldLens[i] + 1;
+    }
+
+    Frame *frame = malloc(sizeof(Frame) + dataLen);
+    frame->opcode = opcode;
+    frame->numFields = numFields;
+    char *field = frame->data;
+    for (int i = 0; i < numFields; ++i) {
+        frame->fields[i] = field;
+        field[fieldLens[i]] = '\0';
+        field += fieldLens[i] + 1;
+    }
+
+    return frame;
+}
+
+/* Decodes the length of a field from the numBytes bytes at bytes into len
+ * and returns the number of bytes it took up. 0 is returned if the length
+ * continues past the bytes given, and -1 if it is malformed, i.e. longer
+ * than FRAME_MAX_LEN_BYTES bytes.
+ */
+static int decode_len(const unsigned char *bytes, size_t numBytes,
+        size_t *len) {
+    *len = 0;
+
+    for (int i = 0; i < FRAME_MAX_LEN_BYTES; ++i) {
+        if (i == numBytes) {
+            return 0;
+        }
+        *len |= (size_t) (bytes[i] & 0x7f) << (7 * i);
+        if (!(bytes[i] & 0x80)) {
+            return i + 1;
+        }
+    }
+
+    return -1;
+}
+
+/* Encodes a field length len into dest, which must have room for
+ * FRAME_MAX_LEN_BYTES bytes, and returns the number of bytes written
+ */
+static size_t encode_len(unsigned char *dest, size_t len) {
+    size_t numBytes = 0;
+
+    do {
+        dest[numBytes] = len & 0x7f;
+        len >>= 7;
+        if (len > 0) {
+            dest[numBytes] |= 0x80;
+        }
+        numBytes++;
+    } while (len > 0);
+
+    return numBytes;
+}
+
+/* Removes everything buffered in a LineBuffer, as the frame at its front
+ * can't be read, and returns an invalid frame in its place
+ */
+static Frame *pop_invalid_frame(LineBuffer *buffer) {
+    Frame *frame = new_invalid_frame();
+    frame->wireLen = buffer->len;
+    skip_line_buffer(buffer, buffer->len);
+    return frame;
+}
+
+/* Returns frame, or an invalid frame in its place (freeing frame) if any of
+ * its fields contains a '\n'. Every command is sent on to text clients as a
+ * line, so such a field would split it into lines of the sender's choosing.
+ */
+static Frame *reject_line_breaks(Frame *frame) {
+    int numKept = frame->numFields < FRAME_MAX_FIELDS ? frame->numFields :
+            FRAME_MAX_FIELDS;
+    for (int i = 0; i < numKept; ++i) {
+        if (strchr(frame->fields[i], '\n') != NULL) {
+            Frame *invalid = new_invalid_frame();
+            invalid->wireLen = frame->wireLen;
+            free(frame);
+            return invalid;
+        }
+    }
+    return frame;
+}
@@ -0,0 +1,86 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "lineBuffer.h"
+
+/* Environment variable in which a server tells the clients it starts which
+ * capabilities it accepts, as a comma-separated list of them, e.g.
+ * FRAME_CAPABILITY if it was started with --binary.
+ */
+#define FRAME_CAPS_ENV "CHAT_SERVER_CAPS"
+
+/* Extra field a client adds to its first reply to WHO:, i.e.
+ * NAME:<name>:binary, to switch to frames. Everything either side sends
+ * after that reply is a frame.
+ *
+ * A client naming more than one capability lists them in that field
+ * separated by commas, e.g. NAME:<name>:binary,ready.
+ */
+#define FRAME_CAPABILITY "binary"
+
+/* Capability a client names in its first reply to WHO: to tell the server
+ * when it has something to say, rather than being sent YT: every round (see
+ * --ready-fallback). Such a client sends READY: whenever it comes to have
+ * something to say, and is taken to have nothing left once it is sent YT:.
+ */
+#define READY_CAPABILITY "ready"
+
+/* Every opcode is below this byte, which no command's name starts with, so
+ * a client that switched to frames can tell a frame from a line of text the
+ * server sent before it saw the switch
+ */
+#define FRAME_OPCODE_LIMIT 0x20
+
+/* Largest number of fields any command has */
+#define FRAME_MAX_FIELDS 2
+
+/* Largest number of bytes the length of a field takes up in a frame, so
+ * fields are shorter than 2^28 bytes
+ */
+#define FRAME_MAX_LEN_BYTES 4
+
+/* A command read from a client or server, either decoded from a frame or
+ * parsed from a line of text. (see text_to_frame())
+ *
+ * On the wire, a frame is a single opcode byte followed by each field of the
+ * command as its length in bytes (7 bits per byte, least significant first,
+ * the top bit set on every byte but the last) and then the bytes themselves.
+ * The opcode is the command's index in clientCmdWords or serverCmdWords
+ * (see commands.c), which also fixes its number of fields, so frames are
+ * read without searching for delimiters and fields may contain any byte but
+ * '\n', which would split the line the command is sent on to text clients
+ * as. A frame with a '\n' in a field is invalid.
+ */
+typedef struct {
+    /* Index of the command in clientCmdWords or serverCmdWords, -1 if the
+     * command is invalid
+     */
+    int opcode;
+    /* Number of fields following the command's name. Only the first
+     * FRAME_MAX_FIELDS of them are kept in fields.
+     */
+    int numFields;
+    /* Number of bytes the command took up as it was read, i.e. the length
+     * of its frame or of its line including the '\n'
+     */
+    size_t wireLen;
+    /* The fields, each terminated by a '\0' and pointing into data */
+    char *fields[FRAME_MAX_FIELDS];
+    /* Storage of the fields */
+    char data[];
+} Frame;
+
+Frame *pop_frame(LineBuffer *buffer, int sentTo, bool isClosed);
+Frame *read_frame(FILE *stream, int sentTo);
+Frame *text_to_frame(char *line, int sentTo);
+Frame *new_invalid_frame();
+size_t frame_size(int numFields, size_t *fieldLens);
+size_t encode_frame(char *dest, int opcode, int numFields, char **fields,
+        size_t *fieldLens);
+void write_frame(FILE *stream, int opcode, int numFields, char **fields);
+bool has_capability(const char *caps, const char *cap);
+
+#endif
@@ -4,6 +4,9 @@
 #include "commands.h"
 #include "clientData.h"
 #include "genericClient.h"
+#include "shmClient.h"
+#include "frame.h"
+#include "probes.h"
 
 /* Enumerated enum values corresponding to valid commands a client
  * can receive.
@@ -21,6 +24,8 @@ typedef enum {
 } ClientCmds;
 
 static FILE *get_script(ClientData *data, char *path);
+static LineList *read_server_cmd(ClientData *data, bool *invalidCmd,
+        bool *isLineEmpty);
 static void handle_cmd(ClientData *data, LineList *cmdLines, bool invalidCmd);
 static void handle_who(ClientData *data);
 static void handle_name_taken(ClientData *data);
@@ -36,10 +41,20 @@ static void handle_comms_error(ClientData *data);
  * Throws usage error if the number of command-line arguments are incorrect
  * (!= 2).
  *
+ * If the server offered the client shared memory to talk over, the client's
+ * stdin and stdout are switched over to it first. (see shmClient.c) Whether
+ * the server accepts frames or READY: is read from the client's environment
+ * too.
+ *
  * Returns a pointer to the LineList representation of the script.
  */
 LineList *setup_client(ClientData *data,
         int argc, char **argv) {
+    attach_shm_transport();
+    char *serverCaps = getenv(FRAME_CAPS_ENV);
+    data->isFramingOffered = has_capability(serverCaps, FRAME_CAPABILITY);
+    data->isReadyOffered = data->config.tellsReady &&
+            has_capability(serverCaps, READY_CAPABILITY);
 
     // Quit with usage error if incorrect no. of commandline args given
     if (argc != 2) {
@@ -68,7 +83,8 @@ void run_client(ClientData *data) {
     while (1) {
         invalidCmd = false;
         isLineEmpty = false;
-        LineList *currentCmd = get_cmd_stdin(&invalidCmd, &isLineEmpty);
+        LineList *currentCmd = read_server_cmd(data, &invalidCmd,
+                &isLineEmpty);
 
         /* The line read from stdin is checked if it is empty (contains only
          * EOF) to ensure that the client does not attempt to handle a command
@@ -102,6 +118,42 @@ static FILE *get_script(ClientData *data, char *path) {
     return script;
 }
 
+/* Reads a command from stdin and returns it as a LineList as per
+ * get_cmd_stdin(), setting the flags invalidCmd and isLineEmpty likewise.
+ *
+ * Once the client has switched to frames, commands the server sent as frames
+ * are decoded into the same LineList, whose first line is the command's
+ * name. Lines the server sent before it saw the switch are still read as
+ * text. (see FRAME_OPCODE_LIMIT)
+ */
+static LineList *read_server_cmd(ClientData *data, bool *invalidCmd,
+        bool *isLineEmpty) {
+    int firstByte = data->isFramed ? getc(stdin) : EOF;
+    if (firstByte == EOF || firstByte >= FRAME_OPCODE_LIMIT) {
+        if (firstByte != EOF) {
+            ungetc(firstByte, stdin);
+        }
+        return get_cmd_stdin(invalidCmd, isLineEmpty);
+    }
+
+    ungetc(firstByte, stdin);
+    Frame *frame = read_frame(stdin, CLIENT);
+    LineList *cmdLines = init_line_list();
+    if (frame->opcode < 0) {
+        // Leave a name for handle_cmd() to look up
+        add_to_lines(cmdLines, "");
+        *invalidCmd = true;
+    } else {
+        add_to_lines(cmdLines, (char *) get_cmd_word(frame->opcode, CLIENT));
+        for (int i = 0; i < frame->numFields; ++i) {
+            add_to_lines(cmdLines, frame->fields[i]);
+        }
+    }
+    free(frame);
+
+    return cmdLines;
+}
+
 /*
  * Handles a command from stdin in LineList representation as returned
  * by get_cmd_stdin(bool *invalidCmd)
@@ -117,6 +169,7 @@ static void handle_cmd(ClientData *data, LineList *cmdLines, bool invalidCmd) {
     const int numCmdArgs[] = {1, 1, 1, 1, 3, 2};
 
     int cmdNum = get_cmd(cmdLines->lines[0], CLIENT);
+    PROBE2(server_cmd, cmdNum, invalidCmd);
 
     // Check cmd is not invalid and number of arguments for the cmd is correct
     if (invalidCmd || cmdNum < 0 ||
@@ -164,14 +217,48 @@ char *get_name(ClientData *data) {
 
 /* Handler for the WHO: command. Emits the name of the client to stdout,
  * including the number of the client, i.e. client0, client1 when the client
- * has received NAME_TAKEN: once or more from the server */
+ * has received NAME_TAKEN: once or more from the server.
+ *
+ * If the server accepts frames, the client's first reply switches it to
+ * them. (see FRAME_CAPABILITY) The client takes up READY_CAPABILITY in that
+ * reply too, if it is offered and the client can. */
 static void handle_who(ClientData *data) {
     char *name = get_name(data);
-    printf("NAME:%s\n", name);
+    char caps[sizeof(FRAME_CAPABILITY) + sizeof(READY_CAPABILITY)] = "";
+    if (data->isFramingOffered && !data->isFramed) {
+        strcat(caps, FRAME_CAPABILITY);
+        data->isFramed = true;
+    }
+    if (data->isReadyOffered && !data->signalsReady) {
+        strcat(caps, caps[0] == '\0' ? READY_CAPABILITY :
+                "," READY_CAPABILITY);
+        data->signalsReady = true;
+    }
+
+    if (caps[0] != '\0') {
+        printf("NAME:%s:%s\n", name, caps);
+    } else {
+        emit_cmd(data, "NAME", name);
+    }
     fflush(stdout);
     free(name);
 }
 
+/* Emits the command cmdName to stdout, with the single argument arg or none
+ * if arg is NULL, i.e. CHAT:<arg> or DONE:. The command is written as a frame
+ * if the client has switched to frames. stdout isn't flushed.
+ */
+void emit_cmd(ClientData *data, char *cmdName, char *arg) {
+    if (data->isFramed) {
+        write_frame(stdout, get_cmd(cmdName, SERVER), arg == NULL ? 0 : 1,
+                &arg);
+    } else if (arg == NULL) {
+        printf("%s:\n", cmdName);
+    } else {
+        printf("%s:%s\n", cmdName, arg);
+    }
+}
+
 /* Handler for the NAME_TAKEN: command. Increments the number of the client.
  * i.e. client with name client0 would change its name to client1
  */
@@ -17,6 +17,7 @@ LineList *setup_client(ClientData *data, int argc,
         char **argv);
 char *get_name(ClientData *data);
 void run_client();
+void emit_cmd(ClientData *data, char *cmdName, char *arg);
 void client_exit(ClientData *data, int exitCode, char *msg);
 void handle_msg_and_left(LineList *cmd);
 
@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <string.h>
+#include "outputQueue.h"
+#include "history.h"
+
+static void evict_oldest(History *history);
+static void copy_to_arena(History *history, size_t position,
+        const char *src, size_t len);
+static void copy_from_arena(History *history, char *dest, size_t position,
+        size_t len);
+
+/* Initializes and allocates memory for a History keeping up to capacity
+ * events and returns a pointer to it.
+ */
+History *new_history(int capacity) {
+    History *history = malloc(sizeof(History));
+    history->arenaSize = (size_t) capacity * HISTORY_BYTES_PER_EVENT;
+    history->arena = malloc(history->arenaSize);
+    history->starts = malloc(sizeof(size_t) * capacity);
+    history->capacity = capacity;
+    history->first = 0;
+    history->numEvents = 0;
+    history->head = 0;
+    history->tail = 0;
+
+    return history;
+}
+
+/* Frees memory allocated to a History */
+void free_history(History *history) {
+    free(history->arena);
+    free(history->starts);
+    free(history);
+}
+
+/* Appends a copy of an event, a message just sent to every client, to a
+ * History, evicting the oldest events to make room for it. If history is
+ * NULL, i.e. the server wasn't started with --history, this does nothing.
+ *
+ * An event too large for the whole arena can't be kept, so the history is
+ * emptied instead, as it is never left with a gap in it.
+ */
+void record_history(History *history, SharedMsg *event) {
+    if (history == NULL) {
+        return;
+    }
+    while (history->numEvents > 0 && (history->numEvents ==
+            history->capacity ||
+            history->tail - history->head + event->len >
+            history->arenaSize)) {
+        evict_oldest(history);
+    }
+    if (event->len > history->arenaSize) {
+        return;
+    }
+
+    int last = (history->first + history->numEvents) % history->capacity;
+    history->starts[last] = history->tail;
+    history->numEvents++;
+
+    copy_to_arena(history, history->tail, event->data, event->len);
+    history->tail += event->len;
+}
+
+/* Returns every event in a History, oldest first, as a single newly
+ * allocated SharedMsg so they can be replayed with one write, or NULL if
+ * history is NULL or has no events.
+ */
+SharedMsg *copy_history(History *history) {
+    if (history == NULL || history->numEvents == 0) {
+        return NULL;
+    }
+
+    size_t len = history->tail - history->head;
+    SharedMsg *events = alloc_shared_msg(len);
+    copy_from_arena(history, events->data, history->head, len);
+
+    return events;
+}
+
+/* Evicts the oldest event from a History with at least one event */
+static void evict_oldest(History *history) {
+    history->first = (history->first + 1) % history->capacity;
+    history->numEvents--;
+    history->head = history->numEvents == 0 ? history->tail :
+            history->starts[history->first];
+}
+
+/* Copies len bytes from src into a History's arena at position, wrapping
+ * around the end of the arena if need be
+ */
+static void copy_to_arena(History *history, size_t position,
+        const char *src, size_t len) {
+    size_t offset = position % history->arenaSize;
+    size_t firstLen = history->arenaSize - offset < len ?
+            history->arenaSize - offset : len;
+    memcpy(history->arena + offset, src, firstLen);
+    memcpy(history->arena, src + firstLen, len - firstLen);
+}
+
+/* Copies len bytes of a History's arena from position into dest, wrapping
+ * around the end of the arena if need be
+ */
+static void copy_from_arena(History *history, char *dest, size_t position,
+        size_t len) {
+    size_t offset = position % history->arenaSize;
+    size_t firstLen = history->arenaSize - offset < len ?
+            history->arenaSize - offset : len;
+    memcpy(dest, history->arena + offset, firstLen);
+    memcpy(dest + firstLen, history->arena, len - firstLen);
+}
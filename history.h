@@ -0,0 +1,46 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+#include "outputQueue.h"
+
+/* Number of bytes of arena a History is given per event it keeps, so long
+ * messages mean fewer events are kept rather than more memory being used
+ */
+#define HISTORY_BYTES_PER_EVENT 256
+
+/* Struct storing the most recent MSG: and LEFT: events of the chat, to be
+ * replayed to clients that join it late. (see --history)
+ *
+ * Each event is kept exactly as it was sent, i.e. as a line of text, in a
+ * circular arena of fixed size, so the history never allocates once it is
+ * created and the events kept are always contiguous in it (wrapping around
+ * at most once). Positions in the arena only ever grow, and are taken
+ * modulo arenaSize to index it. The oldest events are evicted once either
+ * capacity events are kept or the arena is full.
+ */
+typedef struct {
+    /* Arena holding every event kept, oldest first */
+    char *arena;
+    /* Number of bytes allocated to arena */
+    size_t arenaSize;
+    /* Circular array of the positions every event kept starts at */
+    size_t *starts;
+    /* Number of elements allocated to starts, i.e. events kept at most */
+    int capacity;
+    /* Index in starts of the oldest event */
+    int first;
+    /* Number of events kept */
+    int numEvents;
+    /* Position the oldest event starts at */
+    size_t head;
+    /* Position just after the newest event */
+    size_t tail;
+} History;
+
+History *new_history(int capacity);
+void free_history(History *history);
+void record_history(History *history, SharedMsg *event);
+SharedMsg *copy_history(History *history);
+
+#endif
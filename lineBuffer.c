@@ -0,0 +1,127 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lineBuffer.h"
+
+/* Initial number of bytes allocated to a LineBuffer once it is first used */
+#define LINE_BUFFER_MIN_CAP 256
+
+/* Initializes an empty LineBuffer. No memory is allocated until bytes are
+ * first reserved.
+ */
+void init_line_buffer(LineBuffer *buffer) {
+    buffer->data = NULL;
+    buffer->start = 0;
+    buffer->len = 0;
+    buffer->scanned = 0;
+    buffer->cap = 0;
+}
+
+/* Frees memory allocated to the bytes of a LineBuffer and empties it */
+void free_line_buffer(LineBuffer *buffer) {
+    free(buffer->data);
+    init_line_buffer(buffer);
+}
+
+/* Makes room for numBytes more bytes at the end of a LineBuffer and returns
+ * a pointer to where they should be written. The bytes are only added to the
+ * buffer once commit_line_buffer() is called.
+ */
+char *reserve_line_buffer(LineBuffer *buffer, size_t numBytes) {
+    // Move buffered bytes to the front before growing the allocation
+    if (buffer->start > 0 && buffer->start + buffer->len + numBytes >
+            buffer->cap) {
+        memmove(buffer->data, buffer->data + buffer->start, buffer->len);
+        buffer->start = 0;
+    }
+
+    if (buffer->len + numBytes > buffer->cap) {
+        size_t newCap = buffer->cap < LINE_BUFFER_MIN_CAP ?
+                LINE_BUFFER_MIN_CAP : buffer->cap;
+        while (newCap < buffer->len + numBytes) {
+            newCap *= 2;
+        }
+        buffer->data = realloc(buffer->data, newCap);
+        buffer->cap = newCap;
+    }
+
+    return buffer->data + buffer->start + buffer->len;
+}
+
+/* Adds numBytes bytes previously written to the space returned by
+ * reserve_line_buffer() to a LineBuffer
+ */
+void commit_line_buffer(LineBuffer *buffer, size_t numBytes) {
+    buffer->len += numBytes;
+}
+
+/* Copies numBytes bytes to the end of a LineBuffer */
+void append_line_buffer(LineBuffer *buffer, const char *bytes,
+        size_t numBytes) {
+    memcpy(reserve_line_buffer(buffer, numBytes), bytes, numBytes);
+    commit_line_buffer(buffer, numBytes);
+}
+
+/* Removes the first complete line from a LineBuffer and returns it as a newly
+ * allocated string without its trailing '\n'.
+ *
+ * NULL is returned if the buffer doesn't contain a complete line.
+ */
+char *pop_line(LineBuffer *buffer) {
+    if (buffer->len == 0) {
+        return NULL;
+    }
+
+    char *lineStart = buffer->data + buffer->start;
+    char *newline = memchr(lineStart + buffer->scanned, '\n',
+            buffer->len - buffer->scanned);
+
+    if (newline == NULL) {
+        buffer->scanned = buffer->len;
+        return NULL;
+    }
+
+    size_t lineLen = newline - lineStart;
+    char *line = malloc(lineLen + 1);
+    memcpy(line, lineStart, lineLen);
+    line[lineLen] = '\0';
+
+    buffer->start += lineLen + 1;
+    buffer->len -= lineLen + 1;
+    buffer->scanned = 0;
+
+    return line;
+}
+
+/* Removes the first numBytes bytes from a LineBuffer without returning
+ * them, e.g. once they have been decoded by the caller in place.
+ */
+void skip_line_buffer(LineBuffer *buffer, size_t numBytes) {
+    buffer->start += numBytes;
+    buffer->len -= numBytes;
+    buffer->scanned = 0;
+    if (buffer->len == 0) {
+        buffer->start = 0;
+    }
+}
+
+/* Removes all bytes from a LineBuffer and returns them as a newly allocated
+ * string. Used to retrieve the last line of a stream which isn't terminated
+ * by '\n'.
+ *
+ * NULL is returned if the buffer is empty.
+ */
+char *pop_remainder(LineBuffer *buffer) {
+    if (buffer->len == 0) {
+        return NULL;
+    }
+
+    char *line = malloc(buffer->len + 1);
+    memcpy(line, buffer->data + buffer->start, buffer->len);
+    line[buffer->len] = '\0';
+
+    buffer->start = 0;
+    buffer->len = 0;
+    buffer->scanned = 0;
+
+    return line;
+}
@@ -0,0 +1,37 @@
+#ifndef LINEBUFFER_H
+#define LINEBUFFER_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/* Struct used to assemble lines from bytes that arrive in arbitrary chunks,
+ * i.e. from non-blocking reads of a pipe.
+ *
+ * Bytes data[start, start + len) are buffered and not yet returned as a line.
+ * scanned is the number of those bytes already known not to contain '\n', so
+ * each byte is only ever searched once.
+ */
+typedef struct {
+    /* Buffered bytes */
+    char *data;
+    /* Offset of the first buffered byte in data */
+    size_t start;
+    /* Number of buffered bytes */
+    size_t len;
+    /* Number of buffered bytes known not to contain '\n' */
+    size_t scanned;
+    /* Number of bytes allocated to data */
+    size_t cap;
+} LineBuffer;
+
+void init_line_buffer(LineBuffer *buffer);
+void free_line_buffer(LineBuffer *buffer);
+char *reserve_line_buffer(LineBuffer *buffer, size_t numBytes);
+void commit_line_buffer(LineBuffer *buffer, size_t numBytes);
+void append_line_buffer(LineBuffer *buffer, const char *bytes,
+        size_t numBytes);
+char *pop_line(LineBuffer *buffer);
+void skip_line_buffer(LineBuffer *buffer, size_t numBytes);
+char *pop_remainder(LineBuffer *buffer);
+
+#endif
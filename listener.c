@@ -0,0 +1,164 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include "serverUtils.h"
+#include "serverOptions.h"
+#include "eventLoop.h"
+#include "listener.h"
+#include "probes.h"
+
+static int open_listening_socket(ServerOptions *options);
+static void add_joiner(Listener *listener, int connFd);
+
+/* Starts listening on the socket given by the options of chatMembers (see
+ * --listen) and returns a pointer to a newly allocated Listener struct for
+ * it, watched by the server's event loop. Exits with code 1 if the socket
+ * can't be bound or listened on.
+ */
+Listener *start_listener(ClientList *chatMembers) {
+    ServerOptions *options = chatMembers->options;
+    Listener *listener = malloc(sizeof(Listener));
+    listener->fd = open_listening_socket(options);
+    listener->path = options->listenType == LISTEN_UNIX ?
+            strdup(options->listenPath) : NULL;
+    listener->chatMembers = chatMembers;
+    listener->joiners = NULL;
+    listener->numJoiners = 0;
+
+    watch_listener(chatMembers->loop, listener);
+
+    return listener;
+}
+
+/* Stops listening, closes the connection of every client yet to join the
+ * chat and frees memory allocated to a Listener struct. A Unix-domain
+ * socket's path is removed.
+ */
+void stop_listener(Listener *listener) {
+    for (int i = 0; i < listener->numJoiners; ++i) {
+        drop_joiner(listener, listener->joiners[i]);
+    }
+    unwatch_listener(listener->chatMembers->loop, listener);
+    close(listener->fd);
+    if (listener->path != NULL) {
+        unlink(listener->path);
+    }
+    free(listener->path);
+    free(listener->joiners);
+    free(listener);
+}
+
+/* Accepts connections waiting on a listener's socket, up to
+ * MAX_ACCEPTS_PER_POLL of them, and sends each new client WHO:. Called by
+ * the event loop when the socket is readable; any connections left over are
+ * accepted the next time it is.
+ */
+void accept_connections(Listener *listener) {
+    for (int i = 0; i < MAX_ACCEPTS_PER_POLL; ++i) {
+        int connFd = accept4(listener->fd, NULL, NULL,
+                SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (connFd >= 0) {
+            add_joiner(listener, connFd);
+        } else if (errno != EINTR && errno != ECONNABORTED) {
+            break;
+        }
+    }
+}
+
+/* Closes the connection of a client yet to join the chat and frees it, e.g.
+ * if it gave an invalid reply to WHO:. The caller removes it from the
+ * listener's joiners.
+ */
+void drop_joiner(Listener *listener, ClientInstance *joiner) {
+    EventLoop *loop = listener->chatMembers->loop;
+    unwatch_client(loop, joiner);
+    discard_client_output(loop, joiner);
+    cancel_client_deadlines(listener->chatMembers, joiner);
+    free_client_instance(joiner);
+}
+
+/* Creates, binds and listens on the socket given by a server's options and
+ * returns its file descriptor. Exits with code 1 if any step fails.
+ */
+static int open_listening_socket(ServerOptions *options) {
+    int family = options->listenType == LISTEN_UNIX ? AF_UNIX : AF_INET;
+    int sockFd = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+            0);
+    if (sockFd < 0) {
+        perror("socket");
+        exit(1);
+    }
+
+    int bound;
+    if (options->listenType == LISTEN_UNIX) {
+        struct sockaddr_un address;
+        memset(&address, 0, sizeof(struct sockaddr_un));
+        address.sun_family = AF_UNIX;
+        if (strlen(options->listenPath) >= sizeof(address.sun_path)) {
+            fprintf(stderr, "bind: %s: path too long\n",
+                    options->listenPath);
+            exit(1);
+        }
+        strcpy(address.sun_path, options->listenPath);
+        bound = bind(sockFd, (struct sockaddr *) &address,
+                sizeof(struct sockaddr_un));
+    } else {
+        // Let a restarted server reuse its port straight away
+        int reuse = 1;
+        setsockopt(sockFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(int));
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(struct sockaddr_in));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(options->listenPort);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bound = bind(sockFd, (struct sockaddr *) &address,
+                sizeof(struct sockaddr_in));
+    }
+
+    if (bound || listen(sockFd, SOMAXCONN)) {
+        perror(bound ? "bind" : "listen");
+        exit(1);
+    }
+
+    return sockFd;
+}
+
+/* Creates a client for a connection just accepted by a listener, adds it to
+ * the listener's joiners and sends it WHO:.
+ *
+ * The client reads from and writes to its own copies of the connection, so
+ * its stdin can be closed on its own. (see close_client_stdin())
+ */
+static void add_joiner(Listener *listener, int connFd) {
+    ClientList *chatMembers = listener->chatMembers;
+    SpawnedClient connection;
+    init_spawned_client(&connection, -1, connFd,
+            fcntl(connFd, F_DUPFD_CLOEXEC, 0));
+    if (connection.writeFd < 0) {
+        close(connFd);
+        return;
+    }
+
+    ClientInstance *joiner = new_client_instance(&connection);
+    joiner->isSocket = true;
+    // Clients outside the chat are never visited by rounds or broadcasts
+    joiner->isActive = false;
+    watch_client(chatMembers->loop, joiner);
+
+    listener->joiners = realloc(listener->joiners,
+            sizeof(ClientInstance *) * (listener->numJoiners + 1));
+    listener->joiners[listener->numJoiners++] = joiner;
+
+    PROBE1(name_request, joiner);
+    send_client(chatMembers, joiner, "WHO:\n");
+    joiner->awaitingName = true;
+    arm_client_deadline(chatMembers, &joiner->lineTimer,
+            chatMembers->options->lineTimeout);
+}
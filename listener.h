@@ -0,0 +1,47 @@
+#ifndef LISTENER_H
+#define LISTENER_H
+
+#include <stdbool.h>
+#include "serverUtils.h"
+
+/* Maximum number of connections accepted each time the listening socket is
+ * reported readable, so a burst of connections can't stall a turn
+ */
+#define MAX_ACCEPTS_PER_POLL 64
+
+/* Struct for the socket a server listens on for clients to connect to while
+ * it runs. (see --listen)
+ *
+ * Connections are accepted by the server's event loop as they arrive. Each
+ * becomes a client that is sent WHO: at once and kept in joiners, outside
+ * the chat, while it negotiates its name. Its replies are read by the event
+ * loop during turns like any other client's output, and it joins the chat
+ * at the end of the next round once it has given a name that isn't taken.
+ * (see admit_joiners() in server.c)
+ *
+ * A client that connected has a single socket in place of its pipes, and no
+ * process the server can terminate.
+ */
+struct Listener {
+    /* File descriptor of the listening socket */
+    int fd;
+    /* Path the socket is bound to, NULL unless it is a Unix-domain socket */
+    char *path;
+    /* Clients the listener belongs to */
+    ClientList *chatMembers;
+    /* Clients that connected and are yet to join the chat, in the order
+     * they connected
+     */
+    ClientInstance **joiners;
+    /* Number of clients in joiners */
+    int numJoiners;
+    /* Event loop registration for fd */
+    EventSource source;
+};
+
+Listener *start_listener(ClientList *chatMembers);
+void stop_listener(Listener *listener);
+void accept_connections(Listener *listener);
+void drop_joiner(Listener *listener, ClientInstance *joiner);
+
+#endif
@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include "benchRun.h"
+
+/* Word clients put in their messages for bots to respond to */
+#define STIMULUS "ping"
+/* Word bots respond with, which no bot responds to in turn */
+#define RESPONSE "pong"
+
+/* Name clients are given by the server, followed by a number from the
+ * second client on (see get_name() in genericClient.c)
+ */
+#define BOT_NAME "clientbot"
+
+/* Synthetic load generator and throughput benchmark of the server.
+ *
+ * Writes a configfile, a chatscript per client and a responsefile shared by
+ * every bot into a temporary directory, runs the server against them and
+ * reports the throughput of the chat. (see the bench target in the
+ * makefile)
+ *
+ * Every client chats for rounds turns of turnLines messages of msgSize
+ * bytes each, hitRate percent of which contain the bots' stimulus, spread
+ * evenly over its turns. Every bot responds to each of those messages on its
+ * next turn. The first client kicks every bot on its last turn, so the
+ * chat ends once the clients have all quit.
+ *
+ * Usage: loadGen [--name=value ...] [-- server options ...]
+ */
+
+/* A parameter of the load, given as --name=value */
+typedef struct {
+    /* Name of the parameter */
+    const char *name;
+    /* Value of the parameter, set to its default beforehand */
+    int value;
+    /* Smallest and largest value the parameter may take */
+    int min;
+    int max;
+} LoadParam;
+
+/* Indices of each parameter in loadParams */
+typedef enum {
+    PARAM_CLIENTS,
+    PARAM_BOTS,
+    PARAM_MSG_SIZE,
+    PARAM_HIT_RATE,
+    PARAM_TURN_LINES,
+    PARAM_ROUNDS,
+    NUM_PARAMS
+} LoadParamIndex;
+
+/* Every parameter of the load, in the order of LoadParamIndex */
+static LoadParam loadParams[] = {
+        {"clients", 8, 1, 10000},
+        {"bots", 4, 0, 10000},
+        {"msg-size", 32, 8, 1 << 20},
+        {"hit-rate", 25, 0, 100},
+        {"turn-lines", 4, 1, 10000},
+        {"rounds", 500, 1, 1000000}
+        };
+
+/* Prints the usage of the generator and exits with code 1 */
+static void usage_error(void) {
+    fprintf(stderr, "Usage: loadGen [--clients=N] [--bots=N] "
+            "[--msg-size=N] [--hit-rate=PCT] [--turn-lines=N] "
+            "[--rounds=N] [--bin-dir=DIR] [-- server options ...]\n");
+    exit(1);
+}
+
+/* Opens a file in dir for writing, exiting with code 1 if it can't be */
+static FILE *open_output(const char *dir, const char *name, char *path) {
+    sprintf(path, "%s/%s", dir, name);
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        perror(path);
+        exit(1);
+    }
+    return file;
+}
+
+/* Writes a single message of msgSize bytes to a chatscript, starting with
+ * the stimulus if isHit is set and padded with characters no stimulus is
+ * made of.
+ */
+static void write_message(FILE *script, int msgSize, int isHit) {
+    int len = 0;
+    fputs("CHAT:", script);
+    if (isHit) {
+        len = fprintf(script, "%s ", STIMULUS);
+    }
+    for (; len < msgSize; ++len) {
+        fputc('x', script);
+    }
+    fputc('\n', script);
+}
+
+/* Writes the chatscript of the client numbered clientNo. The first client
+ * also kicks every bot on its last turn.
+ */
+static void write_chatscript(const char *dir, int clientNo, char *path) {
+    char name[32];
+    sprintf(name, "chatscript%d", clientNo);
+    FILE *script = open_output(dir, name, path);
+    int numLines = loadParams[PARAM_ROUNDS].value *
+            loadParams[PARAM_TURN_LINES].value;
+    int hitRate = loadParams[PARAM_HIT_RATE].value;
+
+    for (int line = 0; line < numLines; ++line) {
+        // A line hits each time the running total of hits passes a whole one
+        int isHit = (line + 1) * hitRate / 100 > line * hitRate / 100;
+        write_message(script, loadParams[PARAM_MSG_SIZE].value, isHit);
+        if ((line + 1) % loadParams[PARAM_TURN_LINES].value == 0 &&
+                line + 1 < numLines) {
+            fputs("DONE:\n", script);
+        }
+    }
+
+    if (clientNo == 0) {
+        for (int i = 0; i < loadParams[PARAM_BOTS].value; ++i) {
+            if (i == 0) {
+                fprintf(script, "KICK:%s\n", BOT_NAME);
+            } else {
+                fprintf(script, "KICK:%s%d\n", BOT_NAME, i - 1);
+            }
+        }
+    }
+    fputs("QUIT:\n", script);
+    fclose(script);
+}
+
+/* Writes the responsefile of the bots into dir */
+static void write_responsefile(const char *dir, char *path) {
+    FILE *responses = open_output(dir, "responsefile", path);
+    fprintf(responses, "%s:%s", STIMULUS, RESPONSE);
+    for (int len = strlen(RESPONSE); len < loadParams[PARAM_MSG_SIZE].value;
+            ++len) {
+        fputc('y', responses);
+    }
+    fputc('\n', responses);
+    fclose(responses);
+}
+
+/* Writes the configfile, chatscripts and responsefile of the load into
+ * dir, running the client and clientbot programs in binDir, and returns the
+ * path of the configfile in configPath.
+ */
+static void write_load(const char *dir, const char *binDir,
+        char *configPath) {
+    char path[PATH_MAX];
+    FILE *config = open_output(dir, "configfile", configPath);
+
+    for (int i = 0; i < loadParams[PARAM_CLIENTS].value; ++i) {
+        write_chatscript(dir, i, path);
+        fprintf(config, "%s/client:%s\n", binDir, path);
+    }
+    if (loadParams[PARAM_BOTS].value > 0) {
+        write_responsefile(dir, path);
+        for (int i = 0; i < loadParams[PARAM_BOTS].value; ++i) {
+            fprintf(config, "%s/clientbot:%s\n", binDir, path);
+        }
+    }
+    fclose(config);
+}
+
+/* Removes every file written by write_load() and dir itself */
+static void remove_load(const char *dir) {
+    char path[PATH_MAX];
+    for (int i = 0; i < loadParams[PARAM_CLIENTS].value; ++i) {
+        sprintf(path, "%s/chatscript%d", dir, i);
+        unlink(path);
+    }
+    sprintf(path, "%s/responsefile", dir);
+    unlink(path);
+    sprintf(path, "%s/configfile", dir);
+    unlink(path);
+    rmdir(dir);
+}
+
+/* Parses the load parameters and the bin directory from argv up to "--",
+ * and returns the index of the first server option.
+ */
+static int parse_args(int argc, char **argv, const char **binDir) {
+    int argIndex = 1;
+    for (; argIndex < argc && strcmp(argv[argIndex], "--"); ++argIndex) {
+        char *arg = argv[argIndex];
+        char *value = strchr(arg, '=');
+        if (strncmp(arg, "--", 2) || value == NULL || value[1] == '\0') {
+            usage_error();
+        }
+        *value++ = '\0';
+
+        if (!strcmp(arg + 2, "bin-dir")) {
+            *binDir = value;
+            continue;
+        }
+        int i = 0;
+        while (i < NUM_PARAMS && strcmp(loadParams[i].name, arg + 2)) {
+            i++;
+        }
+        char *end;
+        long parsed = i < NUM_PARAMS ? strtol(value, &end, 10) : 0;
+        if (i == NUM_PARAMS || *end != '\0' || parsed < loadParams[i].min ||
+                parsed > loadParams[i].max) {
+            usage_error();
+        }
+        loadParams[i].value = parsed;
+    }
+
+    return argIndex < argc ? argIndex + 1 : argc;
+}
+
+int main(int argc, char **argv) {
+    const char *binDir = ".";
+    int serverOptIndex = parse_args(argc, argv, &binDir);
+    char absBinDir[PATH_MAX];
+    if (realpath(binDir, absBinDir) == NULL) {
+        perror(binDir);
+        return 1;
+    }
+
+    char dir[] = "/tmp/loadGen.XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    char configPath[PATH_MAX];
+    write_load(dir, absBinDir, configPath);
+
+    for (int i = 0; i < NUM_PARAMS; ++i) {
+        printf("%s%s=%d", i == 0 ? "" : " ", loadParams[i].name,
+                loadParams[i].value);
+    }
+    for (int i = serverOptIndex; i < argc; ++i) {
+        printf(" %s", argv[i]);
+    }
+    printf("\n");
+    fflush(stdout);
+
+    RunResult result = run_server(absBinDir, argv + serverOptIndex,
+            argc - serverOptIndex, configPath);
+    remove_load(dir);
+
+    print_run_result(&result);
+    printf("rounds/sec   %10.1f\n", loadParams[PARAM_ROUNDS].value /
+            result.elapsed);
+
+    return 0;
+}
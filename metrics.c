@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "serverUtils.h"
+#include "metrics.h"
+
+/* Percentiles of each histogram given in reports, in tenths of a percent */
+static const int reportedPermilles[] = {500, 900, 990, 999};
+
+/* Number of elements in reportedPermilles */
+static const int numReportedPermilles =
+        sizeof(reportedPermilles) / sizeof(int);
+
+static void init_histogram(Histogram *histogram);
+static int bucket_index(uint64_t value);
+static uint64_t bucket_highest(int index);
+static uint64_t histogram_percentile(Histogram *histogram, int permille);
+static void snapshot_histogram(Histogram *snapshot, Histogram *histogram);
+static void write_histogram(FILE *report, const char *key,
+        Histogram *recorded);
+static void write_json_string(FILE *report, const char *str);
+static void write_client_metrics(FILE *report, ClientInstance *client);
+
+/* Initializes and allocates memory for the metrics of a server, whose
+ * reports are appended to the file at path, and returns a pointer to them.
+ * Exits with code 1 if the file can't be opened.
+ */
+ServerMetrics *new_server_metrics(const char *path) {
+    ServerMetrics *metrics = malloc(sizeof(ServerMetrics));
+    if ((metrics->report = fopen(path, "ae")) == NULL) {
+        perror(path);
+        exit(1);
+    }
+    metrics->startUs = metrics_clock_us();
+    init_histogram(&metrics->fanOutTime);
+    init_histogram(&metrics->broadcastBytes);
+
+    return metrics;
+}
+
+/* Closes the report file of a server's metrics and frees them */
+void free_server_metrics(ServerMetrics *metrics) {
+    fclose(metrics->report);
+    free(metrics);
+}
+
+/* Initializes and allocates memory for the metrics of a client and returns
+ * a pointer to them. They are freed with free().
+ */
+ClientMetrics *new_client_metrics() {
+    ClientMetrics *metrics = malloc(sizeof(ClientMetrics));
+    init_histogram(&metrics->ytRoundTrip);
+    init_histogram(&metrics->linesPerTurn);
+    init_histogram(&metrics->bytesIn);
+    init_histogram(&metrics->bytesOut);
+    metrics->kicks = 0;
+    metrics->skippedTurns = 0;
+    metrics->turnStartUs = 0;
+    metrics->turnLines = 0;
+
+    return metrics;
+}
+
+/* Returns the time in microseconds on a monotonic clock */
+uint64_t metrics_clock_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/* Records a value in a Histogram.
+ *
+ * A histogram has a single writer, but may be reported by another thread
+ * meanwhile (see ClientMetrics), so every field is stored atomically. count
+ * is stored last, so a report that sees it also sees the value's bucket,
+ * sum, minimum and maximum.
+ */
+void record_histogram(Histogram *histogram, uint64_t value) {
+    uint64_t count = __atomic_load_n(&histogram->count, __ATOMIC_RELAXED);
+    if (count == 0 || value < histogram->min) {
+        __atomic_store_n(&histogram->min, value, __ATOMIC_RELAXED);
+    }
+    if (value > histogram->max) {
+        __atomic_store_n(&histogram->max, value, __ATOMIC_RELAXED);
+    }
+    int index = bucket_index(value);
+    __atomic_store_n(&histogram->buckets[index],
+            histogram->buckets[index] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&histogram->sum, histogram->sum + value,
+            __ATOMIC_RELAXED);
+    __atomic_store_n(&histogram->count, count + 1, __ATOMIC_RELEASE);
+}
+
+/* Appends a report of a server's metrics and those of each of its clients
+ * not yet released to the server's report file, as a single line of JSON,
+ * and flushes it. (see write_departure_report())
+ *
+ * Each histogram is reported as its count, sum, minimum, maximum and a few
+ * percentiles. A percentile is the highest value its bucket could hold, so
+ * it is never under the true value by more than the histogram's precision.
+ */
+void write_metrics_report(ServerMetrics *metrics, ClientInstance **clients,
+        int numClients) {
+    FILE *report = metrics->report;
+    fprintf(report, "{\"uptime_us\":%llu,", (unsigned long long)
+            (metrics_clock_us() - metrics->startUs));
+    write_histogram(report, "fan_out_us", &metrics->fanOutTime);
+    fputc(',', report);
+    write_histogram(report, "broadcast_bytes", &metrics->broadcastBytes);
+    fputs(",\"clients\":[", report);
+
+    bool isFirst = true;
+    for (int i = 0; i < numClients; ++i) {
+        // Released clients leave their slot empty
+        if (clients[i] == NULL || clients[i]->metrics == NULL) {
+            continue;
+        }
+        fputs(isFirst ? "" : ",", report);
+        isFirst = false;
+        write_client_metrics(report, clients[i]);
+    }
+
+    fputs("]}\n", report);
+    fflush(report);
+}
+
+/* Appends a report of the metrics of a client that left the chat to a
+ * server's report file, as a single line of JSON, and flushes it. Called as
+ * the client is released, so clients that left are each reported once
+ * rather than kept in every later report. (see release_departed_clients())
+ */
+void write_departure_report(ServerMetrics *metrics, ClientInstance *client) {
+    FILE *report = metrics->report;
+    fprintf(report, "{\"uptime_us\":%llu,\"departed\":",
+            (unsigned long long) (metrics_clock_us() - metrics->startUs));
+    write_client_metrics(report, client);
+    fputs("}\n", report);
+    fflush(report);
+}
+
+/* Writes the metrics of a client to a report as a JSON object */
+static void write_client_metrics(FILE *report, ClientInstance *client) {
+    ClientMetrics *clientMetrics = client->metrics;
+    fputs("{\"name\":", report);
+    write_json_string(report, client->name);
+    fprintf(report, ",\"active\":%s,\"kicks\":%llu,\"skipped_turns\":%llu,",
+            client->isActive ? "true" : "false",
+            (unsigned long long) clientMetrics->kicks,
+            (unsigned long long) clientMetrics->skippedTurns);
+    write_histogram(report, "yt_round_trip_us", &clientMetrics->ytRoundTrip);
+    fputc(',', report);
+    write_histogram(report, "lines_per_turn", &clientMetrics->linesPerTurn);
+    fputc(',', report);
+    write_histogram(report, "bytes_in", &clientMetrics->bytesIn);
+    fputc(',', report);
+    write_histogram(report, "bytes_out", &clientMetrics->bytesOut);
+    fputc('}', report);
+}
+
+/* Initializes an empty Histogram */
+static void init_histogram(Histogram *histogram) {
+    memset(histogram, 0, sizeof(Histogram));
+}
+
+/* Returns the index of the bucket of a Histogram a value is counted in */
+static int bucket_index(uint64_t value) {
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return value;
+    }
+    if (value >> HISTOGRAM_MAX_BITS) {
+        return HISTOGRAM_BUCKETS - 1;
+    }
+
+    // Values are split by their highest set bit, then by the bits after it
+    int shift = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BITS;
+    return (shift + 1) * HISTOGRAM_SUB_BUCKETS +
+            ((value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+/* Returns the highest value counted in the bucket of a Histogram at index
+ */
+static uint64_t bucket_highest(int index) {
+    if (index < HISTOGRAM_SUB_BUCKETS) {
+        return index;
+    }
+    int shift = index / HISTOGRAM_SUB_BUCKETS - 1;
+    uint64_t lowest = (uint64_t) (HISTOGRAM_SUB_BUCKETS +
+            index % HISTOGRAM_SUB_BUCKETS) << shift;
+    return lowest + ((uint64_t) 1 << shift) - 1;
+}
+
+/* Returns the value at or below which permille tenths of a percent of the
+ * values recorded in a non-empty Histogram fall, capped at its maximum
+ */
+static uint64_t histogram_percentile(Histogram *histogram, int permille) {
+    uint64_t rank = (histogram->count * permille + 999) / 1000;
+    uint64_t seen = 0;
+
+    for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        seen += histogram->buckets[i];
+        if (seen >= rank && seen > 0) {
+            uint64_t highest = bucket_highest(i);
+            return highest < histogram->max ? highest : histogram->max;
+        }
+    }
+
+    return histogram->max;
+}
+
+/* Copies a Histogram that may be being recorded in by another thread into
+ * snapshot, loading each field atomically (see record_histogram())
+ */
+static void snapshot_histogram(Histogram *snapshot, Histogram *histogram) {
+    snapshot->count = __atomic_load_n(&histogram->count, __ATOMIC_ACQUIRE);
+    snapshot->sum = __atomic_load_n(&histogram->sum, __ATOMIC_RELAXED);
+    snapshot->min = __atomic_load_n(&histogram->min, __ATOMIC_RELAXED);
+    snapshot->max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+    for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        snapshot->buckets[i] = __atomic_load_n(&histogram->buckets[i],
+                __ATOMIC_RELAXED);
+    }
+}
+
+/* Writes a snapshot of a Histogram to a report as the JSON member key */
+static void write_histogram(FILE *report, const char *key,
+        Histogram *recorded) {
+    Histogram snapshot;
+    snapshot_histogram(&snapshot, recorded);
+    Histogram *histogram = &snapshot;
+
+    fprintf(report, "\"%s\":{\"count\":%llu,\"sum\":%llu", key,
+            (unsigned long long) histogram->count,
+            (unsigned long long) histogram->sum);
+    if (histogram->count > 0) {
+        fprintf(report, ",\"min\":%llu,\"max\":%llu",
+                (unsigned long long) histogram->min,
+                (unsigned long long) histogram->max);
+        for (int i = 0; i < numReportedPermilles; ++i) {
+            fprintf(report, ",\"p%g\":%llu", reportedPermilles[i] / 10.0,
+                    (unsigned long long) histogram_percentile(histogram,
+                    reportedPermilles[i]));
+        }
+    }
+    fputc('}', report);
+}
+
+/* Writes a string to a report as a JSON string, or null if str is NULL */
+static void write_json_string(FILE *report, const char *str) {
+    if (str == NULL) {
+        fputs("null", report);
+        return;
+    }
+
+    fputc('"', report);
+    for (const unsigned char *c = (const unsigned char *) str; *c; ++c) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(report, "\\%c", *c);
+        } else if (*c < 0x20) {
+            fprintf(report, "\\u%04x", *c);
+        } else {
+            fputc(*c, report);
+        }
+    }
+    fputc('"', report);
+}
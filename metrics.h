@@ -0,0 +1,101 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+struct ClientInstance;
+
+/* Number of bits of precision a Histogram keeps of each value, i.e. values
+ * are counted to within 1 part in 2^HISTOGRAM_SUB_BITS
+ */
+#define HISTOGRAM_SUB_BITS 3
+
+/* Number of buckets each power of two is split into */
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+
+/* Number of bits of the largest value a Histogram tells apart. Larger values
+ * are counted in its last bucket.
+ */
+#define HISTOGRAM_MAX_BITS 40
+
+/* Number of buckets of a Histogram */
+#define HISTOGRAM_BUCKETS \
+        ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+/* Histogram of non-negative values with a fixed relative precision, in the
+ * style of an HDR histogram.
+ *
+ * Values below HISTOGRAM_SUB_BUCKETS each have their own bucket, and every
+ * power of two above that is split into HISTOGRAM_SUB_BUCKETS equal
+ * buckets, so recording a value is a few shifts and an increment and the
+ * histogram never allocates. The exact count, sum, minimum and maximum are
+ * kept alongside the buckets.
+ */
+typedef struct {
+    /* Number of values recorded */
+    uint64_t count;
+    /* Sum of the values recorded */
+    uint64_t sum;
+    /* Smallest and largest values recorded, valid once count > 0 */
+    uint64_t min;
+    uint64_t max;
+    /* Number of values recorded in each bucket */
+    uint32_t buckets[HISTOGRAM_BUCKETS];
+} Histogram;
+
+/* Metrics of a single client (see --metrics) */
+typedef struct {
+    /* Microseconds from sending YT: to reading the DONE: or QUIT: ending
+     * the turn, for every turn the client answered
+     */
+    Histogram ytRoundTrip;
+    /* Number of commands sent in each turn the client answered */
+    Histogram linesPerTurn;
+    /* Bytes of each command read from the client */
+    Histogram bytesIn;
+    /* Bytes of each message sent to the client, broadcasts included, as
+     * counted by the thread writing to the client (see send_client_msg()).
+     * That may be a shard's worker, whilst reports are written by the main
+     * thread. (see record_histogram())
+     */
+    Histogram bytesOut;
+    /* Number of times the client was kicked */
+    uint64_t kicks;
+    /* Number of turns the client sat out, not being sent YT:, as it had
+     * nothing to say (see --ready-fallback)
+     */
+    uint64_t skippedTurns;
+    /* Time the client was sent YT: for its current turn, as per
+     * metrics_clock_us(), and number of commands read in that turn so far.
+     * A turn may be carried over several rounds. (see --schedule)
+     */
+    uint64_t turnStartUs;
+    int turnLines;
+} ClientMetrics;
+
+/* Metrics of a server as a whole, written as a report to a file when the
+ * server is sent SIGUSR1 and when it exits (see --metrics)
+ */
+typedef struct {
+    /* File reports are appended to */
+    FILE *report;
+    /* Time the server started, as per metrics_clock_us() */
+    uint64_t startUs;
+    /* Microseconds taken to hand each broadcast to every recipient */
+    Histogram fanOutTime;
+    /* Bytes of each broadcast */
+    Histogram broadcastBytes;
+} ServerMetrics;
+
+ServerMetrics *new_server_metrics(const char *path);
+void free_server_metrics(ServerMetrics *metrics);
+ClientMetrics *new_client_metrics();
+uint64_t metrics_clock_us();
+void record_histogram(Histogram *histogram, uint64_t value);
+void write_metrics_report(ServerMetrics *metrics,
+        struct ClientInstance **clients, int numClients);
+void write_departure_report(ServerMetrics *metrics,
+        struct ClientInstance *client);
+
+#endif
@@ -0,0 +1,317 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lineList.h"
+#include "commands.h"
+#include "clientbotUtils.h"
+
+/* Nanoseconds each benchmark runs for at least */
+#define MIN_BENCH_NS 200000000LL
+/* Number of lines in the files read by the line reading benchmarks */
+#define FILE_LINES 1024
+/* Number of lines or responses added to a list before it is started afresh
+ */
+#define LIST_RESET 10000
+/* Number of messages matched against stimuli in turn */
+#define NUM_TARGETS 64
+/* Length in bytes of short and long lines */
+#define SHORT_LINE 32
+#define LONG_LINE 4096
+
+/* Microbenchmarks of the primitives clients and clientbots run on every
+ * line: reading lines (read_file_line(), file_to_line_list()), building
+ * LineLists (add_to_lines()), parsing commands (get_cmd_str(), get_cmd()),
+ * matching stimuli (pattern_match_lines()) and queueing responses
+ * (append_buffer()).
+ *
+ * Each benchmark runs its operation in ever larger batches until it has run
+ * for MIN_BENCH_NS, then reports the time and number of allocations per
+ * operation. Allocations are counted by wrapping malloc(), calloc() and
+ * realloc() at link time, so only those made by the code under test itself
+ * are counted, not those made inside the C library. (see the bench-micro
+ * target in the makefile)
+ *
+ * Usage: microBench [filter]
+ * Only benchmarks whose name contains filter are run, if it is given.
+ */
+
+/* Number of malloc(), calloc() and realloc() calls made */
+static long numAllocs = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+/* Counts calls to malloc() (see -Wl,--wrap) */
+void *__wrap_malloc(size_t size) {
+    numAllocs++;
+    return __real_malloc(size);
+}
+
+/* Counts calls to calloc() (see -Wl,--wrap) */
+void *__wrap_calloc(size_t count, size_t size) {
+    numAllocs++;
+    return __real_calloc(count, size);
+}
+
+/* Counts calls to realloc() (see -Wl,--wrap) */
+void *__wrap_realloc(void *ptr, size_t size) {
+    numAllocs++;
+    return __real_realloc(ptr, size);
+}
+
+/* State an operation runs on, set up by its benchmark */
+typedef struct {
+    /* File of lines to read, rewound once it is exhausted */
+    FILE *file;
+    /* LineList added to and ResponseBuffer appended to */
+    LineList *list;
+    ResponseBuffer *buffer;
+    /* Strings the operation takes in turn and the number of them */
+    char **inputs;
+    int numInputs;
+    /* Index of the next string taken */
+    int next;
+    /* Stimuli matched against */
+    LineList *stimuli;
+} BenchState;
+
+/* Returns the current time in nanoseconds */
+static long long now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/* Returns the next number of a fixed pseudo-random sequence, so every run
+ * benchmarks the same inputs
+ */
+static unsigned next_random(void) {
+    static unsigned long long state = 0x2545f4914f6cdd1dULL;
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return state >> 33;
+}
+
+/* Writes len bytes of filler text, containing no stimulus, into dest and
+ * terminates it
+ */
+static void fill_text(char *dest, int len) {
+    const char *filler = "the quick brown fox jumps over a lazy dog ";
+    int fillerLen = strlen(filler);
+    for (int i = 0; i < len; ++i) {
+        dest[i] = filler[i % fillerLen];
+    }
+    dest[len] = '\0';
+}
+
+/* Returns a file in memory of FILE_LINES lines of lineLen bytes each. Its
+ * buffer is returned in contents, to be freed once the file is closed.
+ */
+static FILE *open_line_file(int lineLen, char **contents) {
+    size_t size = (size_t) FILE_LINES * (lineLen + 1);
+    *contents = malloc(size + 1);
+    for (int i = 0; i < FILE_LINES; ++i) {
+        fill_text(*contents + (size_t) i * (lineLen + 1), lineLen);
+        (*contents)[(size_t) i * (lineLen + 1) + lineLen] = '\n';
+    }
+    return fmemopen(*contents, size, "r");
+}
+
+/* Runs op on state in batches until MIN_BENCH_NS have passed and prints the
+ * time and allocations per operation, if name contains filter
+ */
+static void run_bench(const char *name, const char *filter,
+        void (*op)(BenchState *), BenchState *state) {
+    if (filter != NULL && strstr(name, filter) == NULL) {
+        return;
+    }
+
+    long long ops = 0;
+    long long batch = 1;
+    long startAllocs = numAllocs;
+    long long start = now_ns();
+    long long elapsed = 0;
+    while (elapsed < MIN_BENCH_NS) {
+        for (long long i = 0; i < batch; ++i) {
+            op(state);
+        }
+        ops += batch;
+        batch *= 2;
+        elapsed = now_ns() - start;
+    }
+
+    printf("%-44s %16.1f ns/op %12.2f allocs/op\n", name,
+            (double) elapsed / ops, (double) (numAllocs - startAllocs) / ops);
+}
+
+/* Reads and frees a single line, rewinding the file once it is exhausted */
+static void op_read_file_line(BenchState *state) {
+    bool isLineEmpty = false;
+    char *line = read_file_line(state->file, &isLineEmpty);
+    free(line);
+    if (isLineEmpty || feof(state->file)) {
+        rewind(state->file);
+    }
+}
+
+/* Reads and frees a whole file as a LineList */
+static void op_file_to_line_list(BenchState *state) {
+    rewind(state->file);
+    free_line_list(file_to_line_list(state->file));
+}
+
+/* Adds the next input to a LineList, starting afresh every LIST_RESET */
+static void op_add_to_lines(BenchState *state) {
+    if (state->list->numLines == LIST_RESET) {
+        free_line_list(state->list);
+        state->list = init_line_list();
+    }
+    add_to_lines(state->list, state->inputs[0]);
+}
+
+/* Parses and frees the next input as a command */
+static void op_get_cmd_str(BenchState *state) {
+    bool invalidCmd;
+    char *cmd = state->inputs[state->next++ % state->numInputs];
+    free_line_list(get_cmd_str(cmd, &invalidCmd));
+}
+
+/* Looks up the next input as the name of a command sent to the server */
+static void op_get_cmd(BenchState *state) {
+    get_cmd(state->inputs[state->next++ % state->numInputs], SERVER);
+}
+
+/* Matches the next input against the stimuli */
+static void op_pattern_match_lines(BenchState *state) {
+    pattern_match_lines(state->inputs[state->next++ % state->numInputs],
+            state->stimuli);
+}
+
+/* Appends a response to a ResponseBuffer, starting afresh every LIST_RESET
+ */
+static void op_append_buffer(BenchState *state) {
+    if (state->buffer->bufferLen == LIST_RESET) {
+        free_buffer(state->buffer);
+        state->buffer = init_buffer();
+    }
+    append_buffer(state->buffer->bufferLen, state->buffer);
+}
+
+/* Benchmarks reading short and long lines, one at a time and as a file */
+static void bench_line_reading(const char *filter) {
+    const int lineLens[] = {SHORT_LINE, LONG_LINE};
+    const char *labels[] = {"short", "long"};
+    char name[64];
+
+    for (int i = 0; i < 2; ++i) {
+        char *contents;
+        BenchState state = {0};
+        state.file = open_line_file(lineLens[i], &contents);
+
+        sprintf(name, "read_file_line/%s", labels[i]);
+        run_bench(name, filter, op_read_file_line, &state);
+        sprintf(name, "file_to_line_list/%d %s lines", FILE_LINES,
+                labels[i]);
+        run_bench(name, filter, op_file_to_line_list, &state);
+
+        fclose(state.file);
+        free(contents);
+    }
+}
+
+/* Benchmarks building LineLists and parsing short and long commands */
+static void bench_commands(const char *filter) {
+    char longMsg[LONG_LINE + 1];
+    fill_text(longMsg, LONG_LINE);
+    char *longCmd = malloc(LONG_LINE + 8);
+    sprintf(longCmd, "CHAT:%s", longMsg);
+
+    BenchState state = {0};
+    char *line = "a line of a chatscript";
+    state.inputs = &line;
+    state.numInputs = 1;
+    state.list = init_line_list();
+    run_bench("add_to_lines", filter, op_add_to_lines, &state);
+    free_line_list(state.list);
+
+    char *shortCmds[] = {"CHAT:hello everyone", "KICK:clientbot0", "DONE:",
+            "MSG:client:the weather is nice"};
+    state.inputs = shortCmds;
+    state.numInputs = 4;
+    run_bench("get_cmd_str/short", filter, op_get_cmd_str, &state);
+    state.inputs = &longCmd;
+    state.numInputs = 1;
+    run_bench("get_cmd_str/long", filter, op_get_cmd_str, &state);
+
+    char *cmdNames[] = {"CHAT", "KICK", "DONE", "QUIT", "NAME", "BOGUS"};
+    state.inputs = cmdNames;
+    state.numInputs = 6;
+    run_bench("get_cmd", filter, op_get_cmd, &state);
+
+    free(longCmd);
+}
+
+/* Benchmarks matching messages against 10 to 100k stimuli, hitRate percent
+ * of the messages containing one of them, chosen at random
+ */
+static void bench_pattern_match(const char *filter) {
+    const int numStimuli[] = {10, 1000, 100000};
+    const int hitRates[] = {0, 50, 100};
+    char name[64];
+
+    for (int i = 0; i < 3; ++i) {
+        BenchState state = {0};
+        state.stimuli = init_line_list();
+        char stimulus[16];
+        for (int j = 0; j < numStimuli[i]; ++j) {
+            sprintf(stimulus, "stim%06d", j);
+            add_to_lines(state.stimuli, stimulus);
+        }
+
+        for (int j = 0; j < 3; ++j) {
+            sprintf(name, "pattern_match_lines/%d stimuli/%d%% hits",
+                    numStimuli[i], hitRates[j]);
+            if (filter != NULL && strstr(name, filter) == NULL) {
+                continue;
+            }
+            char *targets[NUM_TARGETS];
+            for (int k = 0; k < NUM_TARGETS; ++k) {
+                targets[k] = malloc(SHORT_LINE * 2 + 1);
+                fill_text(targets[k], SHORT_LINE * 2);
+                if (k * hitRates[j] / 100 != (k + 1) * hitRates[j] / 100) {
+                    sprintf(stimulus, "stim%06u", next_random() %
+                            numStimuli[i]);
+                    memcpy(targets[k] + SHORT_LINE, stimulus,
+                            strlen(stimulus));
+                }
+            }
+            state.inputs = targets;
+            state.numInputs = NUM_TARGETS;
+            run_bench(name, filter, op_pattern_match_lines, &state);
+            for (int k = 0; k < NUM_TARGETS; ++k) {
+                free(targets[k]);
+            }
+        }
+        free_line_list(state.stimuli);
+    }
+}
+
+/* Benchmarks queueing responses */
+static void bench_responses(const char *filter) {
+    BenchState state = {0};
+    state.buffer = init_buffer();
+    run_bench("append_buffer", filter, op_append_buffer, &state);
+    free_buffer(state.buffer);
+}
+
+int main(int argc, char **argv) {
+    const char *filter = argc > 1 ? argv[1] : NULL;
+
+    bench_line_reading(filter);
+    bench_commands(filter);
+    bench_pattern_match(filter);
+    bench_responses(filter);
+
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include <stddef.h>
+#include "mpscQueue.h"
+
+/* Initializes an empty MpscQueue. Must not be called while any thread uses
+ * the queue.
+ */
+void init_mpsc_queue(MpscQueue *queue) {
+    queue->stub.next = NULL;
+    queue->head = &queue->stub;
+    queue->tail = &queue->stub;
+}
+
+/* Adds a node to the end of an MpscQueue. Safe to call from any thread. */
+void push_mpsc(MpscQueue *queue, MpscNode *node) {
+    __atomic_store_n(&node->next, NULL, __ATOMIC_RELAXED);
+    MpscNode *prev = __atomic_exchange_n(&queue->head, node,
+            __ATOMIC_SEQ_CST);
+    // Until this store the consumer sees the queue end at prev
+    __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+}
+
+/* Removes the oldest node from an MpscQueue and returns it. Returns NULL if
+ * the queue is empty, or if the oldest node's producer hasn't finished
+ * pushing it yet. Must only be called from the consumer thread.
+ */
+MpscNode *pop_mpsc(MpscQueue *queue) {
+    MpscNode *tail = queue->tail;
+    MpscNode *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+    // Skip over the stub node
+    if (tail == &queue->stub) {
+        if (next == NULL) {
+            return NULL;
+        }
+        queue->tail = next;
+        tail = next;
+        next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+    }
+
+    if (next != NULL) {
+        queue->tail = next;
+        return tail;
+    }
+
+    // tail is the last node unless a producer is part way through a push
+    if (tail != __atomic_load_n(&queue->head, __ATOMIC_SEQ_CST)) {
+        return NULL;
+    }
+
+    // Put the stub behind tail so tail can be handed out
+    push_mpsc(queue, &queue->stub);
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next != NULL) {
+        queue->tail = next;
+        return tail;
+    }
+
+    return NULL;
+}
+
+/* Returns whether an MpscQueue has no nodes pushed to it that haven't been
+ * popped yet. The result is only a snapshot if producers are running.
+ */
+bool is_mpsc_empty(MpscQueue *queue) {
+    return __atomic_load_n(&queue->head, __ATOMIC_SEQ_CST) == &queue->stub;
+}
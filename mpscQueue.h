@@ -0,0 +1,45 @@
+#ifndef MPSCQUEUE_H
+#define MPSCQUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Returns a pointer to the struct of the given type whose member (an
+ * MpscNode) node points to.
+ */
+#define MPSC_ENTRY(node, type, member) \
+        ((type *) ((char *) (node) - offsetof(type, member)))
+
+typedef struct MpscNode MpscNode;
+
+/* Node of an MpscQueue. Structs placed on a queue embed one of these and are
+ * recovered from it by the consumer.
+ */
+struct MpscNode {
+    /* Next (newer) node in the queue */
+    MpscNode *next;
+};
+
+/* Lock-free, intrusive, unbounded queue with any number of producer threads
+ * and a single consumer thread. (Dmitry Vyukov's node based MPSC queue)
+ *
+ * Producers only ever exchange head, so pushing never waits on another
+ * thread. The consumer alone owns tail. stub is a dummy node that keeps the
+ * queue non-empty internally, so head == &stub exactly when the queue is
+ * empty.
+ */
+typedef struct {
+    /* Newest node, exchanged by producers */
+    MpscNode *head;
+    /* Oldest node, owned by the consumer */
+    MpscNode *tail;
+    /* Dummy node */
+    MpscNode stub;
+} MpscQueue;
+
+void init_mpsc_queue(MpscQueue *queue);
+void push_mpsc(MpscQueue *queue, MpscNode *node);
+MpscNode *pop_mpsc(MpscQueue *queue);
+bool is_mpsc_empty(MpscQueue *queue);
+
+#endif
@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "nameTable.h"
+
+/* Number of entries a NameTable starts with */
+#define NAME_TABLE_MIN_CAPACITY 64
+
+static uint32_t hash_name(const char *name);
+static int find_slot(NameTable *table, const char *name);
+static void grow_name_table(NameTable *table);
+
+/* Initializes and allocates memory for a new, empty NameTable and returns a
+ * pointer to it.
+ */
+NameTable *init_name_table() {
+    NameTable *table = malloc(sizeof(NameTable));
+    table->capacity = NAME_TABLE_MIN_CAPACITY;
+    table->count = 0;
+    table->entries = calloc(table->capacity, sizeof(NameEntry));
+
+    return table;
+}
+
+/* Frees memory allocated to a NameTable. The names it maps are not freed as
+ * they belong to the clients, except for retired names.
+ */
+void free_name_table(NameTable *table) {
+    for (int i = 0; i < table->capacity; ++i) {
+        if (table->entries[i].isOwned) {
+            free(table->entries[i].name);
+        }
+    }
+    free(table->entries);
+    free(table);
+}
+
+/* Returns the client index a name maps to in a NameTable, NAME_RETIRED if
+ * the name is retired, or -1 if the name isn't in the table.
+ */
+int lookup_name(NameTable *table, const char *name) {
+    NameEntry *entry = &table->entries[find_slot(table, name)];
+    return entry->name == NULL ? -1 : entry->index;
+}
+
+/* Maps a name to a client index in a NameTable, replacing any index the name
+ * previously mapped to. The table keeps a pointer to name rather than a copy,
+ * so name must stay valid until it is removed from the table.
+ */
+void insert_name(NameTable *table, char *name, int index) {
+    if (2 * (table->count + 1) > table->capacity) {
+        grow_name_table(table);
+    }
+
+    NameEntry *entry = &table->entries[find_slot(table, name)];
+    if (entry->name == NULL) {
+        table->count++;
+    } else if (entry->isOwned) {
+        free(entry->name);
+    }
+    entry->name = name;
+    entry->index = index;
+    entry->isOwned = false;
+}
+
+/* Removes a name from a NameTable. Does nothing if it isn't in the table.
+ *
+ * Entries after the removed one in its probe sequence are shifted back, so
+ * no tombstones are needed and lookups never slow down over time.
+ */
+void remove_name(NameTable *table, const char *name) {
+    int mask = table->capacity - 1;
+    int hole = find_slot(table, name);
+    if (table->entries[hole].name == NULL) {
+        return;
+    }
+
+    if (table->entries[hole].isOwned) {
+        free(table->entries[hole].name);
+    }
+    table->entries[hole].name = NULL;
+    table->entries[hole].isOwned = false;
+    table->count--;
+
+    for (int i = (hole + 1) & mask; table->entries[i].name != NULL;
+            i = (i + 1) & mask) {
+        int home = hash_name(table->entries[i].name) & mask;
+        // Move the entry into the hole unless its home lies between them
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            table->entries[hole] = table->entries[i];
+            table->entries[i].name = NULL;
+            table->entries[i].isOwned = false;
+            hole = i;
+        }
+    }
+}
+
+/* Keeps a name in a NameTable once its client is released, mapping it to
+ * NAME_RETIRED rather than removing it, so it is never given out again. The
+ * table takes its own copy of the name, as the client's is freed. Does
+ * nothing if the name isn't in the table.
+ */
+void retire_name(NameTable *table, const char *name) {
+    NameEntry *entry = &table->entries[find_slot(table, name)];
+    if (entry->name == NULL) {
+        return;
+    }
+
+    if (!entry->isOwned) {
+        entry->name = strdup(name);
+        entry->isOwned = true;
+    }
+    entry->index = NAME_RETIRED;
+}
+
+/* Returns the FNV-1a hash of a name */
+static uint32_t hash_name(const char *name) {
+    uint32_t hash = 2166136261u;
+    for (; *name != '\0'; ++name) {
+        hash = (hash ^ (unsigned char) *name) * 16777619u;
+    }
+    return hash;
+}
+
+/* Returns the index of the entry holding name in a NameTable, or of the empty
+ * entry where it would be inserted if it isn't in the table.
+ */
+static int find_slot(NameTable *table, const char *name) {
+    int mask = table->capacity - 1;
+    int slot = hash_name(name) & mask;
+
+    while (table->entries[slot].name != NULL &&
+            strcmp(table->entries[slot].name, name)) {
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
+
+/* Doubles the number of entries of a NameTable, rehashing every name */
+static void grow_name_table(NameTable *table) {
+    NameEntry *oldEntries = table->entries;
+    int oldCapacity = table->capacity;
+
+    table->capacity *= 2;
+    table->count = 0;
+    table->entries = calloc(table->capacity, sizeof(NameEntry));
+
+    // Entries are moved whole, so retired names stay owned by the table
+    for (int i = 0; i < oldCapacity; ++i) {
+        if (oldEntries[i].name != NULL) {
+            table->entries[find_slot(table, oldEntries[i].name)] =
+                    oldEntries[i];
+            table->count++;
+        }
+    }
+    free(oldEntries);
+}
@@ -0,0 +1,46 @@
+#ifndef NAMETABLE_H
+#define NAMETABLE_H
+
+#include <stdbool.h>
+
+/* Index a name maps to once its client has been released from its
+ * ClientList, whose slot may then hold another client. The name stays in
+ * the table, so it is never given out twice. (see retire_name())
+ */
+#define NAME_RETIRED -2
+
+/* A single entry of a NameTable, mapping a client's name to the index of the
+ * client in its ClientList. name is NULL for empty entries.
+ */
+typedef struct {
+    /* Name of the client (owned by the client, not by the table, unless
+     * isOwned is set)
+     */
+    char *name;
+    /* Index of the client in its ClientList, or NAME_RETIRED */
+    int index;
+    /* Whether name is a copy owned by the table, i.e. the name is retired */
+    bool isOwned;
+} NameEntry;
+
+/* Hash table from client names to client indices, using open addressing with
+ * linear probing. The table is kept at most half full so lookups take O(1)
+ * expected time regardless of the number of clients.
+ */
+typedef struct {
+    /* Array of capacity entries */
+    NameEntry *entries;
+    /* Number of entries, always a power of two */
+    int capacity;
+    /* Number of non-empty entries */
+    int count;
+} NameTable;
+
+NameTable *init_name_table();
+void free_name_table(NameTable *table);
+int lookup_name(NameTable *table, const char *name);
+void insert_name(NameTable *table, char *name, int index);
+void remove_name(NameTable *table, const char *name);
+void retire_name(NameTable *table, const char *name);
+
+#endif
@@ -0,0 +1,256 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include "outputQueue.h"
+
+/* Number of messages an OutputQueue has room for once first used */
+#define OUTPUT_QUEUE_MIN_CAPACITY 8
+
+/* Maximum number of messages written by a single writev() call */
+#ifdef IOV_MAX
+#define MAX_IOVECS IOV_MAX
+#else
+#define MAX_IOVECS 1024
+#endif
+
+static void pop_output(OutputQueue *queue);
+static void consume_output(OutputQueue *queue, size_t numWritten);
+
+/* Allocates a SharedMsg with room for a message of len bytes (plus a '\0')
+ * and a single reference, held by the caller.
+ */
+SharedMsg *alloc_shared_msg(size_t len) {
+    SharedMsg *msg = malloc(sizeof(SharedMsg) + len + 1);
+    msg->refs = 1;
+    msg->len = len;
+    msg->framed = NULL;
+    msg->data[len] = '\0';
+
+    return msg;
+}
+
+/* Creates a SharedMsg holding a copy of the string msg, with a single
+ * reference held by the caller.
+ */
+SharedMsg *new_shared_msg(const char *msg) {
+    size_t len = strlen(msg);
+    SharedMsg *sharedMsg = alloc_shared_msg(len);
+    memcpy(sharedMsg->data, msg, len);
+
+    return sharedMsg;
+}
+
+/* Creates a SharedMsg holding a string formatted as per printf(), with a
+ * single reference held by the caller. The string is formatted directly
+ * into the SharedMsg.
+ */
+SharedMsg *format_shared_msg(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    SharedMsg *msg = alloc_shared_msg(len);
+    va_start(args, format);
+    vsnprintf(msg->data, len + 1, format, args);
+    va_end(args);
+
+    return msg;
+}
+
+/* Adds a reference to a SharedMsg. Safe to call from any thread. */
+void retain_shared_msg(SharedMsg *msg) {
+    __atomic_add_fetch(&msg->refs, 1, __ATOMIC_RELAXED);
+}
+
+/* Releases a reference to a SharedMsg, freeing it (and releasing its frame)
+ * if it was the last one. Safe to call from any thread.
+ */
+void release_shared_msg(SharedMsg *msg) {
+    if (__atomic_sub_fetch(&msg->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (msg->framed != NULL) {
+            release_shared_msg(msg->framed);
+        }
+        free(msg);
+    }
+}
+
+/* Initializes an empty OutputQueue. No memory is allocated until a message
+ * is first queued.
+ */
+void init_output_queue(OutputQueue *queue) {
+    queue->msgs = NULL;
+    queue->capacity = 0;
+    queue->head = 0;
+    queue->numMsgs = 0;
+    queue->headOffset = 0;
+    queue->queuedBytes = 0;
+}
+
+/* Releases every message in an OutputQueue and frees its memory, leaving it
+ * empty.
+ */
+void free_output_queue(OutputQueue *queue) {
+    while (queue->numMsgs > 0) {
+        pop_output(queue);
+    }
+    free(queue->msgs);
+    init_output_queue(queue);
+}
+
+/* Adds a reference to msg to the end of an OutputQueue. The message itself
+ * is not copied.
+ */
+void enqueue_output(OutputQueue *queue, SharedMsg *msg) {
+    if (queue->numMsgs == queue->capacity) {
+        int newCapacity = queue->capacity == 0 ? OUTPUT_QUEUE_MIN_CAPACITY :
+                2 * queue->capacity;
+        SharedMsg **newMsgs = malloc(sizeof(SharedMsg *) * newCapacity);
+        // Unwrap the circular array into the new one
+        for (int i = 0; i < queue->numMsgs; ++i) {
+            newMsgs[i] = queue->msgs[(queue->head + i) &
+                    (queue->capacity - 1)];
+        }
+        free(queue->msgs);
+        queue->msgs = newMsgs;
+        queue->capacity = newCapacity;
+        queue->head = 0;
+    }
+
+    retain_shared_msg(msg);
+    queue->msgs[(queue->head + queue->numMsgs++) & (queue->capacity - 1)] =
+            msg;
+    queue->queuedBytes += msg->len;
+}
+
+/* Writes as much of an OutputQueue as possible to the non-blocking file
+ * descriptor fd, gathering pending messages into as few writev() calls as
+ * possible and removing every message that was completely written.
+ *
+ * Returns 0 if the queue was emptied, 1 if fd can't take any more bytes yet
+ * and -1 if writing failed, i.e. the client closed its stdin.
+ */
+int flush_output(OutputQueue *queue, int fd) {
+    struct iovec iovecs[MAX_IOVECS];
+
+    while (queue->numMsgs > 0) {
+        int numIovecs = queue->numMsgs < MAX_IOVECS ? queue->numMsgs :
+                MAX_IOVECS;
+        for (int i = 0; i < numIovecs; ++i) {
+            SharedMsg *msg = queue->msgs[(queue->head + i) &
+                    (queue->capacity - 1)];
+            iovecs[i].iov_base = msg->data;
+            iovecs[i].iov_len = msg->len;
+        }
+        iovecs[0].iov_base = (char *) iovecs[0].iov_base + queue->headOffset;
+        iovecs[0].iov_len -= queue->headOffset;
+
+        ssize_t written = writev(fd, iovecs, numIovecs);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN ? 1 : -1;
+        }
+
+        consume_output(queue, written);
+    }
+
+    return 0;
+}
+
+/* Copies as much of an OutputQueue as there is space for into a ShmRing the
+ * caller writes to, removing every message that was completely copied. The
+ * reader of the ring is woken through bellFd if it may be asleep.
+ *
+ * Returns 0 if the queue was emptied and 1 if the ring is full. In that case
+ * the ring's writerWaiting flag is left set, so bellFd's counterpart is rung
+ * once the reader makes space.
+ */
+int flush_output_to_ring(OutputQueue *queue, ShmRing *ring, int bellFd) {
+    bool hasWritten = false;
+    int status = 0;
+
+    while (queue->numMsgs > 0) {
+        SharedMsg *msg = queue->msgs[queue->head];
+        size_t written = write_ring(ring, msg->data + queue->headOffset,
+                msg->len - queue->headOffset);
+        if (written > 0) {
+            hasWritten = true;
+            consume_output(queue, written);
+            continue;
+        }
+
+        /* Check once more after asking to be woken, as the reader may have
+         * made space before it saw the flag
+         */
+        set_waiting(&ring->writerWaiting);
+        if (is_ring_full(ring)) {
+            status = 1;
+            break;
+        }
+    }
+
+    if (hasWritten && take_waiting(&ring->readerWaiting)) {
+        ring_bell(bellFd);
+    }
+    return status;
+}
+
+/* Drops the oldest messages of an OutputQueue until at most limit bytes are
+ * queued. A message that has been partially written is never dropped, nor is
+ * the newest message.
+ */
+void drop_oldest_output(OutputQueue *queue, size_t limit) {
+    int mask = queue->capacity - 1;
+
+    while (queue->queuedBytes > limit && queue->numMsgs > 1) {
+        if (queue->headOffset == 0) {
+            queue->queuedBytes -= queue->msgs[queue->head]->len;
+            pop_output(queue);
+        } else if (queue->numMsgs > 2) {
+            // Drop the message after the partially written head
+            int dropped = (queue->head + 1) & mask;
+            queue->queuedBytes -= queue->msgs[dropped]->len;
+            release_shared_msg(queue->msgs[dropped]);
+            queue->msgs[dropped] = queue->msgs[queue->head];
+            queue->head = dropped;
+            queue->numMsgs--;
+        } else {
+            break;
+        }
+    }
+}
+
+/* Returns whether an OutputQueue has bytes not yet written */
+bool is_output_pending(OutputQueue *queue) {
+    return queue->numMsgs > 0;
+}
+
+/* Removes numWritten bytes from the front of an OutputQueue once they have
+ * been written, releasing every message written in full
+ */
+static void consume_output(OutputQueue *queue, size_t numWritten) {
+    queue->queuedBytes -= numWritten;
+    queue->headOffset += numWritten;
+    while (queue->numMsgs > 0 &&
+            queue->headOffset >= queue->msgs[queue->head]->len) {
+        size_t remainder = queue->headOffset - queue->msgs[queue->head]->len;
+        pop_output(queue);
+        queue->headOffset = remainder;
+    }
+}
+
+/* Removes the oldest message of an OutputQueue and releases the queue's
+ * reference to it. queuedBytes is left for the caller to update.
+ */
+static void pop_output(OutputQueue *queue) {
+    release_shared_msg(queue->msgs[queue->head]);
+    queue->head = (queue->head + 1) & (queue->capacity - 1);
+    queue->numMsgs--;
+    queue->headOffset = 0;
+}
@@ -0,0 +1,80 @@
+#ifndef OUTPUTQUEUE_H
+#define OUTPUTQUEUE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "shmRing.h"
+
+/* Possible policies for clients whose output queue grows past the server's
+ * high-water mark, i.e. clients that don't read their stdin fast enough.
+ */
+typedef enum {
+    /* Wait (still running the event loop) until the queue drains */
+    SLOW_BLOCK,
+    /* Drop the oldest unsent messages until the queue is small enough */
+    SLOW_DROP_OLDEST,
+    /* Make the client leave the chat as if it had sent QUIT: */
+    SLOW_DISCONNECT
+} SlowClientPolicy;
+
+typedef struct SharedMsg SharedMsg;
+
+/* An immutable message shared by every output queue it is sent to.
+ *
+ * A broadcast is formatted once into a single SharedMsg and each recipient's
+ * queue only holds a reference to it. The message is freed once the last
+ * reference is released. refs is updated atomically as references may be
+ * held by several threads. (see shard.c)
+ *
+ * Clients that switched to frames are sent framed instead, encoded once by
+ * the main thread before the message is handed to any shard. (see frame.h)
+ */
+struct SharedMsg {
+    /* Number of references to the message */
+    int refs;
+    /* Length of the message in bytes */
+    size_t len;
+    /* The message encoded as a frame, NULL until it is first needed */
+    SharedMsg *framed;
+    /* The message itself, followed by a '\0' not counted in len */
+    char data[];
+};
+
+/* Struct storing every message not yet written to a client's stdin.
+ *
+ * Messages are kept in a circular array of references, oldest first, so
+ * queueing a message never allocates once the array is large enough and
+ * any number of pending messages can be written with a single writev().
+ *
+ * headOffset bytes of the oldest message have already been written, so that
+ * message can't be dropped without corrupting the client's input.
+ */
+typedef struct {
+    /* Circular array of queued messages */
+    SharedMsg **msgs;
+    /* Number of elements allocated to msgs, zero or a power of two */
+    int capacity;
+    /* Index in msgs of the oldest message */
+    int head;
+    /* Number of queued messages */
+    int numMsgs;
+    /* Number of bytes of the oldest message already written */
+    size_t headOffset;
+    /* Number of bytes in the queue not yet written */
+    size_t queuedBytes;
+} OutputQueue;
+
+SharedMsg *alloc_shared_msg(size_t len);
+SharedMsg *new_shared_msg(const char *msg);
+SharedMsg *format_shared_msg(const char *format, ...);
+void retain_shared_msg(SharedMsg *msg);
+void release_shared_msg(SharedMsg *msg);
+void init_output_queue(OutputQueue *queue);
+void free_output_queue(OutputQueue *queue);
+void enqueue_output(OutputQueue *queue, SharedMsg *msg);
+int flush_output(OutputQueue *queue, int fd);
+int flush_output_to_ring(OutputQueue *queue, ShmRing *ring, int bellFd);
+void drop_oldest_output(OutputQueue *queue, size_t limit);
+bool is_output_pending(OutputQueue *queue);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/* Static tracepoints (USDT probes) at the key events of the server and
+ * clients, under the provider "chat", e.g. for bpftrace:
+ *
+ *     bpftrace -e 'usdt:./server:chat:client_cmd { @[arg1] = count(); }'
+ *
+ * Probes are only compiled in when ENABLE_PROBES is defined (see make
+ * probes), in which case each one is a single nop until a tracer attaches
+ * to it. Otherwise they expand to nothing and their arguments are never
+ * evaluated, so arguments must have no side effects.
+ */
+#ifdef ENABLE_PROBES
+
+#include <sys/sdt.h>
+
+#define PROBE0(name) DTRACE_PROBE(chat, name)
+#define PROBE1(name, a) DTRACE_PROBE1(chat, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(chat, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(chat, name, a, b, c)
+
+#else
+
+#define PROBE0(name) do {} while (0)
+#define PROBE1(name, a) do {} while (0)
+#define PROBE2(name, a, b) do {} while (0)
+#define PROBE3(name, a, b, c) do {} while (0)
+
+#endif
+
+#endif
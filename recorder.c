@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "commands.h"
+#include "frame.h"
+#include "recorder.h"
+
+/* Line recorded in place of a command that couldn't be parsed, itself not a
+ * valid command
+ */
+#define INVALID_CMD "INVALID"
+
+static void begin_event(Recorder *recorder, int clientId,
+        RecordKind kind);
+
+/* Starts recording to the file at path, which is truncated, and returns a
+ * pointer to a newly allocated Recorder for it. Exits with code 1 if the
+ * file can't be opened.
+ */
+Recorder *start_recorder(const char *path) {
+    Recorder *recorder = malloc(sizeof(Recorder));
+    if ((recorder->file = fopen(path, "we")) == NULL) {
+        perror(path);
+        exit(1);
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    recorder->startUs = (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+
+    return recorder;
+}
+
+/* Writes out and closes a recording and frees its Recorder */
+void stop_recorder(Recorder *recorder) {
+    fclose(recorder->file);
+    free(recorder);
+}
+
+/* Records the len bytes at data, one or more lines each ending in '\n', as
+ * sent to the client with id clientId or broadcast, as per kind. Does nothing
+ * if recorder is NULL, i.e. the server wasn't started with --record, or if
+ * the line is sent to a client not yet in the chat.
+ */
+void record_sent(Recorder *recorder, int clientId, RecordKind kind,
+        const char *data, size_t len) {
+    if (recorder == NULL || (kind == RECORD_SENT && clientId < 0)) {
+        return;
+    }
+
+    const char *end = data + len;
+    while (data < end) {
+        const char *lineEnd = memchr(data, '\n', end - data);
+        size_t lineLen = lineEnd == NULL ? (size_t) (end - data) :
+                (size_t) (lineEnd - data);
+        begin_event(recorder, clientId, kind);
+        fwrite(data, 1, lineLen, recorder->file);
+        fputc('\n', recorder->file);
+        data += lineLen + 1;
+    }
+}
+
+/* Records a command received from the client with id clientId in its text
+ * form. Does nothing if recorder is NULL or the client isn't yet in the
+ * chat.
+ *
+ * A command that couldn't be parsed is recorded as INVALID_CMD, and one
+ * with more fields than a Frame keeps has the rest filled in, so the server
+ * handles the recorded command as it handled the original. An empty
+ * command, e.g. the client closing its stdout, is recorded as
+ * RECORD_CLOSED.
+ */
+void record_received(Recorder *recorder, int clientId, Frame *cmd) {
+    if (recorder == NULL || clientId < 0) {
+        return;
+    }
+
+    if (cmd->opcode < 0 && cmd->wireLen <= 1) {
+        begin_event(recorder, clientId, RECORD_CLOSED);
+    } else if (cmd->opcode < 0) {
+        begin_event(recorder, clientId, RECORD_RECEIVED);
+        fputs(INVALID_CMD, recorder->file);
+    } else {
+        begin_event(recorder, clientId, RECORD_RECEIVED);
+        fprintf(recorder->file, "%s:", get_cmd_word(cmd->opcode, SERVER));
+        for (int i = 0; i < cmd->numFields; ++i) {
+            fputs(i == 0 ? "" : ":", recorder->file);
+            fputs(i < FRAME_MAX_FIELDS ? cmd->fields[i] : "-",
+                    recorder->file);
+        }
+    }
+    fputc('\n', recorder->file);
+}
+
+/* Records a client that connected to the server's listener joining the chat
+ * with id clientId and the given name, as a WHO: sent to it and its reply
+ */
+void record_joined(Recorder *recorder, int clientId, const char *name) {
+    if (recorder == NULL) {
+        return;
+    }
+    begin_event(recorder, clientId, RECORD_SENT);
+    fputs("WHO:\n", recorder->file);
+    begin_event(recorder, clientId, RECORD_RECEIVED);
+    fprintf(recorder->file, "NAME:%s\n", name);
+}
+
+/* Writes the time, client id and kind of a new event to a recording */
+static void begin_event(Recorder *recorder, int clientId,
+        RecordKind kind) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t nowUs = (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    fprintf(recorder->file, "%llu %d %c%s",
+            (unsigned long long) (nowUs - recorder->startUs), clientId,
+            kind, kind == RECORD_CLOSED ? "" : " ");
+}
@@ -0,0 +1,52 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "frame.h"
+
+/* Kinds of event in a recording, each the third field of its line */
+typedef enum {
+    /* A line sent to a single client */
+    RECORD_SENT = 's',
+    /* A line broadcast to every active client but one (or none) */
+    RECORD_BROADCAST = 'b',
+    /* A command received from a client */
+    RECORD_RECEIVED = 'r',
+    /* A client closed its stdout, or sent an empty line */
+    RECORD_CLOSED = 'e'
+} RecordKind;
+
+/* Struct for a recording of every line a server sends and receives, to be
+ * fed back to a server by the replay driver. (see --record and replay.c)
+ *
+ * Each event is a line of text of the form
+ *
+ *     <microseconds since the server started> <client id> <kind> <line>
+ *
+ * where the client id is the client's recordId, the order it was added to
+ * the server's ClientList in (or, for a broadcast, that of the client
+ * excluded from it, -1 for none). Unlike indices in the ClientList, which
+ * are reused once a departed client is released, no two clients of a
+ * recording share an id, so the replay driver gives each its own stand-in.
+ * Commands are recorded in their text form even if they were sent
+ * as frames. Clients that connect to the server's listener are recorded from
+ * when they join the chat, as if they had been sent WHO: and replied with
+ * the name they were given right then.
+ */
+typedef struct {
+    /* File the recording is written to */
+    FILE *file;
+    /* Time the recording started, in microseconds on a monotonic clock */
+    uint64_t startUs;
+} Recorder;
+
+Recorder *start_recorder(const char *path);
+void stop_recorder(Recorder *recorder);
+void record_sent(Recorder *recorder, int clientId, RecordKind kind,
+        const char *data, size_t len);
+void record_received(Recorder *recorder, int clientId, Frame *cmd);
+void record_joined(Recorder *recorder, int clientId, const char *name);
+
+#endif
@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <limits.h>
+#include "benchRun.h"
+
+/* Environment variable telling stand-ins to reply as fast as possible (see
+ * replayClient.c)
+ */
+#define REPLAY_FAST_ENV "REPLAY_FAST"
+
+/* Extra field a client adds to its reply to WHO: to switch to frames (see
+ * frame.h). Stand-ins only speak text, so it is dropped from their replies.
+ */
+#define BINARY_SUFFIX ":binary"
+
+/* Replay driver feeding a session recorded by a server started with
+ * --record=PATH back to the server, for repeatable benchmarks against the
+ * traffic of real sessions with no live clients involved.
+ *
+ * Every client of the recording is replaced by a stand-in (replayClient)
+ * that sends the commands the original client sent, each after the prompt
+ * (WHO: or YT:) it followed and, unless --fast is given, as long after it
+ * as in the recording. The stand-ins' scripts and a configfile starting them
+ * are written to a temporary directory, the server is run against them with
+ * the given options and the throughput of the replayed chat is reported.
+ *
+ * Clients that joined the recorded session through the server's listener
+ * are started from the configfile instead, after every other client.
+ *
+ * Usage: replay [--fast] [--bin-dir=DIR] recording [-- server options ...]
+ */
+
+/* Script of the stand-in of a single client of the recording */
+typedef struct {
+    /* Script being written, in memory until the whole recording is read */
+    FILE *script;
+    char *data;
+    size_t len;
+    /* Number of prompts the client was sent so far */
+    int numPrompts;
+    /* Time of the latest of them, in microseconds into the recording */
+    unsigned long long promptUs;
+} StandIn;
+
+/* A recording as read by read_recording() */
+typedef struct {
+    /* Stand-ins of each client id of the recording, each allocated on its
+     * own as their scripts are written to their data and len
+     */
+    StandIn **standIns;
+    int numClients;
+    /* Number of chat messages broadcast in the recording */
+    long messages;
+    /* Time of the last event of the recording in microseconds */
+    unsigned long long durationUs;
+} Recording;
+
+/* Prints the usage of the driver and exits with code 1 */
+static void usage_error(void) {
+    fprintf(stderr, "Usage: replay [--fast] [--bin-dir=DIR] recording "
+            "[-- server options ...]\n");
+    exit(1);
+}
+
+/* Returns the stand-in of the client with id clientId, adding stand-ins to
+ * recording up to it if needed
+ */
+static StandIn *get_stand_in(Recording *recording, int clientId) {
+    while (recording->numClients <= clientId) {
+        recording->standIns = realloc(recording->standIns,
+                sizeof(StandIn *) * (recording->numClients + 1));
+        StandIn *standIn = malloc(sizeof(StandIn));
+        recording->standIns[recording->numClients++] = standIn;
+        standIn->script = open_memstream(&standIn->data, &standIn->len);
+        standIn->numPrompts = 0;
+        standIn->promptUs = 0;
+    }
+
+    return recording->standIns[clientId];
+}
+
+/* Adds a single event of a recording (see recorder.h) to the script of the
+ * stand-in it concerns. Returns false if the event can't be parsed.
+ */
+static bool read_event(Recording *recording, char *event) {
+    unsigned long long timeUs;
+    int clientId;
+    char kind;
+    int lineStart;
+    if (sscanf(event, "%llu %d %c%n", &timeUs, &clientId, &kind,
+            &lineStart) != 3 || (clientId < 0 && kind != 'b')) {
+        return false;
+    }
+    char *line = event + lineStart + (event[lineStart] == ' ');
+    line[strcspn(line, "\n")] = '\0';
+    recording->durationUs = timeUs;
+
+    if (kind == 'b') {
+        recording->messages += !strncmp(line, "MSG:", 4);
+        return true;
+    }
+    StandIn *standIn = get_stand_in(recording, clientId);
+    unsigned long long delayUs = timeUs - standIn->promptUs;
+
+    if (kind == 's' && (!strcmp(line, "WHO:") || !strcmp(line, "YT:"))) {
+        standIn->numPrompts++;
+        standIn->promptUs = timeUs;
+    } else if (kind == 'r') {
+        size_t lineLen = strlen(line);
+        size_t suffixLen = strlen(BINARY_SUFFIX);
+        if (!strncmp(line, "NAME:", 5) && lineLen > suffixLen &&
+                !strcmp(line + lineLen - suffixLen, BINARY_SUFFIX)) {
+            line[lineLen - suffixLen] = '\0';
+        }
+        fprintf(standIn->script, "%d %llu r %s\n", standIn->numPrompts,
+                delayUs, line);
+    } else if (kind == 'e') {
+        fprintf(standIn->script, "%d %llu e\n", standIn->numPrompts,
+                delayUs);
+    } else if (kind != 's') {
+        return false;
+    }
+    return true;
+}
+
+/* Reads the recording at path into recording. Exits with code 1 if it
+ * can't be read.
+ */
+static void read_recording(const char *path, Recording *recording) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        exit(1);
+    }
+
+    char *event = NULL;
+    size_t eventCap = 0;
+    int lineNo = 0;
+    while (getline(&event, &eventCap, file) > 0) {
+        lineNo++;
+        if (!read_event(recording, event)) {
+            fprintf(stderr, "replay: %s:%d: bad event\n", path, lineNo);
+            exit(1);
+        }
+    }
+    free(event);
+    fclose(file);
+}
+
+/* Writes the script of every stand-in of recording and a configfile
+ * starting them from binDir into dir, and returns the path of the
+ * configfile in configPath. Exits with code 1 if a file can't be written.
+ */
+static void write_stand_ins(Recording *recording, const char *dir,
+        const char *binDir, char *configPath) {
+    sprintf(configPath, "%s/configfile", dir);
+    FILE *config = fopen(configPath, "w");
+    if (config == NULL) {
+        perror(configPath);
+        exit(1);
+    }
+
+    char path[PATH_MAX];
+    for (int i = 0; i < recording->numClients; ++i) {
+        StandIn *standIn = recording->standIns[i];
+        fclose(standIn->script);
+        sprintf(path, "%s/client%d", dir, i);
+        FILE *script = fopen(path, "w");
+        if (script == NULL) {
+            perror(path);
+            exit(1);
+        }
+        fwrite(standIn->data, 1, standIn->len, script);
+        fclose(script);
+        free(standIn->data);
+        free(standIn);
+        fprintf(config, "%s/replayClient:%s\n", binDir, path);
+    }
+    fclose(config);
+}
+
+/* Removes every file written by write_stand_ins() and dir itself */
+static void remove_stand_ins(Recording *recording, const char *dir) {
+    char path[PATH_MAX];
+    for (int i = 0; i < recording->numClients; ++i) {
+        sprintf(path, "%s/client%d", dir, i);
+        unlink(path);
+    }
+    sprintf(path, "%s/configfile", dir);
+    unlink(path);
+    rmdir(dir);
+}
+
+int main(int argc, char **argv) {
+    const char *binDir = ".";
+    bool isFast = false;
+    int argIndex = 1;
+    for (; argIndex < argc && !strncmp(argv[argIndex], "--", 2) &&
+            strcmp(argv[argIndex], "--"); ++argIndex) {
+        if (!strcmp(argv[argIndex], "--fast")) {
+            isFast = true;
+        } else if (!strncmp(argv[argIndex], "--bin-dir=", 10) &&
+                argv[argIndex][10] != '\0') {
+            binDir = argv[argIndex] + 10;
+        } else {
+            usage_error();
+        }
+    }
+    if (argIndex >= argc || !strcmp(argv[argIndex], "--") ||
+            (argIndex + 1 < argc && strcmp(argv[argIndex + 1], "--"))) {
+        usage_error();
+    }
+    const char *recordingPath = argv[argIndex];
+    int serverOptIndex = argIndex + 1 < argc ? argIndex + 2 : argc;
+
+    char absBinDir[PATH_MAX];
+    if (realpath(binDir, absBinDir) == NULL) {
+        perror(binDir);
+        return 1;
+    }
+    Recording recording = {NULL, 0, 0, 0};
+    read_recording(recordingPath, &recording);
+    char dir[] = "/tmp/replay.XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    char configPath[PATH_MAX];
+    write_stand_ins(&recording, dir, absBinDir, configPath);
+    if (isFast) {
+        setenv(REPLAY_FAST_ENV, "1", 1);
+    }
+
+    printf("%s clients=%d%s", recordingPath, recording.numClients,
+            isFast ? " --fast" : "");
+    for (int i = serverOptIndex; i < argc; ++i) {
+        printf(" %s", argv[i]);
+    }
+    printf("\n");
+    printf("recorded     %10ld messages in %.3f s\n", recording.messages,
+            recording.durationUs / 1e6);
+    fflush(stdout);
+
+    RunResult result = run_server(absBinDir, argv + serverOptIndex,
+            argc - serverOptIndex, configPath);
+    remove_stand_ins(&recording, dir);
+    free(recording.standIns);
+    print_run_result(&result);
+
+    return 0;
+}
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include "lineList.h"
+
+/* Environment variable which, if set, makes stand-ins reply as fast as
+ * possible rather than with the timing of the recording (see replay.c)
+ */
+#define REPLAY_FAST_ENV "REPLAY_FAST"
+
+/* Stand-in client run by replay in place of a client of a recorded session.
+ *
+ * Its script is a file of events, one per line, of the form
+ *
+ *     <group> <delay in microseconds> r <line>
+ *     <group> <delay in microseconds> e
+ *
+ * where r sends line to the server and e closes the stand-in's stdout, as
+ * the original client did. Events of group 0 are sent as soon as the
+ * stand-in starts, and those of group k once it has been sent its k-th WHO:
+ * or YT:, each delay after the prompt arrived unless REPLAY_FAST_ENV is set.
+ *
+ * The stand-in exits once it is kicked or its stdin is closed. Should the
+ * server prompt it more times than the original client was (i.e. the server
+ * under test behaves differently), it quits rather than keep the chat
+ * waiting.
+ *
+ * Usage: replayClient script
+ */
+
+/* A single event of a stand-in's script */
+typedef struct {
+    /* Number of the prompt the event follows */
+    int group;
+    /* Microseconds after the prompt the event happens */
+    long long delayUs;
+    /* Line to send, NULL to close stdout */
+    char *line;
+} ReplayEvent;
+
+/* Returns the current time in microseconds on a monotonic clock */
+static long long now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+/* Parses the lines of a stand-in's script into a newly allocated array of
+ * events and returns it, its length in numEvents. Empty lines are skipped.
+ * Exits with code 1 if any other line isn't an event.
+ */
+static ReplayEvent *parse_script(LineList *script, int *numEvents) {
+    ReplayEvent *events = malloc(sizeof(ReplayEvent) * script->numLines);
+    *numEvents = 0;
+    for (int i = 0; i < script->numLines; ++i) {
+        ReplayEvent *event = &events[*numEvents];
+        int lineStart = 0;
+        char kind;
+        if (script->lines[i][0] == '\0') {
+            continue;
+        } else if (sscanf(script->lines[i], "%d %lld %c%n", &event->group,
+                &event->delayUs, &kind, &lineStart) != 3 ||
+                (kind != 'r' && kind != 'e')) {
+            fprintf(stderr, "replayClient: bad event \"%s\"\n",
+                    script->lines[i]);
+            exit(1);
+        }
+        // The line follows a single space, and may itself start with one
+        char *line = script->lines[i] + lineStart;
+        event->line = kind == 'e' ? NULL : (*line == ' ' ? line + 1 : line);
+        (*numEvents)++;
+    }
+
+    return events;
+}
+
+/* Sends the events of the given group, starting from events[*next], each
+ * its delay after promptUs. Exits if one of them closes stdout.
+ */
+static void send_group(ReplayEvent *events, int numEvents, int *next,
+        int group, long long promptUs, bool isFast) {
+    for (; *next < numEvents && events[*next].group == group; ++*next) {
+        ReplayEvent *event = &events[*next];
+        long long waitUs = promptUs + event->delayUs - now_us();
+        if (!isFast && waitUs > 0) {
+            struct timespec wait = {waitUs / 1000000,
+                    (waitUs % 1000000) * 1000};
+            nanosleep(&wait, NULL);
+        }
+
+        if (event->line == NULL) {
+            exit(0);
+        }
+        printf("%s\n", event->line);
+        if (!isFast) {
+            fflush(stdout);
+        }
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    FILE *scriptFile;
+    if (argc != 2 || (scriptFile = fopen(argv[1], "r")) == NULL) {
+        fprintf(stderr, "Usage: replayClient script\n");
+        return 1;
+    }
+    LineList *script = file_to_line_list(scriptFile);
+    fclose(scriptFile);
+    int numEvents;
+    ReplayEvent *events = parse_script(script, &numEvents);
+    int lastGroup = numEvents == 0 ? 0 : events[numEvents - 1].group;
+    bool isFast = getenv(REPLAY_FAST_ENV) != NULL;
+
+    int next = 0;
+    int group = 0;
+    send_group(events, numEvents, &next, group, now_us(), isFast);
+
+    char *line = NULL;
+    size_t lineCap = 0;
+    while (getline(&line, &lineCap, stdin) > 0) {
+        if (!strcmp(line, "KICK:\n")) {
+            break;
+        } else if (strcmp(line, "WHO:\n") && strcmp(line, "YT:\n")) {
+            continue;
+        }
+
+        if (++group > lastGroup) {
+            printf("QUIT:\n");
+            fflush(stdout);
+            break;
+        }
+        send_group(events, numEvents, &next, group, now_us(), isFast);
+    }
+
+    free(line);
+    free(events);
+    free_line_list(script);
+    return 0;
+}
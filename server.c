@@ -6,6 +6,12 @@
 #include "lineList.h"
 #include "commands.h"
 #include "serverUtils.h"
+#include "serverOptions.h"
+#include "eventLoop.h"
+#include "clientSpawn.h"
+#include "listener.h"
+#include "frame.h"
+#include "probes.h"
 
 /* Enumerated enum values corresponding to valid commands a 
  * server can receive from clients.
@@ -18,22 +24,72 @@ typedef enum {
     CHAT,
     KICK,
     DONE,
-    QUIT
+    QUIT,
+    NAME,
+    READY
 } ServerCmds;
 
 void handle_clients(ClientList *chatMembers);
 int handle_client_cmd(ClientList *chatMembers, ClientInstance *client, 
-        char *cmdLine);
+        Frame *cmd);
 void handle_client_quit(ClientList *chatMembers,
         ClientInstance *leavingClient);
 void handle_client_kick(ClientList *chatMembers, char *kickedClientName);
 void handle_client_chat(ClientList *chatMembers, ClientInstance *client,
         char *msg);
+bool schedule_turn(ClientList *chatMembers, ClientInstance *client);
+static bool is_turn_due(ClientList *chatMembers, ClientInstance *client);
 void send_and_handle_yt(ClientList *chatMembers, ClientInstance *client);
+static bool charge_turn(ServerOptions *options, ClientInstance *client,
+        Frame *cmd);
+void disconnect_laggards(ClientList *chatMembers);
+static void recycle_clients(ClientList *chatMembers);
+static void reload_config(ClientList *chatMembers);
+static bool match_config_line(LineList *configLines, bool *isMatched,
+        char *line);
+static void remove_config_client(ClientList *chatMembers, char *line);
+void handle_missed_deadline(ClientList *chatMembers, ClientInstance *client);
 void negotiate_all_names(ClientList *chatMembers);
 int negotiate_name(int clientIndex, ClientList *chatMembers);
+void negotiate_names_in_parallel(ClientList *chatMembers);
+static char *get_reply_name(ClientList *chatMembers, ClientInstance *client,
+        Frame *reply);
+static bool accept_capabilities(ClientList *chatMembers,
+        ClientInstance *client, char *caps);
+static void accept_client_name(ClientList *chatMembers, int clientIndex,
+        char *name);
+static void request_name(ClientList *chatMembers, ClientInstance *client);
+static void read_name_reply(ClientList *chatMembers, ClientInstance *client);
+static int settle_names(ClientList *chatMembers, int frontier);
+static void drop_unnamed_client(ClientList *chatMembers,
+        ClientInstance *client);
+void admit_joiners(ClientList *chatMembers);
+static bool read_joiner_name(ClientList *chatMembers, ClientInstance *joiner);
 ClientList *setup_server(int argc, char **argv);
 static void suppress_sigpipe();
+static void handle_stop_signals();
+static void request_stop(int signum);
+static void handle_report_signal();
+static void request_report(int signum);
+static void handle_reload_signal();
+static void request_reload(int signum);
+static void mask_wake_signals(int how, sigset_t *previous);
+static void wait_for_signal();
+
+/* Set once the server is asked to stop by SIGINT or SIGTERM, if it listens
+ * for clients or watches its configfile
+ */
+static volatile sig_atomic_t stopRequested = 0;
+
+/* Set once the server is sent SIGUSR1, if it keeps metrics, until it has
+ * reported them
+ */
+static volatile sig_atomic_t reportRequested = 0;
+
+/* Set once the server is sent SIGHUP, if it watches its configfile, until it
+ * has read it again
+ */
+static volatile sig_atomic_t reloadRequested = 0;
 
 int main(int argc, char **argv) {
     /* Suppress the SIGPIPE signal so that the server does not exit if it
@@ -47,13 +103,53 @@ int main(int argc, char **argv) {
     negotiate_all_names(chatMembers);
    
     /* Communicate with clients as per the spec while there are active clients
-     * left in the chat
+     * left in the chat. A server that listens for clients or watches its
+     * configfile runs until it is sent SIGINT or SIGTERM, letting clients
+     * that connected or were added to the configfile join between rounds.
      */
-    while (count_active_clients(chatMembers) > 0) {
+    bool isWatching = chatMembers->options->watchConfig;
+    if (chatMembers->listener != NULL || isWatching) {
+        handle_stop_signals();
+    }
+    if (chatMembers->metrics != NULL) {
+        handle_report_signal();
+    }
+    if (isWatching) {
+        handle_reload_signal();
+        mask_wake_signals(SIG_UNBLOCK, NULL);
+    }
+    while ((count_active_clients(chatMembers) > 0 ||
+            chatMembers->listener != NULL || isWatching) && !stopRequested) {
         handle_clients(chatMembers);
+        // Metrics asked for during the round are reported at its end
+        if (reportRequested) {
+            reportRequested = 0;
+            write_metrics_report(chatMembers->metrics, chatMembers->clients,
+                    chatMembers->numClients);
+        }
+        recycle_clients(chatMembers);
+        if (reloadRequested) {
+            reloadRequested = 0;
+            reload_config(chatMembers);
+        }
+        if (chatMembers->listener == NULL) {
+            // An empty watched chat waits for its configfile to change
+            if (isWatching && count_active_clients(chatMembers) == 0) {
+                wait_for_signal();
+            }
+            continue;
+        }
+        /* Turns may never have waited on the event loop, so check it for
+         * connections and replies too. An empty chat waits for them.
+         */
+        poll_events(chatMembers->loop,
+                count_active_clients(chatMembers) > 0 ? 0 : -1);
+        admit_joiners(chatMembers);
     }
 
+    ServerOptions *options = chatMembers->options;
     free_client_list(chatMembers);
+    free_server_options(options);
 
     return 0;
 }
@@ -68,99 +164,457 @@ static void suppress_sigpipe() {
     sigaction(SIGPIPE, &ignoreSignal, 0);
 }
 
+/* Makes SIGINT and SIGTERM ask the server to stop at the end of the current
+ * round, so it can remove its listening socket and flush its stdout. Reads
+ * are restarted so no client is mistaken for having closed its stdout, but
+ * waits for events are interrupted by them all the same, as epoll_wait()
+ * and sigsuspend() are never restarted.
+ */
+static void handle_stop_signals() {
+    struct sigaction stopSignal;
+    memset(&stopSignal, 0, sizeof(struct sigaction));
+    stopSignal.sa_handler = request_stop;
+    stopSignal.sa_flags = SA_RESTART;
+    sigaction(SIGINT, &stopSignal, 0);
+    sigaction(SIGTERM, &stopSignal, 0);
+}
+
+/* Handler for SIGINT and SIGTERM set by handle_stop_signals() */
+static void request_stop(int signum) {
+    stopRequested = 1;
+}
+
+/* Makes SIGUSR1 ask the server to report its metrics at the end of the
+ * current round. Reads are restarted so no client is mistaken for having
+ * closed its stdout.
+ */
+static void handle_report_signal() {
+    struct sigaction reportSignal;
+    memset(&reportSignal, 0, sizeof(struct sigaction));
+    reportSignal.sa_handler = request_report;
+    reportSignal.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &reportSignal, 0);
+}
+
+/* Handler for SIGUSR1 set by handle_report_signal() */
+static void request_report(int signum) {
+    reportRequested = 1;
+}
+
+/* Makes SIGHUP ask the server to read its configfile again at the end of the
+ * current round. (see reload_config()) Reads are restarted as for SIGUSR1.
+ */
+static void handle_reload_signal() {
+    struct sigaction reloadSignal;
+    memset(&reloadSignal, 0, sizeof(struct sigaction));
+    reloadSignal.sa_handler = request_reload;
+    reloadSignal.sa_flags = SA_RESTART;
+    sigaction(SIGHUP, &reloadSignal, 0);
+}
+
+/* Handler for SIGHUP set by handle_reload_signal() */
+static void request_reload(int signum) {
+    reloadRequested = 1;
+}
+
+/* Blocks or unblocks (as per how, see sigprocmask()) the signals a watched
+ * server waits for when its chat is empty, storing the previous signal mask
+ * in previous unless it is NULL.
+ *
+ * A watched server blocks them before any thread starts and unblocks them
+ * in the main thread alone, so they always interrupt the main thread's
+ * waits. (see setup_server())
+ */
+static void mask_wake_signals(int how, sigset_t *previous) {
+    sigset_t wakeSignals;
+    sigemptyset(&wakeSignals);
+    sigaddset(&wakeSignals, SIGHUP);
+    sigaddset(&wakeSignals, SIGINT);
+    sigaddset(&wakeSignals, SIGTERM);
+    sigaddset(&wakeSignals, SIGUSR1);
+    sigprocmask(how, &wakeSignals, previous);
+}
+
+/* Waits for the server to be sent one of the signals it handles, when its
+ * chat is empty and it watches its configfile. The signals are blocked while
+ * their flags are checked, so one sent just before the wait isn't missed.
+ */
+static void wait_for_signal() {
+    sigset_t previous;
+    mask_wake_signals(SIG_BLOCK, &previous);
+    if (!reloadRequested && !stopRequested && !reportRequested) {
+        sigsuspend(&previous);
+    }
+    sigprocmask(SIG_SETMASK, &previous, NULL);
+}
+
 /*
  * Handles one round of communications with each client in a given ClientList
  * chatMembers. Only communicates with clients that are active.
  *
  * If a client's name isn't set, name negotation is performed with the client,
  * else the command YT: is sent to the client and the client's reply handled
+ *
+ * If every client sat out the round for having nothing to say, the server
+ * waits for one of them to send READY: or be due its fallback turn rather
+ * than starting the next round straight away. (see --ready-fallback)
  */
 void handle_clients(ClientList *chatMembers) {
-    int numClients = chatMembers->numClients;
+    // READY: sent since the last round is read before anyone is skipped
+    if (chatMembers->options->readyFallback > 0) {
+        poll_events(chatMembers->loop, 0);
+    }
+
+    bool isRoundIdle = true;
+    // Only visit clients still in the chat, in turn order
+    for (int i = chatMembers->firstActive; i >= 0;
+            i = next_active_index(chatMembers, i)) {
+        // Give the client its turn as per the server's schedule
+        if (!schedule_turn(chatMembers, chatMembers->clients[i])) {
+            isRoundIdle = false;
+        }
+    }
+
+    if (isRoundIdle && chatMembers->firstActive >= 0) {
+        poll_events(chatMembers->loop, -1);
+    }
+}
 
-    for (int i = 0; i < numClients; ++i) {
-        // Get ith client
-        ClientInstance *currentClient = chatMembers->clients[i];
+/* Gives a client its turn as per the server's schedule. (see
+ * SchedulePolicy)
+ *
+ * Under round-robin, the client's turn lasts until it sends DONE: or QUIT:,
+ * however long its reply. Otherwise the client is granted its quota of lines
+ * or bytes for the turn first, and a turn that uses up its quota ends there.
+ * (see send_and_handle_yt()) Quota left unused once the client sends DONE:
+ * isn't kept, but bytes read past it are owed: a client whose quota is still
+ * used up after the grant sits out the turn. No client can therefore hold up
+ * a round for much longer than its quota, whatever it sends.
+ *
+ * A client that named READY_CAPABILITY also sits out every turn it isn't due,
+ * without being granted any quota. (see is_turn_due()) Returns whether the
+ * client sat out its turn for that reason.
+ */
+bool schedule_turn(ClientList *chatMembers, ClientInstance *client) {
+    ServerOptions *options = chatMembers->options;
+    if (client->isReadyCapable && !client->isTurnCarried &&
+            !is_turn_due(chatMembers, client)) {
+        if (client->metrics != NULL) {
+            client->metrics->skippedTurns++;
+        }
+        return true;
+    }
 
-        // Communicate with currentClient if it is active
-        if (currentClient->isActive) {
-            // Send YT to client and handle the client's reply
-            send_and_handle_yt(chatMembers, currentClient);
+    if (options->schedulePolicy != SCHEDULE_RR) {
+        int shares = options->schedulePolicy == SCHEDULE_WEIGHTED ?
+                client->weight : 1;
+        client->turnCredit += (long long) options->scheduleQuota * shares;
+        if (client->turnCredit <= 0) {
+            return false;
         }
-    }   
+    }
+    send_and_handle_yt(chatMembers, client);
+    return false;
+}
+
+/* Returns whether a client that named READY_CAPABILITY is due a turn, i.e.
+ * it sent READY: since it was last sent YT:, its fallback turn is due or it
+ * closed its stdout. READY: commands read ahead of anything else the client
+ * sent are taken here, so they aren't left to its next turn.
+ */
+static bool is_turn_due(ClientList *chatMembers, ClientInstance *client) {
+    Frame *hint;
+    while (peek_bare_cmd(client, READY) &&
+            (hint = read_client_cmd(chatMembers, client)) != NULL) {
+        client->hasPendingOutput = true;
+        free(hint);
+    }
+
+    return client->hasPendingOutput || client->readyTimer.hasExpired ||
+            client->inputClosed;
 }
 
 /* Sends the command YT: to a specified client and handles its reply, i.e.
  * executes commands the client might give to the server, makes server stop
  * communicating with the client if it gives a invalid command.
+ *
+ * If the client's previous turn used up its quota before the client sent
+ * DONE:, YT: isn't sent again and the rest of that reply is handled instead.
+ * A turn that uses up its quota likewise ends after the command that used it
+ * up, with the client's reply carried over to its next turn.
+ * (see schedule_turn())
+ *
+ * If the server was given a turn or line deadline and the client misses it,
+ * the server's timeout policy is applied. (see handle_missed_deadline())
  */
 void send_and_handle_yt(ClientList *chatMembers, ClientInstance *client) {
-    // Sent YT to the client
-    send_client(client, "YT:\n");
-    int clientStatus;
+    ServerOptions *options = chatMembers->options;
+    ClientMetrics *metrics = client->metrics;
+    if (!client->isTurnCarried) {
+        if (metrics != NULL) {
+            metrics->turnStartUs = metrics_clock_us();
+            metrics->turnLines = 0;
+        }
+        // Sent YT to the client
+        send_client(chatMembers, client, "YT:\n");
+        client->hasPendingOutput = false;
+    }
+    client->isTurnCarried = false;
+    arm_client_deadline(chatMembers, &client->turnTimer, options->turnTimeout);
+    int clientStatus = 0;
     
-    while (1) {
+    while (client->isActive) {
         // Read the next line of the client's reply
-        char *reply = read_client_line(client, NULL);
+        arm_client_deadline(chatMembers, &client->lineTimer,
+                options->lineTimeout);
+        Frame *reply = read_client_cmd(chatMembers, client);
+        if (reply == NULL) {
+            handle_missed_deadline(chatMembers, client);
+            break;
+        }
+        if (metrics != NULL) {
+            metrics->turnLines++;
+            record_histogram(&metrics->bytesIn, reply->wireLen);
+        }
+        bool isQuotaUsed = charge_turn(options, client, reply);
 
         clientStatus = handle_client_cmd(chatMembers, client, reply);
+        // clientStatus = -1 is an invalid command, so deactivate client
+        if (clientStatus < 0 && client->isActive) {
+            handle_client_quit(chatMembers, client);
+        }
+        // The command may have left clients too far behind on their stdin
+        disconnect_laggards(chatMembers);
+        free(reply);
+
+        /* clientStatus indicates client sent DONE: or QUIT:, just break
+         * the loop
+         */
         if (clientStatus != 0) {
-            // clientStatus = -1 is an invalid command, so deactivate client
-            if (clientStatus < 0) {
-                //client->isActive = false;
-                handle_client_quit(chatMembers, client);
-            }
-            /* clientStatus indicates client sent DONE: or QUIT:, just break
-             * the loop
-             */
-            free(reply);
+            break;
+        } else if (isQuotaUsed) {
+            client->isTurnCarried = client->isActive;
             break;
         }
-        
-        free(reply);
     }
+    cancel_client_deadlines(chatMembers, client);
+    if (!client->isTurnCarried && client->turnCredit > 0) {
+        client->turnCredit = 0;
+    }
+    // Without READY:, the client is sent YT: again once its fallback is due
+    if (client->isReadyCapable && client->isActive &&
+            !client->isTurnCarried) {
+        arm_client_deadline(chatMembers, &client->readyTimer,
+                options->readyFallback);
+    }
+    // Only turns the client ended itself are timed
+    if (metrics != NULL && clientStatus != 0) {
+        record_histogram(&metrics->ytRoundTrip,
+                metrics_clock_us() - metrics->turnStartUs);
+        record_histogram(&metrics->linesPerTurn, metrics->turnLines);
+    }
+
+    // Broadcasts made during the turn are written together at its end
+    flush_held_output(chatMembers);
+}
+
+/* Charges a command read from a client against its quota for the turn, as
+ * per the server's schedule, and returns whether the quota is used up. A
+ * quota is never used up under round-robin.
+ */
+static bool charge_turn(ServerOptions *options, ClientInstance *client,
+        Frame *cmd) {
+    switch (options->schedulePolicy) {
+        case SCHEDULE_RR:
+            return false;
+        case SCHEDULE_CAP_BYTES:
+            client->turnCredit -= cmd->wireLen;
+            break;
+        default:
+            client->turnCredit--;
+    }
+    return client->turnCredit <= 0;
 }
 
-/* Handles a single command (given as the string cmdLine) from the reply of a 
- * client to the client being sent YT: by the server.
+/* Applies the server's timeout policy to a client that missed a deadline of
+ * its turn. The client either leaves the chat as if it had sent QUIT: and is
+ * disconnected, or its turn ends and the rest of that turn is discarded once
+ * it arrives.
+ */
+void handle_missed_deadline(ClientList *chatMembers, ClientInstance *client) {
+    if (chatMembers->options->timeoutPolicy == TIMEOUT_QUIT) {
+        handle_client_quit(chatMembers, client);
+        disconnect_client(chatMembers, client);
+    } else {
+        client->unfinishedTurns++;
+    }
+}
+
+/* Makes every laggard in chatMembers, i.e. every client that fell too far
+ * behind on reading its stdin under the disconnect policy, leave the chat as
+ * if it had sent QUIT:. Each laggard is then disconnected from the server.
+ */
+void disconnect_laggards(ClientList *chatMembers) {
+    ClientInstance *laggard;
+
+    while ((laggard = next_laggard(chatMembers)) != NULL) {
+        // A laggard still negotiating its name leaves without a LEFT:
+        if (laggard->isActive && laggard->name != NULL) {
+            handle_client_quit(chatMembers, laggard);
+        } else {
+            deactivate_client(chatMembers, laggard);
+        }
+        disconnect_client(chatMembers, laggard);
+    }
+}
+
+/* Frees every client that left the chat and that nothing refers to any more,
+ * and reaps those that exited, at the end of a round. Clients that left
+ * during the round are freed at the end of this one, or of the next if
+ * their shard is still writing to them. (see release_departed_clients())
+ */
+static void recycle_clients(ClientList *chatMembers) {
+    ClientInstance *client;
+
+    release_departed_clients(chatMembers);
+    while ((client = next_released(chatMembers)) != NULL) {
+        /* A shard may have made the client a laggard before it forgot it,
+         * so laggards are dealt with before the client is freed
+         */
+        disconnect_laggards(chatMembers);
+        free_released_client(chatMembers, client);
+    }
+}
+
+/* Reads the server's configfile again once it was sent SIGHUP and applies
+ * the changes made to it since it was last read, between rounds. (see
+ * --watch)
+ *
+ * Each line of the configfile as it was is matched with an identical line
+ * of the new one, each line matching at most once. For every old line left
+ * unmatched, a client started from it leaves the chat through the normal
+ * LEFT: path, if one is still in the chat. For every new line left
+ * unmatched, a client is started. New clients join at the end of the turn
+ * order and names are negotiated with them one at a time, in configfile
+ * order, so every other client keeps its place.
+ *
+ * Clients that connected to the listener are never removed. The chat is
+ * left as it is if the configfile can't be read.
+ */
+static void reload_config(ClientList *chatMembers) {
+    char *configPath = chatMembers->options->configPath;
+    FILE *configFile = fopen(configPath, "re");
+    if (configFile == NULL) {
+        perror(configPath);
+        return;
+    }
+    LineList *newLines = file_to_line_list(configFile);
+    fclose(configFile);
+    LineList *oldLines = chatMembers->configLines;
+    bool *isKept = calloc(newLines->numLines + 1, sizeof(bool));
+
+    for (int i = 0; i < oldLines->numLines; ++i) {
+        if (!match_config_line(newLines, isKept, oldLines->lines[i])) {
+            remove_config_client(chatMembers, oldLines->lines[i]);
+        }
+    }
+    flush_held_output(chatMembers);
+
+    int numAdded = 0;
+    ClientInstance **added = malloc(sizeof(ClientInstance *) *
+            (newLines->numLines + 1));
+    for (int i = 0; i < newLines->numLines; ++i) {
+        ClientInstance *client = isKept[i] ? NULL :
+                add_config_client(chatMembers, newLines->lines[i]);
+        if (client != NULL) {
+            added[numAdded++] = client;
+        }
+    }
+    // Every new client is started before any is asked its name
+    for (int i = 0; i < numAdded; ++i) {
+        while (added[i]->isActive && added[i]->name == NULL) {
+            negotiate_name(added[i]->index, chatMembers);
+            disconnect_laggards(chatMembers);
+        }
+    }
+
+    free(added);
+    free(isKept);
+    free_line_list(oldLines);
+    chatMembers->configLines = newLines;
+}
+
+/* Marks the first line of configLines identical to line and not yet marked
+ * in isMatched as matched. Returns false if there is no such line.
+ */
+static bool match_config_line(LineList *configLines, bool *isMatched,
+        char *line) {
+    for (int i = 0; i < configLines->numLines; ++i) {
+        if (!isMatched[i] && !strcmp(configLines->lines[i], line)) {
+            isMatched[i] = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Makes the first client in turn order that was started from a line of the
+ * configfile identical to line leave the chat as if it had sent QUIT:, and
+ * disconnects it. Does nothing if every such client already left.
+ */
+static void remove_config_client(ClientList *chatMembers, char *line) {
+    for (int i = chatMembers->firstActive; i >= 0;
+            i = next_active_index(chatMembers, i)) {
+        ClientInstance *client = chatMembers->clients[i];
+        if (client->configLine != NULL && !strcmp(client->configLine, line)) {
+            handle_client_quit(chatMembers, client);
+            disconnect_client(chatMembers, client);
+            disconnect_laggards(chatMembers);
+            return;
+        }
+    }
+}
+
+/* Handles a single command (given as a Frame, see read_client_cmd()) from
+ * the reply of a client to the client being sent YT: by the server.
  *
  * The arguments are:
  * chatMembers: clients currently in the server
  * client: the client that sent the command
- * cmdLine: the given command
+ * cmd: the given command
+ *
+ * Commands left over from a turn the client missed a deadline of are
+ * discarded instead, except for QUIT. Their DONE ends the leftover turn
+ * rather than the current one.
+ *
+ * READY: only tells the server the client has more to say, wherever it comes
+ * in a reply, and is invalid from clients that didn't name READY_CAPABILITY.
  *
  * -1 is returned if the command is invalid or the command was empty.
  *  1 is returned if the command was DONE or QUIT.
  *  Else 0 is returned.
  */
 int handle_client_cmd(ClientList *chatMembers, ClientInstance *client,
-        char *cmdLine) {
-
-    // Create LineList representation of cmd 
-    bool invalidCmd = false;
-    LineList *cmd = get_cmd_str(cmdLine, &invalidCmd);
-
-    // Check if the command is empty
-    if (cmd->numLines < 1) {
-        free_line_list(cmd);
-        return -1;
-    }
-
-    /* Number of arguments expected, including the command's name, for the
-     * commands CHAT, KICK, DONE and QUIT respectively
-     */
-    const int numCmdArgs[] = {2, 2, 1, 1};
-    int cmdNum = get_cmd(cmd->lines[0], SERVER);
-
+        Frame *cmd) {
+    int cmdNum = cmd->opcode;
+    PROBE3(client_cmd, client, cmdNum, cmd->wireLen);
 
     int returnFlag = 0;
-    // Check cmd is not invalid and number of arguments for the cmd is correct
-    if (invalidCmd || cmdNum < 0 || numCmdArgs[cmdNum] != cmd->numLines) {
+    // Check cmd is valid and number of arguments for the cmd is correct
+    if (cmdNum < 0 || cmdNum == NAME ||
+            (cmdNum == READY && !client->isReadyCapable) ||
+            get_cmd_num_fields(cmdNum, SERVER) != cmd->numFields) {
         returnFlag = -1;
+    } else if (cmdNum == READY) {
+        client->hasPendingOutput = true;
+    } else if (client->unfinishedTurns > 0 && cmdNum != QUIT) {
+        if (cmdNum == DONE) {
+            client->unfinishedTurns--;
+        }
     } else if (cmdNum == CHAT) {
-        handle_client_chat(chatMembers, client, cmd->lines[1]);
+        handle_client_chat(chatMembers, client, cmd->fields[0]);
     } else if (cmdNum == KICK) {
-        handle_client_kick(chatMembers, cmd->lines[1]);
+        handle_client_kick(chatMembers, cmd->fields[0]);
     } else if (cmdNum == DONE) {
         returnFlag = 1;
     } else if (cmdNum == QUIT) {
@@ -168,8 +622,6 @@ int handle_client_cmd(ClientList *chatMembers, ClientInstance *client,
         returnFlag = 1;
     }
 
-    free_line_list(cmd);
-
     return returnFlag;
 }
 
@@ -181,27 +633,27 @@ int handle_client_cmd(ClientList *chatMembers, ClientInstance *client,
  */
 void handle_client_quit(ClientList *chatMembers,
         ClientInstance *leavingClient) {
-    leavingClient->isActive = false;
-    char *msg = calloc(strlen("LEFT:\n") + strlen(leavingClient->name) + 1,
-            sizeof(char));
-    sprintf(msg, "LEFT:%s\n", leavingClient->name);
-    send_all(chatMembers, msg, -1);
-    free(msg);
+    deactivate_client(chatMembers, leavingClient);
+    SharedMsg *msg = format_shared_msg("LEFT:%s\n", leavingClient->name);
+    send_all_msg(chatMembers, msg, -1);
+    record_history(chatMembers->history, msg);
+    release_shared_msg(msg);
 
-    printf("(%s has left the chat)\n", leavingClient->name);
+    emit_transcript(chatMembers->transcript, "(%s has left the chat)\n",
+            leavingClient->name);
 }
 
 /* Sends the command KICK: to the client in chatMembers who's name is equal to 
- * the given string kickedClientName. If such a client does not exist, this
- * function does nothing.
+ * the given string kickedClientName. If such a client does not exist or has
+ * already left, this function does nothing.
  */
 void handle_client_kick(ClientList *chatMembers, char *kickedClientName) {
-    for (int i = 0; i < chatMembers->numClients; ++i) {
-        ClientInstance *client = chatMembers->clients[i];
-        if (client->isActive && client->name != NULL) {
-            if (!strcmp(client->name, kickedClientName)) {
-                send_client(client, "KICK:\n");
-            }
+    int kickedIndex = find_client_index(chatMembers, kickedClientName);
+    if (kickedIndex >= 0 && chatMembers->clients[kickedIndex]->isActive) {
+        ClientInstance *kickedClient = chatMembers->clients[kickedIndex];
+        send_client(chatMembers, kickedClient, "KICK:\n");
+        if (kickedClient->metrics != NULL) {
+            kickedClient->metrics->kicks++;
         }
     }
 }
@@ -213,42 +665,87 @@ void handle_client_kick(ClientList *chatMembers, char *kickedClientName) {
  */
 void handle_client_chat(ClientList *chatMembers, ClientInstance *client,
         char *msg) {
-    char *serverMsg = calloc(
-            strlen("MSG::\n") + strlen(client->name) + strlen(msg) + 1,
-            sizeof(char));
-    sprintf(serverMsg, "MSG:%s:%s\n", client->name, msg);
-    send_all(chatMembers, serverMsg, -1);
-    free(serverMsg);
+    // Build the message once, every client is sent the same copy of it
+    SharedMsg *serverMsg = format_shared_msg("MSG:%s:%s\n", client->name,
+            msg);
+    send_all_msg(chatMembers, serverMsg, -1);
+    record_history(chatMembers->history, serverMsg);
+    release_shared_msg(serverMsg);
 
-    printf("(%s) %s\n", client->name, msg);
+    emit_transcript(chatMembers->transcript, "(%s) %s\n", client->name, msg);
 
 }
 
 /* Command line arguments to a server are passed to this function to set up
  * all clients specified in its configfile.
  * 
- * Function exits with code 1 if an incorrect number of commandline args 
- * are given or if the configfile could not be opened.
+ * Function exits with code 1 if the commandline args are invalid (see
+ * parse_server_options() in serverOptions.c) or if the configfile could not
+ * be opened.
  *
  * Otherwise, for each valid line in its configfile, a client process is
  * created as per the given arguments in that line and a ClientInstance struct
- * corresponding to that client is created.
+ * corresponding to that client is created. Client processes are created by a
+ * helper process if the server was started with --spawn-helper.
  *
  * Each ClientInstance struct created like so is added to a ClientList struct 
  * that is returned by this function.
+ *
+ * If the server was started with --listen, it starts listening for clients
+ * once those in its configfile have been started. If it was started with
+ * --watch, its configfile is read again on SIGHUP. (see reload_config())
  */
 ClientList *setup_server(int argc, char **argv) {
+    ServerOptions *options = parse_server_options(argc, argv);
     FILE *configFile;
-    if (argc != 2 || (configFile = fopen(argv[1], "r")) == NULL) {
+    // The configfile is close-on-exec so that clients don't inherit it
+    if ((configFile = fopen(options->configPath, "re")) == NULL) {
+        free_server_options(options);
         fprintf(stderr, "Usage: server configfile\n");
         fflush(stderr);
         exit(1);
     }
 
+    // Clients are told the capabilities it accepts through their environment
+    char caps[sizeof(FRAME_CAPABILITY) + sizeof(READY_CAPABILITY)] = "";
+    if (options->binaryFrames) {
+        strcat(caps, FRAME_CAPABILITY);
+    }
+    if (options->readyFallback > 0) {
+        strcat(caps, caps[0] == '\0' ? READY_CAPABILITY :
+                "," READY_CAPABILITY);
+    }
+    if (caps[0] != '\0') {
+        setenv(FRAME_CAPS_ENV, caps, 1);
+    }
+
+    // SIGCHLD is blocked before any thread starts (see start_reaping())
+    int reapFd = start_reaping();
+    // Start the helper before the server grows, so it forks quickly
+    SpawnHelper *helper = options->spawnHelper ?
+            start_spawn_helper(options->shmTransport) : NULL;
+    // Only the main thread takes the signals a watched server waits for
+    if (options->watchConfig) {
+        mask_wake_signals(SIG_BLOCK, NULL);
+    }
+
     LineList *configLines = file_to_line_list(configFile);
-    ClientList *chatMembers = init_clients_from_lines(configLines);
-    free_line_list(configLines);
+    ClientList *chatMembers = init_clients_from_lines(configLines, options,
+            helper);
+    // A watched configfile is diffed against the lines it had (see --watch)
+    if (options->watchConfig) {
+        chatMembers->configLines = configLines;
+    } else {
+        free_line_list(configLines);
+    }
     fclose(configFile);
+    chatMembers->reapFd = reapFd;
+    if (helper != NULL) {
+        stop_spawn_helper(helper);
+    }
+    if (options->listenType != LISTEN_NONE) {
+        chatMembers->listener = start_listener(chatMembers);
+    }
 
     return chatMembers;
 }
@@ -257,8 +754,16 @@ ClientList *setup_server(int argc, char **argv) {
  * names. If a client replies with an invalid command during name negotiation,
  * that client is deactived and name negotiation performed on the next client
  * in the ClientList.
+ *
+ * If the server was started with --parallel-names, names are negotiated with
+ * every client at once instead. (see negotiate_names_in_parallel())
  */
 void negotiate_all_names(ClientList *chatMembers) {
+    if (chatMembers->options->parallelNames) {
+        negotiate_names_in_parallel(chatMembers);
+        return;
+    }
+
     for (int i = 0; i < chatMembers->numClients; ++i) {
         ClientInstance *client = chatMembers->clients[i];
         /* Name negotiate with the client until its name is set or it is
@@ -266,6 +771,7 @@ void negotiate_all_names(ClientList *chatMembers) {
          */
         while (client->isActive && client->name == NULL) {
             negotiate_name(i, chatMembers);
+            disconnect_laggards(chatMembers);
         }
     }
 }
@@ -280,7 +786,8 @@ void negotiate_all_names(ClientList *chatMembers) {
  *
  * If there is already a client with the same name in the 
  * chatMembers, NAME_TAKEN: is sent to the client else the client's name is set
- * as the name it gave.
+ * as the name it gave. A client that misses the server's line deadline is
+ * deactivated and disconnected.
  *
  * In both of these cases, this function returns 0 instead.
  */
@@ -293,27 +800,308 @@ int negotiate_name(int clientIndex, ClientList *chatMembers) {
     }
 
     // Send WHO: and wait for the client to reply with its name
-    send_client(client, "WHO:\n");
-    char *reply = read_client_line(client, NULL);
-    LineList *cmd = get_cmd_str(reply, NULL);
+    PROBE1(name_request, client);
+    send_client(chatMembers, client, "WHO:\n");
+    arm_client_deadline(chatMembers, &client->lineTimer,
+            chatMembers->options->lineTimeout);
+    Frame *reply = read_client_cmd(chatMembers, client);
+    cancel_client_deadlines(chatMembers, client);
+    if (reply == NULL) {
+        drop_unnamed_client(chatMembers, client);
+        return 0;
+    }
 
-    char *clientName;
+    char *clientName = get_reply_name(chatMembers, client, reply);
     
-    if ((cmd->numLines != 2) || strcmp(cmd->lines[0], "NAME")) {
-        client->isActive = false;
-    } else if (find_client_index(chatMembers,
-            clientName = cmd->lines[1]) < 0) {
+    if (clientName == NULL) {
+        deactivate_client(chatMembers, client);
+    } else if (!is_name_taken(chatMembers, clientName)) {
         // Set the clients name if there isn't another client with that name
-        set_client_name(client, clientName);
-        printf("(%s has entered the chat)\n", clientName);
-        fflush(stdout);
+        accept_client_name(chatMembers, clientIndex, clientName);
     } else {
         // else send NAME_TAKEN:
-        send_client(client, "NAME_TAKEN:\n");
+        send_client(chatMembers, client, "NAME_TAKEN:\n");
     }
 
     free(reply);
-    free_line_list(cmd);
 
     return 0;
 }
+
+/* Performs name negotiation with every client in chatMembers at once.
+ *
+ * WHO: is sent to every client up front and replies are handled as they
+ * arrive, so process startup and round trips of all clients overlap. Every
+ * client still ends up with the name negotiate_all_names() would give it:
+ * - a name already given to an earlier client is refused at once with
+ *   NAME_TAKEN:, as names are never given up during negotiation.
+ * - any other name is only given once every earlier client has its name (or
+ *   was deactivated), as an earlier client may yet claim it.
+ * Clients therefore enter the chat in the same order as well.
+ *
+ * Every client waiting to reply to WHO: has its own line deadline, if the
+ * server was given one.
+ */
+void negotiate_names_in_parallel(ClientList *chatMembers) {
+    EventLoop *loop = chatMembers->loop;
+    track_ready_clients(loop, true);
+
+    for (int i = 0; i < chatMembers->numClients; ++i) {
+        if (chatMembers->clients[i]->isActive) {
+            request_name(chatMembers, chatMembers->clients[i]);
+        }
+    }
+
+    // Every client before frontier has its name or has been deactivated
+    int frontier = 0;
+    while (1) {
+        ClientInstance *client;
+        while ((client = take_ready_client(loop)) != NULL) {
+            read_name_reply(chatMembers, client);
+        }
+        // Only clients yet to reply to WHO: have an armed deadline
+        Timer *timer;
+        while ((timer = pop_expired_timer(&loop->timers)) != NULL) {
+            drop_unnamed_client(chatMembers,
+                    TIMER_ENTRY(timer, ClientInstance, lineTimer));
+        }
+        frontier = settle_names(chatMembers, frontier);
+        disconnect_laggards(chatMembers);
+
+        if (frontier == chatMembers->numClients) {
+            break;
+        }
+        poll_events(loop, -1);
+    }
+
+    track_ready_clients(loop, false);
+}
+
+/* Returns the name a client gave in its reply to WHO:, pointing into the
+ * reply, or NULL if the reply is invalid, i.e. isn't NAME:<name>.
+ *
+ * If the server was started with --binary, a client may instead reply
+ * NAME:<name>:binary once, in which case everything it sends and is sent
+ * from then on is a frame. (see frame.h) Other capabilities the server
+ * offers are named the same way. (see accept_capabilities())
+ */
+static char *get_reply_name(ClientList *chatMembers, ClientInstance *client,
+        Frame *reply) {
+    PROBE3(name_reply, client, reply->opcode,
+            reply->numFields > 0 ? reply->fields[0] : NULL);
+    if (reply->opcode != NAME || reply->numFields < 1 ||
+            reply->numFields > 2) {
+        return NULL;
+    } else if (reply->numFields == 2 &&
+            !accept_capabilities(chatMembers, client, reply->fields[1])) {
+        return NULL;
+    }
+
+    return reply->fields[0];
+}
+
+/* Takes up the capabilities a client named in its reply to WHO:, a
+ * comma-separated list of them such as binary,ready, and returns whether
+ * they are valid. Each must be offered by the server (see setup_server())
+ * and not have been taken up by the client already, else none of them are.
+ */
+static bool accept_capabilities(ClientList *chatMembers,
+        ClientInstance *client, char *caps) {
+    ServerOptions *options = chatMembers->options;
+    bool isFramed = client->isFramed;
+    bool isReadyCapable = client->isReadyCapable;
+
+    for (char *cap = caps; ; cap++) {
+        size_t len = strcspn(cap, ",");
+        if (!strncmp(cap, FRAME_CAPABILITY, len) &&
+                FRAME_CAPABILITY[len] == '\0' && options->binaryFrames &&
+                !isFramed) {
+            isFramed = true;
+        } else if (!strncmp(cap, READY_CAPABILITY, len) &&
+                READY_CAPABILITY[len] == '\0' &&
+                options->readyFallback > 0 && !isReadyCapable) {
+            isReadyCapable = true;
+        } else {
+            return false;
+        }
+        cap += len;
+        if (*cap == '\0') {
+            break;
+        }
+    }
+
+    client->isFramed = isFramed;
+    client->isReadyCapable = isReadyCapable;
+    return true;
+}
+
+/* Sets the name of the client at index clientIndex of chatMembers to name,
+ * replays the history of the chat to it (if any is kept) and emits (<name>
+ * has entered the chat) to stdout of the server.
+ */
+static void accept_client_name(ClientList *chatMembers, int clientIndex,
+        char *name) {
+    set_client_name(chatMembers, clientIndex, name);
+    PROBE3(name_accept, chatMembers->clients[clientIndex], clientIndex,
+            name);
+    send_history(chatMembers, chatMembers->clients[clientIndex]);
+    emit_transcript(chatMembers->transcript, "(%s has entered the chat)\n",
+            name);
+    flush_transcript(chatMembers->transcript);
+}
+
+/* Sends WHO: to a client and handles its reply if it has already been read.
+ * Used when negotiating names in parallel.
+ */
+static void request_name(ClientList *chatMembers, ClientInstance *client) {
+    PROBE1(name_request, client);
+    send_client(chatMembers, client, "WHO:\n");
+    client->awaitingName = true;
+    arm_client_deadline(chatMembers, &client->lineTimer,
+            chatMembers->options->lineTimeout);
+    read_name_reply(chatMembers, client);
+}
+
+/* Handles the reply of a client to WHO: if it has been read, when negotiating
+ * names in parallel.
+ *
+ * A client that replies with an invalid command is deactivated. If the name
+ * it gave already belongs to a client, NAME_TAKEN: and WHO: are sent to it,
+ * else the name is kept as its proposedName until settle_names() reaches it.
+ */
+static void read_name_reply(ClientList *chatMembers, ClientInstance *client) {
+    Frame *reply;
+
+    while (client->isActive && client->awaitingName &&
+            (reply = take_client_cmd(client)) != NULL) {
+        record_received(chatMembers->recorder, client->recordId, reply);
+        client->awaitingName = false;
+        cancel_client_deadlines(chatMembers, client);
+        char *name = get_reply_name(chatMembers, client, reply);
+
+        if (name == NULL) {
+            deactivate_client(chatMembers, client);
+        } else if (is_name_taken(chatMembers, name)) {
+            send_client(chatMembers, client, "NAME_TAKEN:\n");
+            send_client(chatMembers, client, "WHO:\n");
+            client->awaitingName = true;
+            arm_client_deadline(chatMembers, &client->lineTimer,
+                    chatMembers->options->lineTimeout);
+        } else {
+            client->proposedName = strdup(name);
+        }
+
+        free(reply);
+    }
+}
+
+/* Gives proposed names to clients in chatMembers, in order, starting from the
+ * client at index frontier. Stops at the first client still waiting to reply
+ * to WHO: and returns its index, or numClients if every client is done.
+ *
+ * A client whose proposed name was taken by an earlier client is sent
+ * NAME_TAKEN: and WHO: instead.
+ */
+static int settle_names(ClientList *chatMembers, int frontier) {
+    while (frontier < chatMembers->numClients) {
+        ClientInstance *client = chatMembers->clients[frontier];
+
+        if (!client->isActive || client->name != NULL) {
+            frontier++;
+            continue;
+        } else if (client->proposedName == NULL) {
+            break;
+        }
+
+        char *name = client->proposedName;
+        client->proposedName = NULL;
+        if (!is_name_taken(chatMembers, name)) {
+            accept_client_name(chatMembers, frontier, name);
+        } else {
+            send_client(chatMembers, client, "NAME_TAKEN:\n");
+            request_name(chatMembers, client);
+        }
+        free(name);
+    }
+
+    return frontier;
+}
+
+/* Deactivates and disconnects a client that missed its deadline to reply to
+ * WHO:. It never entered the chat, so it leaves without a LEFT:.
+ */
+static void drop_unnamed_client(ClientList *chatMembers,
+        ClientInstance *client) {
+    if (client->isActive) {
+        deactivate_client(chatMembers, client);
+        disconnect_client(chatMembers, client);
+    }
+    client->awaitingName = false;
+}
+
+/* Adds every client that connected to the server's listener and has since
+ * given a name that isn't taken to the chat, in the order they connected,
+ * and drops any that gave an invalid reply or missed their line deadline.
+ * Called between rounds, so clients only ever join the chat at the end of a
+ * round.
+ *
+ * Names are negotiated with such clients as with any other: a client whose
+ * name is taken is sent NAME_TAKEN: and WHO: again, and its next reply is
+ * handled once it arrives.
+ */
+void admit_joiners(ClientList *chatMembers) {
+    Listener *listener = chatMembers->listener;
+    int numLeft = 0;
+
+    for (int i = 0; i < listener->numJoiners; ++i) {
+        ClientInstance *joiner = listener->joiners[i];
+        if (!read_joiner_name(chatMembers, joiner)) {
+            listener->joiners[numLeft++] = joiner;
+        }
+    }
+    listener->numJoiners = numLeft;
+}
+
+/* Handles every reply a client that connected to the server's listener has
+ * sent to WHO: so far. Returns true if the client is done negotiating its
+ * name, i.e. it was added to the chat or dropped, else false.
+ */
+static bool read_joiner_name(ClientList *chatMembers, ClientInstance *joiner) {
+    Frame *reply;
+    bool isValid = true;
+
+    while (isValid && !joiner->isLagging && !joiner->lineTimer.hasExpired &&
+            (reply = take_client_cmd(joiner)) != NULL) {
+        cancel_client_deadlines(chatMembers, joiner);
+        char *name = get_reply_name(chatMembers, joiner, reply);
+
+        if (name == NULL) {
+            isValid = false;
+        } else if (is_name_taken(chatMembers, name)) {
+            send_client(chatMembers, joiner, "NAME_TAKEN:\n");
+            send_client(chatMembers, joiner, "WHO:\n");
+            arm_client_deadline(chatMembers, &joiner->lineTimer,
+                    chatMembers->options->lineTimeout);
+        } else {
+            // The event loop watches the client again as a chat member
+            unwatch_client(chatMembers->loop, joiner);
+            joiner->isActive = true;
+            joiner->awaitingName = false;
+            add_client_instance(chatMembers, joiner);
+            record_joined(chatMembers->recorder, joiner->recordId, name);
+            accept_client_name(chatMembers, joiner->index, name);
+        }
+
+        free(reply);
+        if (joiner->isActive) {
+            return true;
+        }
+    }
+
+    // The client gave an invalid reply, missed its deadline or lagged
+    if (!isValid || joiner->isLagging || joiner->lineTimer.hasExpired) {
+        drop_joiner(chatMembers->listener, joiner);
+        return true;
+    }
+    return false;
+}
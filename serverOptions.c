@@ -0,0 +1,407 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lineList.h"
+#include "serverOptions.h"
+
+/* Struct describing a single option a server accepts.
+ *
+ * name is the option's name without the leading "--".
+ * setter applies the option's value (NULL if no "=value" was given) to a
+ * ServerOptions struct and returns false if the value is invalid.
+ */
+typedef struct {
+    /* Name of the option */
+    const char *name;
+    /* Function applying the option to a ServerOptions struct */
+    bool (*setter)(ServerOptions *, char *);
+} ServerOption;
+
+static bool set_event_loop(ServerOptions *options, char *value);
+static bool set_queue_limit(ServerOptions *options, char *value);
+static bool set_slow_policy(ServerOptions *options, char *value);
+static bool set_parallel_names(ServerOptions *options, char *value);
+static bool set_shards(ServerOptions *options, char *value);
+static bool set_coalesce(ServerOptions *options, char *value);
+static bool set_turn_timeout(ServerOptions *options, char *value);
+static bool set_line_timeout(ServerOptions *options, char *value);
+static bool set_timeout_policy(ServerOptions *options, char *value);
+static bool set_spawn_helper(ServerOptions *options, char *value);
+static bool set_listen(ServerOptions *options, char *value);
+static bool set_shm(ServerOptions *options, char *value);
+static bool set_binary(ServerOptions *options, char *value);
+static bool set_transcript(ServerOptions *options, char *value);
+static bool set_history(ServerOptions *options, char *value);
+static bool set_metrics(ServerOptions *options, char *value);
+static bool set_record(ServerOptions *options, char *value);
+static bool set_watch(ServerOptions *options, char *value);
+static bool set_schedule(ServerOptions *options, char *value);
+static bool set_ready_fallback(ServerOptions *options, char *value);
+static bool parse_timeout(char *value, int *timeoutMs);
+static bool parse_count(char *value, long long *count);
+static void server_usage_error(ServerOptions *options);
+
+/* Every option a server accepts */
+static const ServerOption serverOptions[] = {
+        {"event-loop", set_event_loop},
+        {"queue-limit", set_queue_limit},
+        {"slow-policy", set_slow_policy},
+        {"parallel-names", set_parallel_names},
+        {"shards", set_shards},
+        {"coalesce", set_coalesce},
+        {"turn-timeout", set_turn_timeout},
+        {"line-timeout", set_line_timeout},
+        {"timeout-policy", set_timeout_policy},
+        {"spawn-helper", set_spawn_helper},
+        {"listen", set_listen},
+        {"shm", set_shm},
+        {"binary", set_binary},
+        {"transcript", set_transcript},
+        {"history", set_history},
+        {"metrics", set_metrics},
+        {"record", set_record},
+        {"watch", set_watch},
+        {"schedule", set_schedule},
+        {"ready-fallback", set_ready_fallback}
+        };
+
+/* Number of options in serverOptions */
+static const int numServerOptions =
+        sizeof(serverOptions) / sizeof(ServerOption);
+
+/* Parses the command line arguments of a server into a newly allocated
+ * ServerOptions struct and returns a pointer to it.
+ *
+ * The arguments are expected to be any number of options followed by exactly
+ * one configfile path. The server exits with a usage error if an option is
+ * unknown, has an invalid value, or if the configfile isn't given.
+ */
+ServerOptions *parse_server_options(int argc, char **argv) {
+    ServerOptions *options = calloc(1, sizeof(ServerOptions));
+    options->queueLimit = DEFAULT_QUEUE_LIMIT;
+    options->slowPolicy = SLOW_BLOCK;
+    options->timeoutPolicy = TIMEOUT_SKIP;
+    options->transcriptPolicy = TRANSCRIPT_SYNC;
+    options->schedulePolicy = SCHEDULE_RR;
+
+    int argIndex = 1;
+    for (; argIndex < argc && !strncmp(argv[argIndex], "--", 2); ++argIndex) {
+        char *name = argv[argIndex] + 2;
+        // Split --name=value into its name and value
+        char *value = strchr(name, '=');
+        size_t nameLen = value == NULL ? strlen(name) : value - name;
+        if (value != NULL) {
+            value++;
+        }
+
+        bool isValid = false;
+        for (int i = 0; i < numServerOptions; ++i) {
+            if (strlen(serverOptions[i].name) == nameLen &&
+                    !strncmp(serverOptions[i].name, name, nameLen)) {
+                isValid = serverOptions[i].setter(options, value);
+                break;
+            }
+        }
+        if (!isValid) {
+            server_usage_error(options);
+        }
+    }
+
+    // Exactly one configfile is expected after the options
+    if (argIndex != argc - 1) {
+        server_usage_error(options);
+    }
+    options->configPath = argv[argIndex];
+
+    return options;
+}
+
+/* Frees memory allocated to a ServerOptions struct */
+void free_server_options(ServerOptions *options) {
+    free(options);
+}
+
+/* Setter for --event-loop, which takes no value */
+static bool set_event_loop(ServerOptions *options, char *value) {
+    options->eventLoop = true;
+    return value == NULL;
+}
+
+/* Setter for --queue-limit=BYTES, the high-water mark of every client's
+ * output queue. Implies --event-loop.
+ */
+static bool set_queue_limit(ServerOptions *options, char *value) {
+    long long limit;
+    if (!parse_count(value, &limit) || limit < 1) {
+        return false;
+    }
+    options->queueLimit = limit;
+    options->eventLoop = true;
+    return true;
+}
+
+/* Setter for --slow-policy=block|drop|disconnect, the policy for clients
+ * whose output queue outgrows the high-water mark. Implies --event-loop.
+ */
+static bool set_slow_policy(ServerOptions *options, char *value) {
+    // Names of each policy, in the order of the SlowClientPolicy enum
+    char *policies[] = {"block", "drop", "disconnect"};
+    int policy = value == NULL ? -1 : find_word(value, policies, 3);
+    if (policy < 0) {
+        return false;
+    }
+    options->slowPolicy = policy;
+    options->eventLoop = true;
+    return true;
+}
+
+/* Setter for --parallel-names, which takes no value. Implies --event-loop.
+ */
+static bool set_parallel_names(ServerOptions *options, char *value) {
+    options->parallelNames = true;
+    options->eventLoop = true;
+    return value == NULL;
+}
+
+/* Setter for --shards=N, the number of worker threads writing to clients.
+ * Implies --event-loop.
+ */
+static bool set_shards(ServerOptions *options, char *value) {
+    long long numShards;
+    if (!parse_count(value, &numShards) || numShards < 1 ||
+            numShards > MAX_SHARDS) {
+        return false;
+    }
+    options->numShards = numShards;
+    options->eventLoop = true;
+    return true;
+}
+
+/* Setter for --coalesce[=BYTES], which holds broadcasts made during a turn
+ * until the turn ends or BYTES of them are held for a client. Implies
+ * --event-loop.
+ */
+static bool set_coalesce(ServerOptions *options, char *value) {
+    long long limit = DEFAULT_COALESCE_LIMIT;
+    if (value != NULL && (!parse_count(value, &limit) || limit < 1)) {
+        return false;
+    }
+    options->coalesceLimit = limit;
+    options->eventLoop = true;
+    return true;
+}
+
+/* Setter for --turn-timeout=MS, the time a client has to finish its turn.
+ * Implies --event-loop.
+ */
+static bool set_turn_timeout(ServerOptions *options, char *value) {
+    options->eventLoop = true;
+    return parse_timeout(value, &options->turnTimeout);
+}
+
+/* Setter for --line-timeout=MS, the time a client has to send each line of
+ * its turn. Implies --event-loop.
+ */
+static bool set_line_timeout(ServerOptions *options, char *value) {
+    options->eventLoop = true;
+    return parse_timeout(value, &options->lineTimeout);
+}
+
+/* Setter for --timeout-policy=skip|quit, the policy for clients that miss a
+ * deadline. Implies --event-loop.
+ */
+static bool set_timeout_policy(ServerOptions *options, char *value) {
+    // Names of each policy, in the order of the TimeoutPolicy enum
+    char *policies[] = {"skip", "quit"};
+    int policy = value == NULL ? -1 : find_word(value, policies, 2);
+    if (policy < 0) {
+        return false;
+    }
+    options->timeoutPolicy = policy;
+    options->eventLoop = true;
+    return true;
+}
+
+/* Setter for --spawn-helper, which takes no value. Clients are spawned the
+ * same way either way, so this doesn't imply --event-loop.
+ */
+static bool set_spawn_helper(ServerOptions *options, char *value) {
+    options->spawnHelper = true;
+    return value == NULL;
+}
+
+/* Setter for --listen=unix:PATH|tcp:PORT, the socket clients can connect to
+ * while the server runs. TCP sockets are only bound to the loopback
+ * interface. Implies --event-loop.
+ */
+static bool set_listen(ServerOptions *options, char *value) {
+    long long port;
+    if (value == NULL) {
+        return false;
+    } else if (!strncmp(value, "unix:", 5) && value[5] != '\0') {
+        options->listenType = LISTEN_UNIX;
+        options->listenPath = value + 5;
+    } else if (!strncmp(value, "tcp:", 4) && parse_count(value + 4, &port) &&
+            port >= 1 && port <= MAX_LISTEN_PORT) {
+        options->listenType = LISTEN_TCP;
+        options->listenPort = port;
+    } else {
+        return false;
+    }
+    options->eventLoop = true;
+    return true;
+}
+
+/* Setter for --shm, which takes no value. Implies --event-loop, which reads
+ * and writes the shared memory.
+ */
+static bool set_shm(ServerOptions *options, char *value) {
+    options->shmTransport = true;
+    options->eventLoop = true;
+    return value == NULL;
+}
+
+/* Setter for --binary, which takes no value. Implies --event-loop, which
+ * reads frames. (see frame.h)
+ */
+static bool set_binary(ServerOptions *options, char *value) {
+    options->binaryFrames = true;
+    options->eventLoop = true;
+    return value == NULL;
+}
+
+/* Setter for --transcript=lines:N|ms:N, which has the transcript written by
+ * a writer thread once every N lines (or once the oldest held is too old)
+ * or at most N milliseconds after each line is emitted. Doesn't need the
+ * event loop.
+ */
+static bool set_transcript(ServerOptions *options, char *value) {
+    long long lines;
+    if (value == NULL) {
+        return false;
+    } else if (!strncmp(value, "lines:", 6) && parse_count(value + 6, &lines)
+            && lines >= 1 && lines <= MAX_TRANSCRIPT_LINES) {
+        options->transcriptPolicy = TRANSCRIPT_EVERY_LINES;
+        options->transcriptFlush = lines;
+    } else if (!strncmp(value, "ms:", 3) &&
+            parse_timeout(value + 3, &options->transcriptFlush)) {
+        options->transcriptPolicy = TRANSCRIPT_EVERY_MS;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/* Setter for --history=N, which replays the last N MSG: and LEFT: events
+ * to each client once it is named
+ */
+static bool set_history(ServerOptions *options, char *value) {
+    long long events;
+    if (!parse_count(value, &events) || events < 1 ||
+            events > MAX_HISTORY_EVENTS) {
+        return false;
+    }
+    options->historyEvents = events;
+    return true;
+}
+
+/* Setter for --metrics=PATH, which keeps metrics of the server and its
+ * clients and appends a report of them to PATH on SIGUSR1 and at exit
+ */
+static bool set_metrics(ServerOptions *options, char *value) {
+    if (value == NULL || *value == '\0') {
+        return false;
+    }
+    options->metricsPath = value;
+    return true;
+}
+
+/* Setter for --record=PATH, which records every line the server sends and
+ * receives to PATH, to be replayed by replay
+ */
+static bool set_record(ServerOptions *options, char *value) {
+    if (value == NULL || *value == '\0') {
+        return false;
+    }
+    options->recordPath = value;
+    return true;
+}
+
+/* Setter for --watch, which takes no value. The server then runs until it
+ * is sent SIGINT or SIGTERM, reading its configfile again on SIGHUP.
+ */
+static bool set_watch(ServerOptions *options, char *value) {
+    options->watchConfig = true;
+    return value == NULL;
+}
+
+/* Setter for --schedule=rr|cap-lines:N|cap-bytes:N|weighted:N, how much of
+ * a client's reply is handled in a turn. (see SchedulePolicy) Any policy but
+ * rr implies --event-loop, which reads the rest of a reply while other
+ * clients take their turns.
+ */
+static bool set_schedule(ServerOptions *options, char *value) {
+    // Names of each policy, in the order of the SchedulePolicy enum
+    char *policies[] = {"rr", "cap-lines", "cap-bytes", "weighted"};
+    long long quota;
+    if (value != NULL && !strcmp(value, policies[SCHEDULE_RR])) {
+        options->schedulePolicy = SCHEDULE_RR;
+        return true;
+    }
+
+    for (int i = SCHEDULE_CAP_LINES; value != NULL && i <= SCHEDULE_WEIGHTED;
+            ++i) {
+        size_t nameLen = strlen(policies[i]);
+        if (!strncmp(value, policies[i], nameLen) && value[nameLen] == ':' &&
+                parse_count(value + nameLen + 1, &quota) && quota >= 1 &&
+                quota <= MAX_SCHEDULE_QUOTA) {
+            options->schedulePolicy = i;
+            options->scheduleQuota = quota;
+            options->eventLoop = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Setter for --ready-fallback=MS. Clients are then offered
+ * READY_CAPABILITY, and a client that takes it up is only sent YT: once it
+ * sends READY:, or MS milliseconds after its last turn. Implies --event-loop.
+ */
+static bool set_ready_fallback(ServerOptions *options, char *value) {
+    options->eventLoop = true;
+    return parse_timeout(value, &options->readyFallback);
+}
+
+/* Parses a whole option value as a deadline of 1 to MAX_TIMEOUT_MS
+ * milliseconds and stores it in *timeoutMs. Returns false if it isn't one.
+ */
+static bool parse_timeout(char *value, int *timeoutMs) {
+    long long timeout;
+    if (!parse_count(value, &timeout) || timeout < 1 ||
+            timeout > MAX_TIMEOUT_MS) {
+        return false;
+    }
+    *timeoutMs = timeout;
+    return true;
+}
+
+/* Parses a whole option value as a non-negative decimal integer and stores
+ * it in *count. Returns false if value is NULL or isn't such an integer.
+ */
+static bool parse_count(char *value, long long *count) {
+    if (value == NULL || *value == '\0') {
+        return false;
+    }
+    char *end;
+    *count = strtoll(value, &end, 10);
+    return *end == '\0' && *count >= 0;
+}
+
+/* Emits the server's usage error to stderr and exits with code 1 */
+static void server_usage_error(ServerOptions *options) {
+    free_server_options(options);
+    fprintf(stderr, "Usage: server configfile\n");
+    fflush(stderr);
+    exit(1);
+}
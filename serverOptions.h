@@ -0,0 +1,184 @@
+#ifndef SERVEROPTIONS_H
+#define SERVEROPTIONS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "outputQueue.h"
+
+/* Default high-water mark of a client's output queue (1 MiB) */
+#define DEFAULT_QUEUE_LIMIT (1 << 20)
+
+/* Default number of bytes of broadcasts held for a client by --coalesce
+ * before they are written early, the default capacity of a pipe (64 KiB)
+ */
+#define DEFAULT_COALESCE_LIMIT (1 << 16)
+
+/* Maximum number of shards a server can be split into */
+#define MAX_SHARDS 256
+
+/* Highest TCP port a server can listen on */
+#define MAX_LISTEN_PORT 65535
+
+/* Maximum turn or line deadline in milliseconds (one day) */
+#define MAX_TIMEOUT_MS (24 * 60 * 60 * 1000)
+
+/* Maximum number of lines of the transcript a server's writer thread holds
+ * before writing them (see --transcript)
+ */
+#define MAX_TRANSCRIPT_LINES (1 << 20)
+
+/* Maximum number of events a server keeps to replay to late joiners (see
+ * --history)
+ */
+#define MAX_HISTORY_EVENTS (1 << 16)
+
+/* Maximum number of lines or bytes of a turn under --schedule */
+#define MAX_SCHEDULE_QUOTA (1 << 30)
+
+/* Maximum weight of a configfile entry under --schedule=weighted */
+#define MAX_SCHEDULE_WEIGHT 1000
+
+/* Possible policies for a client that misses a deadline of its turn */
+typedef enum {
+    /* End the client's turn, discarding the rest of it once it arrives */
+    TIMEOUT_SKIP,
+    /* Make the client leave the chat as if it had sent QUIT: */
+    TIMEOUT_QUIT
+} TimeoutPolicy;
+
+/* Possible policies for when a server's transcript is written to its stdout
+ */
+typedef enum {
+    /* As it is emitted, by the main thread through stdio */
+    TRANSCRIPT_SYNC,
+    /* By a writer thread, once every transcriptFlush lines, or once the
+     * oldest line held is TRANSCRIPT_MAX_AGE_MS old (see transcript.h)
+     */
+    TRANSCRIPT_EVERY_LINES,
+    /* By a writer thread, at most transcriptFlush milliseconds after each
+     * line was emitted
+     */
+    TRANSCRIPT_EVERY_MS
+} TranscriptPolicy;
+
+/* Possible policies for how much of a client's reply is handled in a turn.
+ * Under any policy but SCHEDULE_RR, a turn that uses up its quota ends there
+ * and the rest of the reply is carried over to the client's next turn.
+ */
+typedef enum {
+    /* Every turn lasts until the client sends DONE: or QUIT: */
+    SCHEDULE_RR,
+    /* A turn handles at most scheduleQuota lines */
+    SCHEDULE_CAP_LINES,
+    /* A turn handles lines until scheduleQuota bytes were read. Bytes read
+     * past the quota are counted against the client's next turn.
+     */
+    SCHEDULE_CAP_BYTES,
+    /* A turn handles at most scheduleQuota lines per unit of weight of the
+     * client's configfile entry, given as program:arg:weight
+     */
+    SCHEDULE_WEIGHTED
+} SchedulePolicy;
+
+/* Kinds of socket a server can listen on for clients to connect to */
+typedef enum {
+    /* Don't listen; every client comes from the configfile */
+    LISTEN_NONE,
+    /* A Unix-domain stream socket bound to a path */
+    LISTEN_UNIX,
+    /* A TCP socket bound to a port of the loopback interface */
+    LISTEN_TCP
+} ListenType;
+
+/* Struct storing the options a server was started with.
+ *
+ * Options are given on the command line before the configfile in the form
+ * --name or --name=value. Every option is off by default so that a server
+ * started with just a configfile behaves exactly as the spec describes.
+ */
+typedef struct {
+    /* Path to the server's configfile */
+    char *configPath;
+    /* Whether client I/O is driven by the epoll based event loop (see
+     * eventLoop.c) rather than blocking reads on one client at a time
+     */
+    bool eventLoop;
+    /* High-water mark in bytes of each client's output queue */
+    size_t queueLimit;
+    /* What happens to a client whose output queue outgrows queueLimit */
+    SlowClientPolicy slowPolicy;
+    /* Whether names are negotiated with every client at once at startup */
+    bool parallelNames;
+    /* Number of worker threads writing to clients, 0 to write from the main
+     * thread (see shard.c)
+     */
+    int numShards;
+    /* Bytes of broadcasts held for a client until the end of the current
+     * turn before they are written early, 0 to write every broadcast at once
+     */
+    size_t coalesceLimit;
+    /* Milliseconds a client has from being sent YT: to sending DONE:, 0 for
+     * no limit
+     */
+    int turnTimeout;
+    /* Milliseconds a client has to send each line of its turn or its reply
+     * to WHO:, 0 for no limit
+     */
+    int lineTimeout;
+    /* What happens to a client that misses its turn or line deadline */
+    TimeoutPolicy timeoutPolicy;
+    /* Whether clients are started by a helper process while the server
+     * parses its configfile (see clientSpawn.c)
+     */
+    bool spawnHelper;
+    /* Kind of socket clients can connect to while the server runs */
+    ListenType listenType;
+    /* Path of the Unix-domain socket listened on, for LISTEN_UNIX */
+    char *listenPath;
+    /* Port of the TCP socket listened on, for LISTEN_TCP */
+    int listenPort;
+    /* Whether clients are offered shared memory to talk to the server over
+     * instead of their pipes (see shmRing.h)
+     */
+    bool shmTransport;
+    /* Whether clients may switch to sending and receiving binary frames
+     * rather than lines of text (see frame.h)
+     */
+    bool binaryFrames;
+    /* When the server's transcript is written to its stdout (see
+     * transcript.c)
+     */
+    TranscriptPolicy transcriptPolicy;
+    /* Number of lines or milliseconds of transcriptPolicy */
+    int transcriptFlush;
+    /* Number of the most recent MSG: and LEFT: events replayed to each
+     * client once it is named, 0 to keep no history (see history.c)
+     */
+    int historyEvents;
+    /* Path of the file reports of the server's metrics are appended to,
+     * NULL if no metrics are kept (see metrics.c)
+     */
+    char *metricsPath;
+    /* Path of the file the session is recorded to, NULL if it isn't
+     * recorded (see recorder.c)
+     */
+    char *recordPath;
+    /* Whether the configfile is read again on SIGHUP, starting clients added
+     * to it and removing those taken out of it (see reload_config())
+     */
+    bool watchConfig;
+    /* How much of a client's reply is handled in a turn */
+    SchedulePolicy schedulePolicy;
+    /* Number of lines or bytes of schedulePolicy */
+    int scheduleQuota;
+    /* Milliseconds after its last turn a client that tells the server when
+     * it has something to say is sent YT: anyway, 0 if clients aren't
+     * offered READY_CAPABILITY (see frame.h)
+     */
+    int readyFallback;
+} ServerOptions;
+
+ServerOptions *parse_server_options(int argc, char **argv);
+void free_server_options(ServerOptions *options);
+
+#endif
@@ -4,76 +4,91 @@
 #include <fcntl.h>
 #include <string.h>
 #include <signal.h>
+#include <sys/socket.h>
 #include "lineList.h"
 #include "commands.h"
 #include "serverUtils.h"
+#include "eventLoop.h"
+#include "nameTable.h"
+#include "mpscQueue.h"
+#include "shard.h"
+#include "clientSpawn.h"
+#include "botEngine.h"
+#include "listener.h"
+#include "frame.h"
+#include "probes.h"
 
-/* Uses fork and exec to create a new client child-process given a valid
- * configfile command stored in a LineList struct cmd. cmd is assumed to
- * be storing two strings, the clientProgram and clientScript where:
- *
- * clientProgram: path to the client program
- * (i.e. client, clientbot)
- *
- * clientScript: argument to be passed into the client program
- * (for clients this is the path to its chatscript whilst for clientbots it is
- * the path to its reponsefile)
- *
- * A new ClientInstance struct for this client is initialized and read and 
- * write pipes to this new process are created, connected to the calling
- * process, and saved to this struct as FILE * objects.
- *
- * Finally, a pointer to this struct is then returned.
- *
- */
-ClientInstance *new_client_instance(LineList *cmd) {
-    ClientInstance *newClient;
+static void fan_out_msg(ClientList *chatMembers, SharedMsg *msg,
+        int excludedIndex);
+static void frame_shared_msg(SharedMsg *msg);
+static void record_bytes_out(ClientInstance *client, SharedMsg *msg);
+static int split_sent_line(char *line, int *opcode, char **fields,
+        size_t *fieldLens);
+static ClientInstance *new_bot_instance(ClientList *chatMembers,
+        char *responsePath);
+static LineList *parse_config_line(char *line, ServerOptions *options,
+        int *weight);
+static bool take_config_client(ClientList *chatMembers, SpawnHelper *helper,
+        char **pendingLines, int *numTaken);
 
-    /* Create two pipes, one for reading from the client, the other for
-     * writing to it
-     */
-    int readPipe[2];
-    int writePipe[2];
-    pipe(readPipe);
-    pipe(writePipe);
-
-    if (fork()) {
-        //Create new ClientInstance struct
-        newClient = (ClientInstance *) malloc(sizeof(ClientInstance));
-        newClient->name = NULL;
-        newClient->isActive = true;
-
-        /* Close unneeded pipe ends and open the read end of readPipe and
-         * write end of writePipe as files.
-         */
-        close(readPipe[1]);
-        close(writePipe[0]);
-        newClient->readEnd = fdopen(readPipe[0], "r");
-        newClient->writeEnd = fdopen(writePipe[1], "w");
-    } else {
-        /* Closed unneeded pipe ends and connected stdout/stdin to the
-         * readPipe/writePipe respectively.
-         */
-        close(readPipe[0]);
-        close(writePipe[1]);
-        dup2(readPipe[1], 1);
-        close(readPipe[1]);
-        dup2(writePipe[0], 0);
-        close(writePipe[0]);
-
-        // dup2 stderr to the null device to suppress it
-        int nullDevice = open("/dev/null", O_WRONLY);
-        dup2(nullDevice, 2);
-        
-        char *clientProgram = cmd->lines[0];
-        char *clientScript = cmd->lines[1];
-        execlp(clientProgram, clientProgram, clientScript, NULL);
-
-        // Free the cmd LineList if the execlp call failed
-        free_line_list(cmd);
-        exit(-1);
+/* Initializes and allocates memory for a ClientInstance struct for a client
+ * process that was just started (see spawn_client() in clientSpawn.c) and
+ * returns a pointer to it. The read and write ends of the pipes to the
+ * process are opened as FILE * objects, and the ShmChannel it was offered
+ * (if any) is mapped.
+ */
+ClientInstance *new_client_instance(SpawnedClient *spawned) {
+    //Create new ClientInstance struct
+    ClientInstance *newClient = (ClientInstance *) malloc(
+            sizeof(ClientInstance));
+    newClient->name = NULL;
+    newClient->isActive = true;
+    newClient->readFd = spawned->readFd;
+    init_line_buffer(&newClient->input);
+    newClient->inputClosed = false;
+    newClient->writeFd = spawned->writeFd;
+    init_output_queue(&newClient->output);
+    newClient->isWatchingOutput = false;
+    newClient->isOutputHeld = false;
+    init_timer(&newClient->turnTimer);
+    init_timer(&newClient->lineTimer);
+    init_timer(&newClient->readyTimer);
+    newClient->unfinishedTurns = 0;
+    newClient->isLagging = false;
+    newClient->pid = spawned->pid;
+    newClient->isSocket = false;
+    newClient->isInputReady = false;
+    newClient->awaitingName = false;
+    newClient->proposedName = NULL;
+    newClient->shard = NULL;
+    newClient->shardPos = -1;
+    newClient->bot = NULL;
+    newClient->isOutputOnRing = false;
+    newClient->isFramed = false;
+    newClient->metrics = NULL;
+    newClient->index = -1;
+    newClient->recordId = -1;
+    newClient->isReleasing = false;
+    newClient->configLine = NULL;
+    newClient->weight = 1;
+    newClient->turnCredit = 0;
+    newClient->isTurnCarried = false;
+    newClient->isReadyCapable = false;
+    newClient->hasPendingOutput = true;
+    memcpy(newClient->shmFds, spawned->shmFds, sizeof(newClient->shmFds));
+    PROBE2(client_spawn, newClient, spawned->pid);
+    newClient->shm = spawned->shmFds[SHM_MEMORY] < 0 ? NULL :
+            map_shm_channel(spawned->shmFds[SHM_MEMORY]);
+    if (newClient->shm == NULL) {
+        close_shm_fds(newClient->shmFds);
     }
 
+    // In-process bots have no pipes
+    newClient->readEnd = spawned->readFd < 0 ? NULL :
+            fdopen(spawned->readFd, "r");
+    newClient->writeEnd = spawned->writeFd < 0 ? NULL :
+            fdopen(spawned->writeFd, "w");
+
     return newClient;
 }
 
@@ -84,98 +99,543 @@ ClientInstance *new_client_instance(LineList *cmd) {
  * Frees memory allocated to store the client's name.
  */
 void free_client_instance(ClientInstance *client) {
-    fclose(client->readEnd);
-    fclose(client->writeEnd);
+    if (client->readEnd != NULL) {
+        fclose(client->readEnd);
+    }
+    if (client->writeEnd != NULL) {
+        fclose(client->writeEnd);
+    }
+    if (client->bot != NULL) {
+        free_bot(client->bot);
+    }
+    if (client->shm != NULL) {
+        unmap_shm_channel(client->shm);
+        close_shm_fds(client->shmFds);
+    }
+    free_line_buffer(&client->input);
+    free_output_queue(&client->output);
+    free(client->proposedName);
+    free(client->configLine);
     free(client->name);
+    free(client->metrics);
     free(client);
 }
 
-/* Sends a string msg to the stdin of the given client instance. */
-void send_client(ClientInstance *client, char *msg) {
-    fprintf(client->writeEnd, "%s", msg);
-    fflush(client->writeEnd);
+/* Sends a string msg to the stdin of the given client instance in
+ * chatMembers. (see send_client_msg())
+ */
+void send_client(ClientList *chatMembers, ClientInstance *client, char *msg) {
+    SharedMsg *sharedMsg = new_shared_msg(msg);
+    record_sent(chatMembers->recorder, client->recordId, RECORD_SENT, msg,
+            sharedMsg->len);
+    send_client_msg(chatMembers, client, sharedMsg);
+    release_shared_msg(sharedMsg);
+}
+
+/* Sends a SharedMsg msg to the stdin of the given client instance in
+ * chatMembers. The caller keeps its reference to msg.
+ *
+ * If the server runs an event loop, msg is queued for the client. (see
+ * queue_client_output()) If the server is sharded, msg is handed to the
+ * client's shard, which queues it instead. If the client is an in-process
+ * bot, msg is handed straight to the bot.
+ *
+ * msg is counted in the client's metrics, if kept, by whichever thread
+ * writes or queues it. (see queue_client_output())
+ */
+void send_client_msg(ClientList *chatMembers, ClientInstance *client,
+        SharedMsg *msg) {
+    if (client->isFramed) {
+        frame_shared_msg(msg);
+    }
+
+    if (client->bot != NULL) {
+        record_bytes_out(client, msg);
+        deliver_to_bot(chatMembers->bots, client, msg->data, msg->len);
+    } else if (chatMembers->loop == NULL) {
+        record_bytes_out(client, msg);
+        fwrite(msg->data, sizeof(char), msg->len, client->writeEnd);
+        fflush(client->writeEnd);
+    } else if (client->shard != NULL) {
+        post_shard(client->shard, SHARD_SEND, client, msg);
+    } else {
+        queue_client_output(chatMembers->loop, chatMembers, client, msg,
+                false);
+    }
+}
+
+/* Adds a reference to a SharedMsg msg to a client's output queue and writes
+ * as much of the queue as possible without blocking, using the given event
+ * loop to write the rest once the client's stdin is writable.
+ *
+ * If mayHold is set and the server coalesces output, the queue is instead
+ * held back until the end of the turn (see flush_held_output()), unless that
+ * would leave more than the coalescing limit unwritten. Queues are only ever
+ * written in order, so clients see messages in the same order either way.
+ *
+ * Should the queue outgrow the server's high-water mark, the server's slow
+ * client policy is applied. (see SlowClientPolicy in outputQueue.h)
+ *
+ * A client that switched to frames is sent msg's frame instead, if it was
+ * encoded. (see frame_shared_msg()) Messages sent before the switch are
+ * still sent as text, which such clients tell apart from frames.
+ *
+ * Every message queued is counted in the client's metrics here, broadcasts
+ * included, so the client's bytesOut has a single writer: the thread that
+ * owns its queue. The main thread may report it meanwhile, so it is
+ * recorded atomically. (see record_histogram() in metrics.c)
+ */
+void queue_client_output(EventLoop *loop, ClientList *chatMembers,
+        ClientInstance *client, SharedMsg *msg, bool mayHold) {
+    // Laggards are about to leave the chat, so they are sent nothing more
+    if (client->isLagging) {
+        return;
+    }
+    if (client->isFramed && msg->framed != NULL) {
+        msg = msg->framed;
+    }
+
+    record_bytes_out(client, msg);
+    enqueue_output(&client->output, msg);
+    size_t limit = chatMembers->options->queueLimit;
+    size_t queuedBytes = client->output.queuedBytes;
+    if (mayHold && queuedBytes < chatMembers->options->coalesceLimit &&
+            queuedBytes <= limit) {
+        hold_client_output(loop, client);
+        return;
+    }
+    flush_client_output(loop, client);
+
+    if (client->output.queuedBytes <= limit) {
+        return;
+    }
+
+    switch (chatMembers->options->slowPolicy) {
+        case SLOW_BLOCK:
+            // Keep every other pipe of the loop drained whilst waiting
+            while (client->output.queuedBytes > limit) {
+                poll_events(loop, -1);
+            }
+            break;
+        case SLOW_DROP_OLDEST:
+            drop_oldest_output(&client->output, limit);
+            break;
+        case SLOW_DISCONNECT:
+            client->isLagging = true;
+            discard_client_output(loop, client);
+            // Clients yet to join the chat are dropped by their owner
+            if (client->index >= 0) {
+                push_mpsc(&chatMembers->laggards, &client->laggardNode);
+            }
+            break;
+    }
+}
+
+/* Counts a message sent to a client in the client's metrics, if kept */
+static void record_bytes_out(ClientInstance *client, SharedMsg *msg) {
+    if (client->metrics != NULL) {
+        record_histogram(&client->metrics->bytesOut, msg->len);
+    }
+}
+
+/* Reads a single command from stdout of a client in chatMembers and returns
+ * it as a newly allocated Frame, whether the client sent it as a frame or a
+ * line of text. (see take_client_cmd())
+ *
+ * If the server runs an event loop, other clients' output is also read while
+ * waiting for the command, else this blocks on the client's readEnd alone.
+ * NULL is returned if one of the client's deadlines passes before the
+ * command arrives. (see arm_client_deadline())
+ */
+Frame *read_client_cmd(ClientList *chatMembers, ClientInstance *client) {
+    Frame *cmd;
+
+    // Bots reply as soon as they are sent anything, so never keep us waiting
+    if (client->bot != NULL) {
+        cmd = take_client_cmd(client);
+    } else if (chatMembers->loop != NULL) {
+        cmd = wait_client_cmd(chatMembers->loop, client);
+    } else {
+        char *line = read_file_line(client->readEnd, NULL);
+        cmd = text_to_frame(line, SERVER);
+        free(line);
+    }
+
+    if (cmd != NULL) {
+        record_received(chatMembers->recorder, client->recordId, cmd);
+    }
+    return cmd;
+}
+
+/* Arms one of the deadline timers of a client in chatMembers to expire
+ * delayMs milliseconds from now. Does nothing if delayMs is 0, i.e. if the
+ * server wasn't given that deadline.
+ */
+void arm_client_deadline(ClientList *chatMembers, Timer *timer, int delayMs) {
+    if (delayMs > 0) {
+        arm_timer(&chatMembers->loop->timers, timer, delayMs);
+    }
 }
 
-/* Reads a single line from stdout of a client and returns it as a string */
-char *read_client_line(ClientInstance *client, bool *isLineEmpty) {
-    return read_file_line(client->readEnd, isLineEmpty);
+/* Cancels every deadline of a client in chatMembers */
+void cancel_client_deadlines(ClientList *chatMembers, ClientInstance *client) {
+    if (chatMembers->loop != NULL) {
+        cancel_timer(&chatMembers->loop->timers, &client->turnTimer);
+        cancel_timer(&chatMembers->loop->timers, &client->lineTimer);
+        cancel_timer(&chatMembers->loop->timers, &client->readyTimer);
+    }
 }
 
-/* Sets the name of a ClientInstance struct client.
+/* Sets the name of the client at index clientIndex of chatMembers.
  * Allocates memory for and copies the given name into the name member of
- * client. It is assumed that the member was previously NULL, if not, there 
- * may be a memory leak.
+ * the client and adds the name to the name table of chatMembers. It is
+ * assumed that the member was previously NULL, if not, there may be a memory
+ * leak.
  */
-void set_client_name(ClientInstance *client, char *name) {
+void set_client_name(ClientList *chatMembers, int clientIndex, char *name) {
+    ClientInstance *client = chatMembers->clients[clientIndex];
     client->name = calloc(strlen(name) + 1, sizeof(char));
     strcpy(client->name, name);
+    insert_name(chatMembers->names, client->name, clientIndex);
 }
 
-/* Finds the first client in a ClientList with a given name and returns its
- * index. Otherwise -1 is returned if such a client is not found
+/* Finds the client in a ClientList with a given name and returns its index.
+ * Otherwise -1 is returned if such a client is not found, or NAME_RETIRED
+ * if the client has since been released and its slot may hold another.
+ *
+ * Names stay in the name table after their client leaves the chat, so as
+ * in the spec, a name is never given out twice. (see is_name_taken())
  */
 int find_client_index(ClientList *chatMembers, char *name) {
-    int foundIndex = -1;
-
-    // Check the names of each client in chatMembers if it matches name
-    for (int i = 0; i < chatMembers->numClients; ++i) {
-        char *clientName = (chatMembers->clients[i])->name;
-        // Do nothing if the client's name isn't set yet
-        if (clientName == NULL) {
-            ;
-        } else if (clientName != NULL && !strcmp(clientName, name)) {
-            foundIndex = i;
-            break;
-        }
-    }
+    return lookup_name(chatMembers->names, name);
+}
 
-    return foundIndex;
+/* Returns whether a name belongs to a client of a ClientList, whether or not
+ * that client is still in the chat or has been released.
+ */
+bool is_name_taken(ClientList *chatMembers, char *name) {
+    return find_client_index(chatMembers, name) != -1;
 }
 
 /* Initializes and allocates memory for a new ClientList struct and returns
- * a pointer to it.
+ * a pointer to it. The server's event loop, shards and transcript writer are
+ * created here if the given options ask for them.
  */
-ClientList *init_client_list() {
+ClientList *init_client_list(ServerOptions *options) {
     ClientList *chatMembers = malloc(sizeof(ClientList));
     chatMembers->numClients = 0;
     chatMembers->clients = (ClientInstance **) malloc(0);
+    chatMembers->options = options;
+    chatMembers->names = init_name_table();
+    chatMembers->firstActive = -1;
+    chatMembers->lastActive = -1;
+    chatMembers->numActive = 0;
+    chatMembers->loop = options->eventLoop ? init_event_loop() : NULL;
+    init_mpsc_queue(&chatMembers->laggards);
+    chatMembers->departed = NULL;
+    chatMembers->numDeparted = 0;
+    init_mpsc_queue(&chatMembers->released);
+    chatMembers->freeSlots = NULL;
+    chatMembers->numFreeSlots = 0;
+    chatMembers->numAdded = 0;
+    chatMembers->reapFd = -1;
+    chatMembers->shards = NULL;
+    chatMembers->numShards = 0;
+    chatMembers->bots = NULL;
+    chatMembers->numActiveBots = 0;
+    chatMembers->listener = NULL;
+    chatMembers->configLines = NULL;
+    chatMembers->transcript = options->transcriptPolicy == TRANSCRIPT_SYNC ?
+            NULL : start_transcript(STDOUT_FILENO, options->transcriptPolicy,
+            options->transcriptFlush);
+    chatMembers->history = options->historyEvents == 0 ? NULL :
+            new_history(options->historyEvents);
+    chatMembers->metrics = options->metricsPath == NULL ? NULL :
+            new_server_metrics(options->metricsPath);
+    chatMembers->recorder = options->recordPath == NULL ? NULL :
+            start_recorder(options->recordPath);
+    if (options->numShards > 0) {
+        start_shards(chatMembers, options->numShards);
+    }
 
     return chatMembers;
 }
 
 /* Frees all memory allocated to a ClientList struct. */
 void free_client_list(ClientList *chatMembers) {
+    // Stop writing to clients before they are freed
+    if (chatMembers->shards != NULL) {
+        stop_shards(chatMembers);
+    }
+    if (chatMembers->configLines != NULL) {
+        free_line_list(chatMembers->configLines);
+    }
+    if (chatMembers->listener != NULL) {
+        stop_listener(chatMembers->listener);
+    }
+    if (chatMembers->metrics != NULL) {
+        write_metrics_report(chatMembers->metrics, chatMembers->clients,
+                chatMembers->numClients);
+        free_server_metrics(chatMembers->metrics);
+    }
+
     // Free memory allocated to each client in the ClientList
     for (int i = 0; i < chatMembers->numClients; ++i) {
-        free_client_instance(chatMembers->clients[i]);
+        if (chatMembers->clients[i] != NULL) {
+            free_client_instance(chatMembers->clients[i]);
+        }
+    }
+    if (chatMembers->loop != NULL) {
+        free_event_loop(chatMembers->loop);
     }
+    if (chatMembers->bots != NULL) {
+        free_bot_engine(chatMembers->bots);
+    }
+    // Everything emitted is written before the server exits
+    if (chatMembers->transcript != NULL) {
+        stop_transcript(chatMembers->transcript);
+    }
+    if (chatMembers->history != NULL) {
+        free_history(chatMembers->history);
+    }
+    if (chatMembers->recorder != NULL) {
+        stop_recorder(chatMembers->recorder);
+    }
+    if (chatMembers->reapFd >= 0) {
+        close(chatMembers->reapFd);
+    }
+    free_name_table(chatMembers->names);
+    free(chatMembers->departed);
+    free(chatMembers->freeSlots);
     free(chatMembers->clients);
     free(chatMembers);
 }
 
 /* Adds a new ClientInstance * to an existing ClientList struct 
- * Allocates memory for the new pointer then adds it to the end of the 
- * clients array of the struct
+ * Takes up the slot of a released client if there is one, else allocates
+ * memory for the new pointer then adds it to the end of the clients array of
+ * the struct. The client is added to the end of the list of active clients
+ * either way. The client is watched by the server's event loop if it runs
+ * one and joins a shard if the server is sharded, the shard then writing
+ * any output still queued for it.
  */
 void add_client_instance(ClientList *chatMembers, ClientInstance *newClient) {
-    chatMembers->clients = (ClientInstance **) realloc(chatMembers->clients,
-            sizeof(ClientInstance *) * (chatMembers->numClients + 1));
-    chatMembers->clients[chatMembers->numClients++] = newClient;
+    int newIndex;
+    if (chatMembers->numFreeSlots > 0) {
+        newIndex = chatMembers->freeSlots[--chatMembers->numFreeSlots];
+    } else {
+        chatMembers->clients = (ClientInstance **) realloc(
+                chatMembers->clients,
+                sizeof(ClientInstance *) * (chatMembers->numClients + 1));
+        newIndex = chatMembers->numClients++;
+    }
+    chatMembers->clients[newIndex] = newClient;
+    newClient->index = newIndex;
+    newClient->recordId = chatMembers->numAdded++;
+
+    newClient->prevActive = chatMembers->lastActive;
+    newClient->nextActive = -1;
+    if (chatMembers->lastActive < 0) {
+        chatMembers->firstActive = newIndex;
+    } else {
+        chatMembers->clients[chatMembers->lastActive]->nextActive = newIndex;
+    }
+    chatMembers->lastActive = newIndex;
+    chatMembers->numActive++;
+    if (chatMembers->metrics != NULL) {
+        newClient->metrics = new_client_metrics();
+    }
+
+    // In-process bots have no pipes to watch or write to
+    if (newClient->bot != NULL) {
+        chatMembers->numActiveBots++;
+        return;
+    }
+    if (chatMembers->loop != NULL) {
+        watch_client(chatMembers->loop, newClient);
+    }
+    if (chatMembers->shards != NULL) {
+        // Output queued whilst the client negotiated its name is the shard's
+        hand_over_client_output(chatMembers->loop, newClient);
+        newClient->shard = &chatMembers->shards[newIndex %
+                chatMembers->numShards];
+        post_shard(newClient->shard, SHARD_JOIN, newClient, NULL);
+    }
 }
 
-/* Counts and returns the number of active clients in a ClientList.
+/* Sets a client in chatMembers to inactive, i.e. the server stops
+ * communicating with it, and removes it from the list of active clients.
+ * Its output is no longer read by the event loop and nothing more is
+ * written to it.
  */
-int count_active_clients(ClientList *chatMembers) {
-    int count = 0;
+void deactivate_client(ClientList *chatMembers, ClientInstance *client) {
+    if (!client->isActive) {
+        return;
+    }
+    client->isActive = false;
+    // Clients outside the chat (see listener.c) are freed by their owner
+    if (client->index >= 0) {
+        chatMembers->departed = realloc(chatMembers->departed,
+                sizeof(int) * (chatMembers->numDeparted + 1));
+        chatMembers->departed[chatMembers->numDeparted++] = client->index;
+    }
 
-    for (int i = 0; i < chatMembers->numClients; ++i) {
-        ClientInstance *client = chatMembers->clients[i];
-        if (client->isActive) {
-            count++;
+    if (client->prevActive < 0) {
+        chatMembers->firstActive = client->nextActive;
+    } else {
+        chatMembers->clients[client->prevActive]->nextActive =
+                client->nextActive;
+    }
+    if (client->nextActive < 0) {
+        chatMembers->lastActive = client->prevActive;
+    } else {
+        chatMembers->clients[client->nextActive]->prevActive =
+                client->prevActive;
+    }
+    chatMembers->numActive--;
+
+    if (client->bot != NULL) {
+        chatMembers->numActiveBots--;
+        return;
+    }
+    if (chatMembers->loop != NULL) {
+        unwatch_client(chatMembers->loop, client);
+    }
+    if (client->shard != NULL) {
+        post_shard(client->shard, SHARD_LEAVE, client, NULL);
+    } else if (chatMembers->loop != NULL) {
+        discard_client_output(chatMembers->loop, client);
+    }
+}
+
+/* Removes the longest waiting laggard from chatMembers and returns it, or
+ * returns NULL if there are none. (see SLOW_DISCONNECT in outputQueue.h)
+ */
+ClientInstance *next_laggard(ClientList *chatMembers) {
+    MpscNode *node = pop_mpsc(&chatMembers->laggards);
+    return node == NULL ? NULL :
+            MPSC_ENTRY(node, ClientInstance, laggardNode);
+}
+
+/* Closes the stdin of a client in chatMembers that has been deactivated and
+ * terminates its process, as it may otherwise block forever on a pipe the
+ * server no longer writes to.
+ */
+void disconnect_client(ClientList *chatMembers, ClientInstance *client) {
+    // A client being released has had its stdin closed already
+    if (client->isReleasing) {
+        return;
+    }
+    // The client's shard may still be writing to it
+    if (client->shard != NULL) {
+        post_shard(client->shard, SHARD_CLOSE, client, NULL);
+    } else {
+        close_client_stdin(client);
+    }
+    if (client->pid > 0) {
+        kill(client->pid, SIGTERM);
+    }
+}
+
+/* Starts releasing every client of chatMembers that left the chat since
+ * this was last called, i.e. at the end of a round, once no round or
+ * broadcast can reach them. Each is handed to next_released() once no other
+ * thread refers to it: straight away, or once its shard has closed its stdin
+ * and forgotten it.
+ *
+ * Exited clients are reaped here too, if the server reaps them.
+ */
+void release_departed_clients(ClientList *chatMembers) {
+    if (chatMembers->reapFd >= 0) {
+        reap_children(chatMembers->reapFd);
+    }
+
+    for (int i = 0; i < chatMembers->numDeparted; ++i) {
+        int index = chatMembers->departed[i];
+        ClientInstance *client = chatMembers->clients[index];
+        client->isReleasing = true;
+        if (client->shard != NULL) {
+            post_shard(client->shard, SHARD_CLOSE, client, NULL);
+            post_shard(client->shard, SHARD_RELEASE, client, NULL);
+        } else {
+            push_mpsc(&chatMembers->released, &client->releaseNode);
+        }
+    }
+    chatMembers->numDeparted = 0;
+}
+
+/* Removes the next client that is ready to be freed from chatMembers and
+ * returns it, or returns NULL if there are none. (see
+ * release_departed_clients())
+ */
+ClientInstance *next_released(ClientList *chatMembers) {
+    MpscNode *node = pop_mpsc(&chatMembers->released);
+    return node == NULL ? NULL :
+            MPSC_ENTRY(node, ClientInstance, releaseNode);
+}
+
+/* Frees a client taken from next_released(), closing its pipes, and frees
+ * its slot in chatMembers for clients that join later. Its name is retired
+ * rather than freed, so no later client can take it. Its process (if any)
+ * exits on seeing EOF on its stdin, if it hasn't already.
+ */
+void free_released_client(ClientList *chatMembers, ClientInstance *client) {
+    if (client->metrics != NULL) {
+        write_departure_report(chatMembers->metrics, client);
+    }
+    cancel_client_deadlines(chatMembers, client);
+    if (client->name != NULL) {
+        retire_name(chatMembers->names, client->name);
+    }
+
+    chatMembers->clients[client->index] = NULL;
+    chatMembers->freeSlots = realloc(chatMembers->freeSlots,
+            sizeof(int) * (chatMembers->numFreeSlots + 1));
+    chatMembers->freeSlots[chatMembers->numFreeSlots++] = client->index;
+    free_client_instance(client);
+}
+
+/* Closes the pipe to a client's stdin. A client that connected to the
+ * server's listener is sent EOF through its socket instead. The ShmChannel
+ * to a client is closed too, so it sees EOF whichever it reads.
+ */
+void close_client_stdin(ClientInstance *client) {
+    if (client->writeEnd == NULL) {
+        return;
+    }
+    if (client->shm != NULL) {
+        close_ring(&client->shm->toClient);
+        if (take_waiting(&client->shm->toClient.readerWaiting)) {
+            ring_bell(client->shmFds[SHM_CLIENT_BELL]);
         }
     }
+    // The socket stays open for reading until the client is freed
+    if (client->isSocket) {
+        shutdown(client->writeFd, SHUT_WR);
+    }
+    fclose(client->writeEnd);
+    client->writeEnd = NULL;
+    client->writeFd = -1;
+}
+
+/* Returns the number of active clients in a ClientList. */
+int count_active_clients(ClientList *chatMembers) {
+    return chatMembers->numActive;
+}
+
+/* Returns the index of the first active client after the client at
+ * clientIndex in turn order, or -1 if there is none. The client at
+ * clientIndex may itself have left the chat.
+ */
+int next_active_index(ClientList *chatMembers, int clientIndex) {
+    int nextIndex = chatMembers->clients[clientIndex]->nextActive;
+
+    // Clients that left after clientIndex did still point onwards
+    while (nextIndex >= 0 && !chatMembers->clients[nextIndex]->isActive) {
+        nextIndex = chatMembers->clients[nextIndex]->nextActive;
+    }
 
-    return count;
+    return nextIndex;
 }
 
 /* Sends a string msg to the stdin of all active clients in a given
@@ -184,14 +644,103 @@ int count_active_clients(ClientList *chatMembers) {
  * excludedIndex can be set to -1 to send msg to all active clients.
  */
 void send_all(ClientList *chatMembers, char *msg, int excludedIndex) {
-    for (int i = 0; i < chatMembers->numClients; ++i) {
-        ClientInstance *currentClient = chatMembers->clients[i];
-        if (currentClient->isActive && i != excludedIndex) {
-            send_client(currentClient, msg);
+    SharedMsg *sharedMsg = new_shared_msg(msg);
+    send_all_msg(chatMembers, sharedMsg, excludedIndex);
+    release_shared_msg(sharedMsg);
+}
+
+/* Replays the events kept in the history of chatMembers (if any) to a
+ * client that was just named, all in a single message. (see --history)
+ */
+void send_history(ClientList *chatMembers, ClientInstance *client) {
+    SharedMsg *events = copy_history(chatMembers->history);
+    if (events != NULL) {
+        record_sent(chatMembers->recorder, client->recordId, RECORD_SENT,
+                events->data, events->len);
+        send_client_msg(chatMembers, client, events);
+        release_shared_msg(events);
+    }
+}
+
+/* Sends a SharedMsg msg to the stdin of all active clients in a given
+ * ClientList except the client who's index is equal to excludedIndex (-1 to
+ * send it to all of them). Every recipient is sent a reference to the same
+ * message, which is never copied. The caller keeps its reference to msg.
+ *
+ * Broadcasts may be held back until the end of the turn. (see
+ * queue_client_output())
+ */
+void send_all_msg(ClientList *chatMembers, SharedMsg *msg,
+        int excludedIndex) {
+    record_sent(chatMembers->recorder, excludedIndex < 0 ? -1 :
+            chatMembers->clients[excludedIndex]->recordId, RECORD_BROADCAST,
+            msg->data, msg->len);
+    if (chatMembers->metrics == NULL) {
+        fan_out_msg(chatMembers, msg, excludedIndex);
+        return;
+    }
+
+    uint64_t startUs = metrics_clock_us();
+    fan_out_msg(chatMembers, msg, excludedIndex);
+    record_histogram(&chatMembers->metrics->fanOutTime,
+            metrics_clock_us() - startUs);
+    record_histogram(&chatMembers->metrics->broadcastBytes, msg->len);
+}
+
+/* Hands a SharedMsg msg to every active client of chatMembers, except the
+ * client at excludedIndex, or to their shards. (see send_all_msg())
+ */
+static void fan_out_msg(ClientList *chatMembers, SharedMsg *msg,
+        int excludedIndex) {
+    PROBE3(broadcast, msg->data, msg->len, chatMembers->numActive);
+    // Shards may send the frame too, so it is encoded before they see msg
+    if (chatMembers->options->binaryFrames) {
+        frame_shared_msg(msg);
+    }
+
+    // Shards each send msg to their own clients
+    if (chatMembers->shards != NULL) {
+        ClientInstance *excluded = excludedIndex < 0 ? NULL :
+                chatMembers->clients[excludedIndex];
+        for (int i = 0; i < chatMembers->numShards; ++i) {
+            post_shard(&chatMembers->shards[i], SHARD_BROADCAST, excluded,
+                    msg);
+        }
+        // Bots belong to no shard, so they are still sent msg from here
+        if (chatMembers->numActiveBots == 0) {
+            return;
+        }
+    }
+
+    for (int i = chatMembers->firstActive; i >= 0;
+            i = next_active_index(chatMembers, i)) {
+        ClientInstance *client = chatMembers->clients[i];
+        if (i == excludedIndex ||
+                (chatMembers->shards != NULL && client->bot == NULL)) {
+            continue;
+        }
+        if (chatMembers->loop == NULL || client->bot != NULL) {
+            send_client_msg(chatMembers, chatMembers->clients[i], msg);
+        } else {
+            queue_client_output(chatMembers->loop, chatMembers,
+                    chatMembers->clients[i], msg, true);
         }
     }
 }
 
+/* Writes every broadcast held back for the clients of chatMembers, i.e. at
+ * the end of a turn when the server coalesces output. (see --coalesce)
+ */
+void flush_held_output(ClientList *chatMembers) {
+    if (chatMembers->shards != NULL) {
+        for (int i = 0; i < chatMembers->numShards; ++i) {
+            post_shard(&chatMembers->shards[i], SHARD_FLUSH, NULL, NULL);
+        }
+    } else if (chatMembers->loop != NULL) {
+        release_held_output(chatMembers->loop);
+    }
+}
+
 /* Initializes a new ClientList given a configfile represented as a LineList
  * struct configLines.
  * (i.e. a LineList containing every individual line of the configfile)
@@ -200,23 +749,218 @@ void send_all(ClientList *chatMembers, char *msg, int excludedIndex) {
  * start a new client process as per these arguments. Invalid or commented
  * lines are ignored.
  *
+ * Lines whose program is BOT_PROGRAM start in-process bots instead. (see
+ * botEngine.c) Other clients are started by helper if it isn't NULL, else by
+ * the server itself.
+ * Requests to the helper are sent as lines are parsed and its replies taken
+ * whenever it can't accept more, so the two work in parallel. Clients are
+ * added to the ClientList in configfile order either way, each remembering
+ * the line it was started from.
+ *
  * Returns a ClientList struct containing ClientInstance structs for each
- * client process started.
+ * client process started, set up as per the server's options.
  */
-ClientList *init_clients_from_lines(LineList *configLines) {
-    ClientList *chatMembers = init_client_list();
+ClientList *init_clients_from_lines(LineList *configLines,
+        ServerOptions *options, SpawnHelper *helper) {
+    ClientList *chatMembers = init_client_list(options);
+    // Lines of the clients requested from helper, oldest first
+    char **pendingLines = malloc(sizeof(char *) * configLines->numLines);
+    int numRequested = 0;
+    int numTaken = 0;
 
     for (int i = 0; i < configLines->numLines; ++i) {
-        LineList *cmd = get_cmd_str(configLines->lines[i], NULL);
+        char *line = configLines->lines[i];
+        int weight;
+        LineList *cmd = parse_config_line(line, options, &weight);
+        if (cmd == NULL) {
+            continue;
+        }
 
-        /* Check the current line is not a comment and has the correct number
-         * of arguments.
-         */
-        if (!is_comment(configLines->lines[i]) && cmd->numLines == 2) {
-            add_client_instance(chatMembers, new_client_instance(cmd));
+        if (helper == NULL || !strcmp(cmd->lines[0], BOT_PROGRAM)) {
+            // Keep clients in configfile order
+            while (helper != NULL && take_config_client(chatMembers, helper,
+                    pendingLines, &numTaken)) {
+                continue;
+            }
+            add_config_client(chatMembers, line);
+        } else {
+            while (!request_spawn(helper, cmd->lines[0], cmd->lines[1]) &&
+                    take_config_client(chatMembers, helper, pendingLines,
+                    &numTaken)) {
+                continue;
+            }
+            pendingLines[numRequested++] = line;
         }
         free_line_list(cmd);
     }
 
+    while (helper != NULL && take_config_client(chatMembers, helper,
+            pendingLines, &numTaken)) {
+        continue;
+    }
+    free(pendingLines);
+
     return chatMembers;
-}
\ No newline at end of file
+}
+
+/* Starts a client as per a line of a configfile (see
+ * init_clients_from_lines()) and adds it to chatMembers. The server starts
+ * the client itself, as the spawn helper only runs while the server starts
+ * up.
+ *
+ * Returns the new client, or NULL if the line is invalid or commented, in
+ * which case no client is started.
+ */
+ClientInstance *add_config_client(ClientList *chatMembers, char *line) {
+    int weight;
+    LineList *cmd = parse_config_line(line, chatMembers->options, &weight);
+    if (cmd == NULL) {
+        return NULL;
+    }
+
+    ClientInstance *newClient;
+    if (!strcmp(cmd->lines[0], BOT_PROGRAM)) {
+        newClient = new_bot_instance(chatMembers, cmd->lines[1]);
+    } else {
+        SpawnedClient spawned;
+        spawn_client(cmd->lines[0], cmd->lines[1],
+                chatMembers->options->shmTransport, &spawned);
+        newClient = new_client_instance(&spawned);
+    }
+    free_line_list(cmd);
+
+    newClient->configLine = strdup(line);
+    newClient->weight = weight;
+    add_client_instance(chatMembers, newClient);
+    return newClient;
+}
+
+/* Encodes a SharedMsg msg, one or more commands sent to clients as lines of
+ * text, as frames and keeps them as msg's framed, unless that was already
+ * done. Only ever called by the main thread, before msg is handed to any
+ * shard. Only a replayed history holds more than one command.
+ */
+static void frame_shared_msg(SharedMsg *msg) {
+    if (msg->framed != NULL) {
+        return;
+    }
+
+    char *fields[FRAME_MAX_FIELDS];
+    size_t fieldLens[FRAME_MAX_FIELDS];
+    char *msgEnd = msg->data + msg->len;
+    size_t framedLen = 0;
+    for (char *line = msg->data; line < msgEnd;
+            line = strchr(line, '\n') + 1) {
+        int opcode;
+        int numFields = split_sent_line(line, &opcode, fields, fieldLens);
+        framedLen += frame_size(numFields, fieldLens);
+    }
+
+    msg->framed = alloc_shared_msg(framedLen);
+    framedLen = 0;
+    for (char *line = msg->data; line < msgEnd;
+            line = strchr(line, '\n') + 1) {
+        int opcode;
+        int numFields = split_sent_line(line, &opcode, fields, fieldLens);
+        framedLen += encode_frame(msg->framed->data + framedLen, opcode,
+                numFields, fields, fieldLens);
+    }
+}
+
+/* Splits line, a command the server formatted to send to clients, into its
+ * opcode and fields, pointing into line, and returns its number of fields.
+ *
+ * The server formats every command itself, so the last field is simply the
+ * rest of the line and may contain ':'. A line that ends before all of its
+ * command's fields, or has no ':' at all, only keeps the fields it has, and
+ * a line naming no known command has none, its opcode being one clients
+ * reject as invalid.
+ */
+static int split_sent_line(char *line, int *opcode, char **fields,
+        size_t *fieldLens) {
+    char *cmdEnd = line + strcspn(line, ":\n");
+    char *lineEnd = strchr(cmdEnd, '\n');
+    char delimiter = *cmdEnd;
+    *cmdEnd = '\0';
+    *opcode = get_cmd(line, CLIENT);
+    *cmdEnd = delimiter;
+    int numFields = delimiter == ':' ? get_cmd_num_fields(*opcode, CLIENT) : 0;
+
+    for (int i = 0; i < numFields; ++i) {
+        fields[i] = (i == 0 ? cmdEnd : fields[i - 1] + fieldLens[i - 1]) + 1;
+        if (i == numFields - 1) {
+            fieldLens[i] = lineEnd - fields[i];
+        } else {
+            fieldLens[i] = strcspn(fields[i], ":\n");
+            if (fields[i][fieldLens[i]] == '\n') {
+                numFields = i + 1;
+            }
+        }
+    }
+
+    return numFields < 0 ? 0 : numFields;
+}
+
+/* Creates a ClientInstance struct for a new in-process bot of chatMembers
+ * using the responsefile at responsePath and returns a pointer to it.
+ */
+static ClientInstance *new_bot_instance(ClientList *chatMembers,
+        char *responsePath) {
+    SpawnedClient noProcess;
+    init_spawned_client(&noProcess, -1, -1, -1);
+    ClientInstance *newClient = new_client_instance(&noProcess);
+
+    if (chatMembers->bots == NULL) {
+        chatMembers->bots = init_bot_engine();
+    }
+    start_bot(chatMembers->bots, newClient, responsePath);
+
+    return newClient;
+}
+
+/* Splits a line of a configfile into its program and argument, returned as
+ * the first two lines of a LineList, and stores the weight of the entry in
+ * weight. Returns NULL if the line is a comment or doesn't have the correct
+ * number of arguments.
+ *
+ * Under --schedule=weighted, a line may also be given a weight of 1 to
+ * MAX_SCHEDULE_WEIGHT as a third argument, i.e. program:arg:weight. Every
+ * other entry has a weight of 1.
+ */
+static LineList *parse_config_line(char *line, ServerOptions *options,
+        int *weight) {
+    LineList *cmd = get_cmd_str(line, NULL);
+    bool isWeighted = options->schedulePolicy == SCHEDULE_WEIGHTED &&
+            cmd->numLines == 3;
+    char *end = NULL;
+    long parsed = isWeighted ? strtol(cmd->lines[2], &end, 10) : 1;
+
+    if (is_comment(line) || (cmd->numLines != 2 && !isWeighted) ||
+            (end != NULL && (end == cmd->lines[2] || *end != '\0')) ||
+            parsed < 1 || parsed > MAX_SCHEDULE_WEIGHT) {
+        free_line_list(cmd);
+        return NULL;
+    }
+    *weight = parsed;
+    return cmd;
+}
+
+/* Takes the client a spawn helper started for its oldest pending request
+ * and adds it to chatMembers, remembering the line of the configfile it was
+ * started from, the next of pendingLines not yet taken. (see numTaken)
+ * Returns false if no requests are pending.
+ */
+static bool take_config_client(ClientList *chatMembers, SpawnHelper *helper,
+        char **pendingLines, int *numTaken) {
+    SpawnedClient spawned;
+    if (!take_spawned_client(helper, &spawned)) {
+        return false;
+    }
+    ClientInstance *newClient = new_client_instance(&spawned);
+    char *line = pendingLines[(*numTaken)++];
+    free_line_list(parse_config_line(line, chatMembers->options,
+            &newClient->weight));
+    newClient->configLine = strdup(line);
+    add_client_instance(chatMembers, newClient);
+    return true;
+}
@@ -3,7 +3,54 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <sys/types.h>
 #include "lineList.h"
+#include "lineBuffer.h"
+#include "serverOptions.h"
+#include "outputQueue.h"
+#include "nameTable.h"
+#include "mpscQueue.h"
+#include "timerWheel.h"
+#include "clientSpawn.h"
+#include "shmRing.h"
+#include "frame.h"
+#include "transcript.h"
+#include "history.h"
+#include "metrics.h"
+#include "recorder.h"
+
+typedef struct ClientInstance ClientInstance;
+typedef struct EventLoop EventLoop;
+typedef struct Shard Shard;
+typedef struct ClientBot ClientBot;
+typedef struct BotEngine BotEngine;
+typedef struct Listener Listener;
+
+/* Types of file descriptors watched by a server's event loop */
+typedef enum {
+    /* A client's stdout, read by the server */
+    CLIENT_INPUT,
+    /* The doorbell a client rings when it writes to its ShmChannel */
+    CLIENT_SHM_INPUT,
+    /* A client's stdin, written to by the server */
+    CLIENT_OUTPUT,
+    /* An eventfd other threads use to wake the loop's thread */
+    LOOP_WAKE,
+    /* A socket the server accepts client connections on */
+    LISTENER
+} EventSourceType;
+
+/* Struct registered with the event loop for each watched file descriptor,
+ * identifying what the descriptor is when epoll reports it ready.
+ */
+typedef struct {
+    /* What the file descriptor is */
+    EventSourceType type;
+    /* Client the file descriptor belongs to, if any */
+    ClientInstance *client;
+    /* Listener the file descriptor belongs to, if any */
+    Listener *listener;
+} EventSource;
 
 /* Struct for storing information pertaining to a client child process of the
  * current server.
@@ -16,8 +63,11 @@
  *
  * isActive is a bool flag that is initialized to true and set to false only
  * if the client has left the server.
+ *
+ * The remaining members are only used when the server runs its event loop
+ * (see eventLoop.c), which reads and writes the client's pipes without stdio.
  */
-typedef struct {
+struct ClientInstance {
     /* File pointer to the pipe end the server uses to read the client's stdout
      */
     FILE *readEnd;
@@ -28,7 +78,132 @@ typedef struct {
     char *name;
     /* Whether or not the client is active */
     bool isActive;
-} ClientInstance;
+    /* File descriptor underlying readEnd */
+    int readFd;
+    /* Bytes read from the client not yet handled as complete lines */
+    LineBuffer input;
+    /* Whether the client has closed its stdout (EOF was read) */
+    bool inputClosed;
+    /* File descriptor underlying writeEnd, -1 once closed */
+    int writeFd;
+    /* Messages not yet written to the client's stdin */
+    OutputQueue output;
+    /* Whether the event loop is waiting for writeFd to become writable */
+    bool isWatchingOutput;
+    /* Whether the client is in its event loop's list of held output */
+    bool isOutputHeld;
+    /* Whether the client is to be disconnected for not reading its stdin.
+     * Only clients in the chat are also queued as laggards; one yet to join
+     * is dropped by the listener instead. (see read_joiner_name())
+     */
+    bool isLagging;
+    /* Process ID of the client, -1 if it has none */
+    pid_t pid;
+    /* Whether the client connected to the server's listener, in which case
+     * readFd and writeFd are copies of the same socket (see listener.c)
+     */
+    bool isSocket;
+    /* Indices of the previous and next active clients in turn order, -1 if
+     * there are none. Once the client leaves, nextActive is left as it was
+     * so a round that is part way through the client can still move on.
+     */
+    int prevActive;
+    int nextActive;
+    /* Index of the client in its ClientList */
+    int index;
+    /* Number of clients added to its ClientList before the client, which
+     * unlike index is never reused, identifying it in recordings (see
+     * recorder.h)
+     */
+    int recordId;
+    /* Whether the client is in its event loop's list of ready clients */
+    bool isInputReady;
+    /* Whether WHO: was sent to the client and its reply not yet read */
+    bool awaitingName;
+    /* Name the client replied with that can't be given to it yet, as
+     * clients before it are still negotiating their names. NULL otherwise.
+     */
+    char *proposedName;
+    /* Node linking the client into its ClientList's laggards */
+    MpscNode laggardNode;
+    /* Shard writing to the client, NULL if the server isn't sharded */
+    Shard *shard;
+    /* Index of the client in its shard's members, -1 if not a member */
+    int shardPos;
+    /* Deadline of the client's turn, armed when it is sent YT: */
+    Timer turnTimer;
+    /* Deadline of the next line of the client's turn or reply to WHO: */
+    Timer lineTimer;
+    /* Time the client is next sent YT: even if it hasn't sent READY:,
+     * armed at the end of each of its turns (see --ready-fallback)
+     */
+    Timer readyTimer;
+    /* Number of turns the client missed a deadline of and hasn't yet sent
+     * DONE: for. The rest of such turns is discarded as it arrives.
+     */
+    int unfinishedTurns;
+    /* In-process bot standing in for the client's process, NULL if the
+     * client is a real process (see botEngine.c)
+     */
+    ClientBot *bot;
+    /* Shared memory the client was offered to talk over instead of its
+     * pipes, NULL if it wasn't offered any (see shmRing.h)
+     */
+    ShmChannel *shm;
+    /* Server's end of shm, in the order of ShmFd */
+    int shmFds[SHM_NUM_FDS];
+    /* Whether output to the client is written to shm rather than writeFd,
+     * i.e. once the client has attached to it
+     */
+    bool isOutputOnRing;
+    /* Whether the client switched to sending and being sent frames rather
+     * than lines of text (see frame.h)
+     */
+    bool isFramed;
+    /* Event loop registrations for readFd and writeFd respectively. While
+     * output is written to shm, outputSource is registered for the doorbell
+     * rung as the client makes space instead.
+     */
+    EventSource inputSource;
+    EventSource outputSource;
+    /* Event loop registration for the doorbell rung as the client writes to
+     * shm
+     */
+    EventSource shmSource;
+    /* Metrics of the client, NULL if the server keeps none */
+    ClientMetrics *metrics;
+    /* Whether the client left the chat and is being released, after which
+     * it is never disconnected again (see release_departed_clients())
+     */
+    bool isReleasing;
+    /* Node linking the client into its ClientList's released clients */
+    MpscNode releaseNode;
+    /* Line of the configfile the client was started from, NULL if it
+     * connected to the listener instead (see reload_config() in server.c)
+     */
+    char *configLine;
+    /* Weight of the client's configfile entry, 1 unless it was given one
+     * (see SCHEDULE_WEIGHTED)
+     */
+    int weight;
+    /* Lines or bytes of its quota the client has left this turn, negative
+     * while bytes read past its quota are counted against its next turns
+     * (see schedule_turn() in server.c)
+     */
+    long long turnCredit;
+    /* Whether the client's last turn used up its quota before it sent
+     * DONE:, so its next turn goes on with the same reply
+     */
+    bool isTurnCarried;
+    /* Whether the client named READY_CAPABILITY in its reply to WHO:, so it
+     * is only sent YT: once it has something to say (see frame.h)
+     */
+    bool isReadyCapable;
+    /* Whether the client may have something to say, i.e. it sent READY:
+     * since it was last sent YT:. Set until its first turn.
+     */
+    bool hasPendingOutput;
+};
 
 /* Struct for storing information pertaining to every client that was in the
  * server when the server was started.
@@ -36,25 +211,145 @@ typedef struct {
  * clients is an array of ClientInstance structs storing info of each client.
  * numClients is the total number of clients in the server at the start of the
  * server.
+ * options are the options the server was started with and loop is the
+ * server's event loop, or NULL if it isn't running one.
+ *
+ * names maps the name of every client that has had one to its index.
+ *
+ * Active clients are also kept in a doubly linked list (through the
+ * prevActive and nextActive members of each client) in turn order, so rounds
+ * and broadcasts only ever visit clients that are still in the chat.
+ *
+ * laggards are clients whose output queue outgrew the server's high-water
+ * mark under the disconnect policy. They are made to leave the chat by the
+ * server once it is done handling the current command. Shard worker threads
+ * add laggards too, so this is a lock-free queue.
+ *
+ * If the server was started with --shards, writing to clients is done by
+ * worker threads, one per shard. (see shard.c)
+ *
+ * Clients whose configfile program is BOT_PROGRAM are in-process bots rather
+ * than processes. Messages to them are handled by the main thread as soon as
+ * they are sent and their replies read without waiting. (see botEngine.c)
+ *
+ * If the server was started with --listen, clients can also connect to it
+ * while it runs. They are only added once they have a name. (see
+ * listener.c)
+ *
+ * If the server was started with --watch, clients are also started and
+ * removed as lines are added to and taken out of its configfile, which is
+ * kept as it was last read to tell which lines changed.
+ *
+ * Clients that leave the chat are released at the end of the round: their
+ * pipes are closed, their memory freed and their slot in clients and their
+ * name are taken up by the next client to join. (see
+ * release_departed_clients()) Their processes are reaped as they exit, so
+ * rooms with heavy churn run in constant memory and file descriptors.
+ *
+ * If the server was started with --transcript, its transcript is written by
+ * a writer thread. (see transcript.c) If it was started with --history, the
+ * most recent events of the chat are kept to replay to late joiners. If it
+ * was started with --metrics, every client's metrics are kept as well as
+ * its own. (see metrics.c)
  */
 typedef struct {
-    /* Array of all ClientInstances for each client in the server */
+    /* Array of all ClientInstances for each client in the server, NULL for
+     * slots left empty by released clients
+     */
     ClientInstance **clients;
-    /* Number of clients in the server */
+    /* Number of slots in clients */
     int numClients;
+    /* Hash table from client names to indices in clients */
+    NameTable *names;
+    /* Indices of the first and last active clients, -1 if there are none */
+    int firstActive;
+    int lastActive;
+    /* Number of active clients */
+    int numActive;
+    /* Options the server was started with */
+    ServerOptions *options;
+    /* Event loop watching every client, NULL unless options->eventLoop */
+    EventLoop *loop;
+    /* Clients to be disconnected for not reading their stdin */
+    MpscQueue laggards;
+    /* Indices of clients that left the chat since they were last released
+     * and the number of them
+     */
+    int *departed;
+    int numDeparted;
+    /* Clients that left the chat and that no other thread refers to any
+     * more, ready to be freed
+     */
+    MpscQueue released;
+    /* Indices of empty slots in clients and the number of them */
+    int *freeSlots;
+    int numFreeSlots;
+    /* Number of clients ever added, i.e. the recordId of the next one */
+    int numAdded;
+    /* signalfd SIGCHLD is read from, -1 if exited clients aren't reaped
+     * (see start_reaping())
+     */
+    int reapFd;
+    /* Shards of the server, NULL unless options->numShards > 0 */
+    Shard *shards;
+    /* Number of shards */
+    int numShards;
+    /* In-process bots of the server, NULL until the first one is started */
+    BotEngine *bots;
+    /* Number of active clients that are in-process bots */
+    int numActiveBots;
+    /* Socket clients connect to, NULL unless the server was started with
+     * --listen
+     */
+    Listener *listener;
+    /* Lines of the configfile as it was last read, NULL unless the server
+     * was started with --watch
+     */
+    LineList *configLines;
+    /* Writer of the server's transcript, NULL if it is printed by the main
+     * thread
+     */
+    Transcript *transcript;
+    /* Most recent events of the chat, NULL if none are kept */
+    History *history;
+    /* Metrics of the server, NULL if it keeps none */
+    ServerMetrics *metrics;
+    /* Recording of the session, NULL if it isn't recorded */
+    Recorder *recorder;
 } ClientList;
 
-ClientInstance *new_client_instance(LineList *cmd);
+ClientInstance *new_client_instance(SpawnedClient *spawned);
 void free_client_instance(ClientInstance *client);
-void send_client(ClientInstance *client, char *msg);
-char *read_client_line(ClientInstance *client, bool *isLineEmpty);
-void set_client_name(ClientInstance *client, char *name);
+void send_client(ClientList *chatMembers, ClientInstance *client, char *msg);
+void send_client_msg(ClientList *chatMembers, ClientInstance *client,
+        SharedMsg *msg);
+void queue_client_output(EventLoop *loop, ClientList *chatMembers,
+        ClientInstance *client, SharedMsg *msg, bool mayHold);
+void flush_held_output(ClientList *chatMembers);
+void arm_client_deadline(ClientList *chatMembers, Timer *timer, int delayMs);
+void cancel_client_deadlines(ClientList *chatMembers, ClientInstance *client);
+Frame *read_client_cmd(ClientList *chatMembers, ClientInstance *client);
+void set_client_name(ClientList *chatMembers, int clientIndex, char *name);
 int find_client_index(ClientList *chatMembers, char *name);
-ClientList *init_client_list();
+bool is_name_taken(ClientList *chatMembers, char *name);
+ClientList *init_client_list(ServerOptions *options);
 void free_client_list(ClientList *chatMembers);
 void add_client_instance(ClientList *chatMembers, ClientInstance *newClient);
+void deactivate_client(ClientList *chatMembers, ClientInstance *client);
+ClientInstance *next_laggard(ClientList *chatMembers);
+void disconnect_client(ClientList *chatMembers, ClientInstance *client);
+void release_departed_clients(ClientList *chatMembers);
+ClientInstance *next_released(ClientList *chatMembers);
+void free_released_client(ClientList *chatMembers, ClientInstance *client);
+void close_client_stdin(ClientInstance *client);
 int count_active_clients(ClientList *chatMembers);
+int next_active_index(ClientList *chatMembers, int clientIndex);
 void send_all(ClientList *chatMembers, char *msg, int excludedIndex);
-ClientList *init_clients_from_lines(LineList *configLines);
+void send_history(ClientList *chatMembers, ClientInstance *client);
+void send_all_msg(ClientList *chatMembers, SharedMsg *msg,
+        int excludedIndex);
+ClientList *init_clients_from_lines(LineList *configLines,
+        ServerOptions *options, SpawnHelper *helper);
+ClientInstance *add_config_client(ClientList *chatMembers, char *line);
 
 #endif
@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "mpscQueue.h"
+#include "serverUtils.h"
+#include "eventLoop.h"
+#include "shard.h"
+
+static void *run_shard(void *arg);
+static void apply_shard_item(Shard *shard, ShardItem *item);
+static void join_shard(Shard *shard, ClientInstance *client);
+static void leave_shard(Shard *shard, ClientInstance *client);
+static size_t get_item_bytes(ShardItem *item);
+
+/* Splits the clients of chatMembers into numShards shards and starts a
+ * worker thread for each. Clients are added to shards as they are added to
+ * chatMembers. (see add_client_instance() in serverUtils.c)
+ */
+void start_shards(ClientList *chatMembers, int numShards) {
+    chatMembers->shards = calloc(numShards, sizeof(Shard));
+    chatMembers->numShards = numShards;
+
+    for (int i = 0; i < numShards; ++i) {
+        Shard *shard = &chatMembers->shards[i];
+        init_mpsc_queue(&shard->inbox);
+        shard->loop = init_event_loop();
+        enable_wakeups(shard->loop);
+        shard->members = NULL;
+        shard->numMembers = 0;
+        shard->pendingBytes = 0;
+        shard->isSleeping = false;
+        shard->isStopped = false;
+        shard->chatMembers = chatMembers;
+
+        if (pthread_create(&shard->thread, NULL, run_shard, shard)) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+}
+
+/* Stops the worker thread of every shard of chatMembers once it has handled
+ * everything already in its inbox, then frees the shards.
+ */
+void stop_shards(ClientList *chatMembers) {
+    for (int i = 0; i < chatMembers->numShards; ++i) {
+        post_shard(&chatMembers->shards[i], SHARD_STOP, NULL, NULL);
+    }
+
+    for (int i = 0; i < chatMembers->numShards; ++i) {
+        Shard *shard = &chatMembers->shards[i];
+        pthread_join(shard->thread, NULL);
+        free_event_loop(shard->loop);
+        free(shard->members);
+    }
+
+    free(chatMembers->shards);
+    chatMembers->shards = NULL;
+    chatMembers->numShards = 0;
+}
+
+/* Hands a piece of work to a shard. The shard takes its own reference to msg
+ * for SHARD_SEND and SHARD_BROADCAST items; it is NULL for the others.
+ *
+ * The shard's worker is only woken (costing a syscall) if it is waiting in
+ * its event loop.
+ *
+ * Should the shard's inbox outgrow the server's high-water mark, e.g. as its
+ * worker waits on a slow client (see SLOW_BLOCK in outputQueue.h), this
+ * waits until the worker has carried out half of it. Every other pipe of
+ * the main thread's event loop is kept drained meanwhile, so clients the
+ * worker waits on are never stuck writing to the server.
+ */
+void post_shard(Shard *shard, ShardItemType type, ClientInstance *client,
+        SharedMsg *msg) {
+    ShardItem *item = malloc(sizeof(ShardItem));
+    item->type = type;
+    item->client = client;
+    item->msg = msg;
+    if (msg != NULL) {
+        retain_shared_msg(msg);
+    }
+
+    // Counted before the push so the worker never takes off more than this
+    size_t pendingBytes = __atomic_add_fetch(&shard->pendingBytes,
+            get_item_bytes(item), __ATOMIC_SEQ_CST);
+    push_mpsc(&shard->inbox, &item->node);
+    if (__atomic_load_n(&shard->isSleeping, __ATOMIC_SEQ_CST)) {
+        wake_event_loop(shard->loop);
+    }
+
+    size_t limit = shard->chatMembers->options->queueLimit;
+    if (pendingBytes <= limit) {
+        return;
+    }
+    while (__atomic_load_n(&shard->pendingBytes, __ATOMIC_SEQ_CST) >
+            limit / 2) {
+        poll_events(shard->chatMembers->loop, SHARD_BACKOFF_MS);
+    }
+}
+
+/* Body of a shard's worker thread. Handles work from the shard's inbox and
+ * otherwise waits in its event loop, writing pending output to the shard's
+ * clients as their stdin becomes writable.
+ */
+static void *run_shard(void *arg) {
+    Shard *shard = arg;
+
+    while (!shard->isStopped) {
+        MpscNode *node;
+        while (!shard->isStopped && (node = pop_mpsc(&shard->inbox)) != NULL) {
+            apply_shard_item(shard, MPSC_ENTRY(node, ShardItem, node));
+        }
+        if (shard->isStopped) {
+            break;
+        }
+
+        /* Producers check isSleeping after pushing, so either they see it
+         * set and wake the loop, or the inbox is seen to be non-empty here.
+         */
+        __atomic_store_n(&shard->isSleeping, true, __ATOMIC_SEQ_CST);
+        if (is_mpsc_empty(&shard->inbox)) {
+            poll_events(shard->loop, -1);
+        }
+        __atomic_store_n(&shard->isSleeping, false, __ATOMIC_SEQ_CST);
+    }
+
+    return NULL;
+}
+
+/* Carries out a single item from a shard's inbox, then frees it and
+ * releases its message
+ */
+static void apply_shard_item(Shard *shard, ShardItem *item) {
+    ClientInstance *client = item->client;
+    size_t itemBytes = get_item_bytes(item);
+
+    switch (item->type) {
+        case SHARD_JOIN:
+            join_shard(shard, client);
+            break;
+        case SHARD_LEAVE:
+            leave_shard(shard, client);
+            break;
+        case SHARD_SEND:
+            if (client->shardPos >= 0) {
+                queue_client_output(shard->loop, shard->chatMembers, client,
+                        item->msg, false);
+            }
+            break;
+        case SHARD_BROADCAST:
+            for (int i = 0; i < shard->numMembers; ++i) {
+                if (shard->members[i] != client) {
+                    queue_client_output(shard->loop, shard->chatMembers,
+                            shard->members[i], item->msg, true);
+                }
+            }
+            break;
+        case SHARD_CLOSE:
+            close_client_stdin(client);
+            break;
+        case SHARD_RELEASE:
+            // Nothing of the shard refers to the client once it has left
+            push_mpsc(&shard->chatMembers->released, &client->releaseNode);
+            break;
+        case SHARD_FLUSH:
+            release_held_output(shard->loop);
+            break;
+        case SHARD_STOP:
+            shard->isStopped = true;
+            break;
+    }
+
+    if (item->msg != NULL) {
+        release_shared_msg(item->msg);
+    }
+    free(item);
+    __atomic_sub_fetch(&shard->pendingBytes, itemBytes, __ATOMIC_SEQ_CST);
+}
+
+/* Returns the number of bytes a shard's inbox is taken to hold for an item,
+ * i.e. the item itself and its message, if it has one
+ */
+static size_t get_item_bytes(ShardItem *item) {
+    return sizeof(ShardItem) + (item->msg == NULL ? 0 : item->msg->len);
+}
+
+/* Adds a client to a shard's members, then writes any output the main
+ * thread queued for the client before handing it over. (see
+ * hand_over_client_output() in eventLoop.c)
+ */
+static void join_shard(Shard *shard, ClientInstance *client) {
+    shard->members = realloc(shard->members,
+            sizeof(ClientInstance *) * (shard->numMembers + 1));
+    client->shardPos = shard->numMembers;
+    shard->members[shard->numMembers++] = client;
+
+    if (client->output.numMsgs > 0) {
+        flush_client_output(shard->loop, client);
+    }
+}
+
+/* Removes a client from a shard's members, discarding any output still
+ * pending for it
+ */
+static void leave_shard(Shard *shard, ClientInstance *client) {
+    if (client->shardPos < 0) {
+        return;
+    }
+
+    // Move the last member into the leaving client's place
+    ClientInstance *last = shard->members[--shard->numMembers];
+    shard->members[client->shardPos] = last;
+    last->shardPos = client->shardPos;
+    client->shardPos = -1;
+
+    discard_client_output(shard->loop, client);
+}
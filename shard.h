@@ -0,0 +1,92 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stdbool.h>
+#include <pthread.h>
+#include "mpscQueue.h"
+#include "serverUtils.h"
+
+/* Milliseconds the main thread runs its event loop for between checks on a
+ * shard whose inbox is full (see post_shard())
+ */
+#define SHARD_BACKOFF_MS 1
+
+/* Types of work the main thread of a server hands to a shard */
+typedef enum {
+    /* A client joined the shard */
+    SHARD_JOIN,
+    /* A client left the chat, so nothing more is written to it */
+    SHARD_LEAVE,
+    /* Send a message to a single client */
+    SHARD_SEND,
+    /* Send a message to every client of the shard except one */
+    SHARD_BROADCAST,
+    /* Close a client's stdin */
+    SHARD_CLOSE,
+    /* Forget a client that left, handing it back to be freed */
+    SHARD_RELEASE,
+    /* Write every broadcast held back for the shard's clients */
+    SHARD_FLUSH,
+    /* Stop the shard's worker thread */
+    SHARD_STOP
+} ShardItemType;
+
+/* A single piece of work in a shard's inbox */
+typedef struct {
+    /* Node linking the item into the inbox */
+    MpscNode node;
+    /* What is to be done */
+    ShardItemType type;
+    /* Client the item is for, or the client excluded from a broadcast
+     * (NULL to exclude nobody)
+     */
+    ClientInstance *client;
+    /* Message of SHARD_SEND and SHARD_BROADCAST items, NULL otherwise */
+    SharedMsg *msg;
+} ShardItem;
+
+/* Struct for one shard of a server's clients, owned by a worker thread.
+ *
+ * Shards only offload writing: the worker thread does all writing to the
+ * stdin of the shard's clients, using an event loop of its own. The main
+ * thread (the coordinator) still reads and parses every client's commands,
+ * decides whose turn it is and emits the transcript, and hands messages to
+ * shards through their lock-free inboxes. A broadcast costs the coordinator
+ * one inbox item per shard, however many clients there are.
+ *
+ * An inbox is bounded like a client's output queue: once more than the
+ * server's high-water mark of work is waiting in it, the coordinator runs its
+ * own event loop until the worker has caught up. (see post_shard())
+ *
+ * Membership changes go through the inbox too, so each worker's view of who
+ * is in the chat always matches the order messages were sent in.
+ */
+struct Shard {
+    /* Worker thread of the shard */
+    pthread_t thread;
+    /* Work handed to the shard by other threads */
+    MpscQueue inbox;
+    /* Event loop writing to the shard's clients */
+    EventLoop *loop;
+    /* Clients currently in the shard */
+    ClientInstance **members;
+    /* Number of clients in members */
+    int numMembers;
+    /* Bytes of work in the inbox not yet carried out, counting each message
+     * once however many clients it is for. Updated atomically.
+     */
+    size_t pendingBytes;
+    /* Whether the worker is (about to be) waiting in its event loop */
+    bool isSleeping;
+    /* Whether the worker has been told to stop */
+    bool isStopped;
+    /* Clients the shard belongs to */
+    ClientList *chatMembers;
+};
+
+void start_shards(ClientList *chatMembers, int numShards);
+void stop_shards(ClientList *chatMembers);
+void post_shard(Shard *shard, ShardItemType type, ClientInstance *client,
+        SharedMsg *msg);
+
+#endif
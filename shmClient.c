@@ -0,0 +1,166 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include "shmRing.h"
+#include "shmClient.h"
+
+/* Struct for a client's end of the ShmChannel its server offered it */
+typedef struct {
+    /* The channel itself */
+    ShmChannel *channel;
+    /* File descriptors of the channel, in the order of ShmFd */
+    int fds[SHM_NUM_FDS];
+    /* Whether everything the server will ever write to stdin has been read
+     * from it, so input only comes from the channel
+     */
+    bool isInputOnRing;
+    /* Whether the server closed the client's stdin */
+    bool isStdinClosed;
+} ShmClient;
+
+static ssize_t read_shm_input(void *cookie, char *buf, size_t size);
+static ssize_t write_shm_output(void *cookie, const char *buf, size_t size);
+static void wait_for_bell(ShmClient *shm);
+
+/* Switches the client's stdin and stdout over to the ShmChannel its server
+ * offered it, if any (see SHM_FD_ENV), and returns whether it did.
+ *
+ * stdin and stdout are replaced by streams reading from and writing to the
+ * channel, so the rest of the client reads and writes lines as before. Lines
+ * the server wrote to the client's stdin before it saw the client attach are
+ * still read first.
+ */
+bool attach_shm_transport() {
+    char *value = getenv(SHM_FD_ENV);
+    ShmClient shm;
+    struct stat memStat;
+    if (value == NULL || atoi(value) != SHM_BASE_FD ||
+            fstat(SHM_BASE_FD, &memStat) ||
+            memStat.st_size != sizeof(ShmChannel) ||
+            (shm.channel = map_shm_channel(SHM_BASE_FD)) == NULL) {
+        return false;
+    }
+
+    for (int i = 0; i < SHM_NUM_FDS; ++i) {
+        shm.fds[i] = SHM_BASE_FD + i;
+        fcntl(shm.fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    shm.isInputOnRing = false;
+    shm.isStdinClosed = false;
+    // Anything the server still writes to stdin is read without waiting
+    fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+
+    ShmClient *cookie = malloc(sizeof(ShmClient));
+    *cookie = shm;
+    cookie_io_functions_t inputFuncs = {read_shm_input, NULL, NULL, NULL};
+    cookie_io_functions_t outputFuncs = {NULL, write_shm_output, NULL, NULL};
+    FILE *input = fopencookie(cookie, "r", inputFuncs);
+    FILE *output = fopencookie(cookie, "w", outputFuncs);
+    if (input == NULL || output == NULL) {
+        return false;
+    }
+
+    fflush(stdout);
+    __atomic_store_n(&cookie->channel->isAttached, 1, __ATOMIC_RELEASE);
+    stdin = input;
+    stdout = output;
+
+    return true;
+}
+
+/* Reads up to size bytes of the client's input into buf, waiting until any
+ * arrive, and returns the number read or 0 once the server closed the
+ * client's stdin.
+ *
+ * Until the server switches to the channel, input comes from stdin. Once
+ * there is input in the channel, the server has written all it will to
+ * stdin, so stdin is drained once more and then only read for its EOF.
+ */
+static ssize_t read_shm_input(void *cookie, char *buf, size_t size) {
+    ShmClient *shm = cookie;
+    ShmRing *ring = &shm->channel->toClient;
+
+    while (1) {
+        if (!shm->isInputOnRing) {
+            bool hadRingInput = !is_ring_empty(ring);
+            ssize_t numRead = read(STDIN_FILENO, buf, size);
+            if (numRead > 0) {
+                return numRead;
+            } else if (numRead < 0 && errno == EINTR) {
+                continue;
+            }
+            shm->isStdinClosed = numRead == 0;
+            shm->isInputOnRing = hadRingInput || shm->isStdinClosed;
+        }
+
+        size_t numRead = read_ring(ring, buf, size);
+        if (numRead > 0) {
+            if (take_waiting(&ring->writerWaiting)) {
+                ring_bell(shm->fds[SHM_SPACE_BELL]);
+            }
+            return numRead;
+        } else if (shm->isStdinClosed || is_ring_closed(ring)) {
+            return 0;
+        }
+
+        set_waiting(&ring->readerWaiting);
+        if (is_ring_empty(ring) && !is_ring_closed(ring)) {
+            wait_for_bell(shm);
+        }
+    }
+}
+
+/* Writes the size bytes at buf to the server, waiting for space in the
+ * channel as needed. Returns size, or -1 if the server closed the client's
+ * stdin before they could all be written.
+ */
+static ssize_t write_shm_output(void *cookie, const char *buf, size_t size) {
+    ShmClient *shm = cookie;
+    ShmRing *ring = &shm->channel->toServer;
+    size_t numWritten = 0;
+
+    while (1) {
+        numWritten += write_ring(ring, buf + numWritten, size - numWritten);
+        if (take_waiting(&ring->readerWaiting)) {
+            ring_bell(shm->fds[SHM_DATA_BELL]);
+        }
+        if (numWritten == size) {
+            return size;
+        } else if (shm->isStdinClosed ||
+                is_ring_closed(&shm->channel->toClient)) {
+            return -1;
+        }
+
+        set_waiting(&ring->writerWaiting);
+        if (is_ring_full(ring)) {
+            wait_for_bell(shm);
+        }
+    }
+}
+
+/* Waits for the server to ring the client's doorbell or to write to or
+ * close the client's stdin. Once input only comes from the channel, stdin
+ * only becomes readable when the server closes it, e.g. if the server died.
+ */
+static void wait_for_bell(ShmClient *shm) {
+    struct pollfd fds[2] = {
+            {shm->fds[SHM_CLIENT_BELL], POLLIN, 0},
+            {STDIN_FILENO, POLLIN, 0}};
+
+    if (poll(fds, 2, -1) <= 0) {
+        return;
+    }
+    if (fds[0].revents) {
+        clear_bell(shm->fds[SHM_CLIENT_BELL]);
+    }
+    if (shm->isInputOnRing && fds[1].revents) {
+        char byte;
+        shm->isStdinClosed = read(STDIN_FILENO, &byte, 1) <= 0;
+    }
+}
@@ -0,0 +1,8 @@
+#ifndef SHMCLIENT_H
+#define SHMCLIENT_H
+
+#include <stdbool.h>
+
+bool attach_shm_transport();
+
+#endif
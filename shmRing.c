@@ -0,0 +1,176 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include "shmRing.h"
+
+/* Creates the memory and doorbells of a new, zeroed ShmChannel and stores
+ * their file descriptors in fds, in the order of ShmFd. Every descriptor is
+ * close-on-exec and above the range they are passed to clients on, so none
+ * is overwritten while passing the others. (see spawn_client())
+ *
+ * Returns false, leaving every element of fds -1, if any can't be created.
+ */
+bool open_shm_channel(int fds[SHM_NUM_FDS]) {
+    bool isOpen = true;
+
+    for (int i = 0; i < SHM_NUM_FDS; ++i) {
+        int fd = i == SHM_MEMORY ? memfd_create("chat", MFD_CLOEXEC) :
+                eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        fds[i] = fd < 0 ? -1 :
+                fcntl(fd, F_DUPFD_CLOEXEC, SHM_BASE_FD + SHM_NUM_FDS);
+        if (fd >= 0) {
+            close(fd);
+        }
+        isOpen = isOpen && fds[i] >= 0;
+    }
+
+    if (!isOpen || ftruncate(fds[SHM_MEMORY], sizeof(ShmChannel))) {
+        close_shm_fds(fds);
+        return false;
+    }
+
+    // The server is asleep until the client first writes to it
+    ShmChannel *channel = map_shm_channel(fds[SHM_MEMORY]);
+    if (channel == NULL) {
+        close_shm_fds(fds);
+        return false;
+    }
+    channel->toServer.readerWaiting = 1;
+    unmap_shm_channel(channel);
+
+    return true;
+}
+
+/* Maps the ShmChannel in the memfd memFd into memory and returns a pointer
+ * to it, or NULL if it can't be mapped.
+ */
+ShmChannel *map_shm_channel(int memFd) {
+    void *channel = mmap(NULL, sizeof(ShmChannel), PROT_READ | PROT_WRITE,
+            MAP_SHARED, memFd, 0);
+    return channel == MAP_FAILED ? NULL : channel;
+}
+
+/* Unmaps a ShmChannel mapped by map_shm_channel() */
+void unmap_shm_channel(ShmChannel *channel) {
+    munmap(channel, sizeof(ShmChannel));
+}
+
+/* Closes every file descriptor of a ShmChannel that is open and sets it to
+ * -1
+ */
+void close_shm_fds(int fds[SHM_NUM_FDS]) {
+    for (int i = 0; i < SHM_NUM_FDS; ++i) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+        fds[i] = -1;
+    }
+}
+
+/* Writes as much of the len bytes at src to a ring as there is space for,
+ * without waiting, and returns the number of bytes written. Only the
+ * ring's writer may call this.
+ */
+size_t write_ring(ShmRing *ring, const char *src, size_t len) {
+    unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    unsigned int tail = ring->tail;
+    size_t space = SHM_RING_SIZE - (tail - head);
+    if (len > space) {
+        len = space;
+    }
+
+    // The bytes may wrap around the end of data
+    size_t start = tail & (SHM_RING_SIZE - 1);
+    size_t firstLen = SHM_RING_SIZE - start < len ? SHM_RING_SIZE - start :
+            len;
+    memcpy(ring->data + start, src, firstLen);
+    memcpy(ring->data, src + firstLen, len - firstLen);
+
+    __atomic_store_n(&ring->tail, tail + len, __ATOMIC_RELEASE);
+    return len;
+}
+
+/* Reads up to len bytes from a ring into dest, without waiting, and returns
+ * the number of bytes read. Only the ring's reader may call this.
+ */
+size_t read_ring(ShmRing *ring, char *dest, size_t len) {
+    unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    unsigned int head = ring->head;
+    if (len > tail - head) {
+        len = tail - head;
+    }
+
+    size_t start = head & (SHM_RING_SIZE - 1);
+    size_t firstLen = SHM_RING_SIZE - start < len ? SHM_RING_SIZE - start :
+            len;
+    memcpy(dest, ring->data + start, firstLen);
+    memcpy(dest + firstLen, ring->data, len - firstLen);
+
+    __atomic_store_n(&ring->head, head + len, __ATOMIC_RELEASE);
+    return len;
+}
+
+/* Returns whether a ring has no bytes to read. Ordered after any preceding
+ * set_waiting(), as the reader checks this just before sleeping.
+ */
+bool is_ring_empty(ShmRing *ring) {
+    return __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) ==
+            __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+}
+
+/* Returns whether a ring has no space to write to. Ordered after any
+ * preceding set_waiting(), as the writer checks this just before sleeping.
+ */
+bool is_ring_full(ShmRing *ring) {
+    return __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) -
+            __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) == SHM_RING_SIZE;
+}
+
+/* Returns whether a ring's writer has closed it */
+bool is_ring_closed(ShmRing *ring) {
+    return __atomic_load_n(&ring->isClosed, __ATOMIC_ACQUIRE);
+}
+
+/* Closes a ring, telling its reader nothing more will be written once it has
+ * read what is left. The caller then rings the reader's doorbell if
+ * take_waiting() says to.
+ */
+void close_ring(ShmRing *ring) {
+    __atomic_store_n(&ring->isClosed, 1, __ATOMIC_SEQ_CST);
+}
+
+/* Sets one of a ring's waiting flags before its side sleeps. The ring must
+ * be checked once more before sleeping. (see is_ring_empty())
+ */
+void set_waiting(int *waiting) {
+    __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+}
+
+/* Clears one of a ring's waiting flags after changing the ring and returns
+ * whether it was set, i.e. whether the other side's doorbell is to be rung.
+ */
+bool take_waiting(int *waiting) {
+    // Order the change to the ring before the flag is checked
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return __atomic_load_n(waiting, __ATOMIC_SEQ_CST) &&
+            __atomic_exchange_n(waiting, 0, __ATOMIC_SEQ_CST);
+}
+
+/* Rings a doorbell, waking whoever is waiting on it */
+void ring_bell(int bellFd) {
+    uint64_t count = 1;
+    write(bellFd, &count, sizeof(uint64_t));
+}
+
+/* Resets a doorbell after it has woken its owner, so it can be waited on
+ * again
+ */
+void clear_bell(int bellFd) {
+    uint64_t count;
+    read(bellFd, &count, sizeof(uint64_t));
+}
@@ -0,0 +1,100 @@
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Capacity in bytes of each ring of a ShmChannel, a power of two */
+#define SHM_RING_SIZE (1 << 16)
+
+/* Environment variable telling a client its server offers it a ShmChannel.
+ * Its value is the file descriptor of the channel's memory, and the client's
+ * ends of its doorbells follow on the next file descriptors in the order of
+ * ShmFd.
+ */
+#define SHM_FD_ENV "CHAT_SHM_FD"
+
+/* First file descriptor a ShmChannel is passed to a client on */
+#define SHM_BASE_FD 3
+
+/* File descriptors making up a ShmChannel, in the order they are passed to
+ * a client. Doorbells are eventfds.
+ */
+typedef enum {
+    /* memfd holding the ShmChannel itself */
+    SHM_MEMORY,
+    /* Rung by the client when it writes to toServer */
+    SHM_DATA_BELL,
+    /* Rung by the client when it makes space in toClient */
+    SHM_SPACE_BELL,
+    /* Rung by the server when it writes to toClient or makes space in
+     * toServer
+     */
+    SHM_CLIENT_BELL,
+    /* Number of file descriptors of a ShmChannel */
+    SHM_NUM_FDS
+} ShmFd;
+
+/* A single-producer single-consumer ring of bytes in shared memory.
+ *
+ * head and tail count every byte ever read and written respectively, so the
+ * ring is empty when they are equal and full when they are SHM_RING_SIZE
+ * apart. Each is only ever written by one side and published with release
+ * ordering, so neither side takes a lock.
+ *
+ * A side that is about to sleep sets its waiting flag and then checks the
+ * ring once more. The other side clears the flag after changing the ring and
+ * only rings the sleeper's doorbell if it was set, so a doorbell is only
+ * rung (costing a syscall) when its owner may be asleep.
+ *
+ * Each member the two sides write is on its own cache line.
+ */
+typedef struct {
+    /* Number of bytes ever read from the ring */
+    unsigned int head __attribute__((aligned(64)));
+    /* Number of bytes ever written to the ring */
+    unsigned int tail __attribute__((aligned(64)));
+    /* Whether the writer has closed the ring, i.e. will write no more */
+    int isClosed;
+    /* Whether the reader may be asleep waiting for bytes */
+    int readerWaiting __attribute__((aligned(64)));
+    /* Whether the writer may be asleep waiting for space */
+    int writerWaiting __attribute__((aligned(64)));
+    /* The bytes themselves */
+    char data[SHM_RING_SIZE] __attribute__((aligned(64)));
+} ShmRing;
+
+/* Memory shared by a server and one of its clients, carrying the same lines
+ * the pipes to the client's stdin and stdout would.
+ *
+ * A client that uses the channel sets isAttached before writing anything,
+ * and from then on writes to toServer only. The server keeps writing to the
+ * client's stdin until it sees isAttached, then writes to toClient only, so
+ * anything the client reads from its stdin comes before anything in
+ * toClient. Clients that don't use the channel never see a difference.
+ */
+typedef struct {
+    /* Whether the client uses the channel */
+    int isAttached;
+    /* Bytes from the server to the client's stdin */
+    ShmRing toClient;
+    /* Bytes from the client's stdout to the server */
+    ShmRing toServer;
+} ShmChannel;
+
+bool open_shm_channel(int fds[SHM_NUM_FDS]);
+ShmChannel *map_shm_channel(int memFd);
+void unmap_shm_channel(ShmChannel *channel);
+void close_shm_fds(int fds[SHM_NUM_FDS]);
+size_t write_ring(ShmRing *ring, const char *src, size_t len);
+size_t read_ring(ShmRing *ring, char *dest, size_t len);
+bool is_ring_empty(ShmRing *ring);
+bool is_ring_full(ShmRing *ring);
+bool is_ring_closed(ShmRing *ring);
+void close_ring(ShmRing *ring);
+void set_waiting(int *waiting);
+bool take_waiting(int *waiting);
+void ring_bell(int bellFd);
+void clear_bell(int bellFd);
+
+#endif
@@ -0,0 +1,219 @@
+#include <stdlib.h>
+#include <time.h>
+#include "timerWheel.h"
+
+static void init_timer_list(Timer *head);
+static void link_timer(Timer *head, Timer *timer);
+static void unlink_timer(Timer *timer);
+static long long next_occupied_tick(TimerWheel *wheel, long long tick,
+        long long lastTick);
+static void clear_if_empty(TimerWheel *wheel, int slotNo);
+
+/* Returns the time elapsed in milliseconds since some fixed point in the
+ * past, unaffected by changes to the system clock.
+ */
+long long current_time_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+/* Initializes an empty TimerWheel. Its slots are only allocated once a timer
+ * is first armed.
+ */
+void init_timer_wheel(TimerWheel *wheel) {
+    wheel->slots = NULL;
+    for (int i = 0; i < TIMER_WHEEL_SLOTS / 64; ++i) {
+        wheel->occupied[i] = 0;
+    }
+    wheel->now = 0;
+    wheel->numArmed = 0;
+    init_timer_list(&wheel->expired);
+}
+
+/* Frees memory allocated to a TimerWheel. Timers still in the wheel are left
+ * as they are.
+ */
+void free_timer_wheel(TimerWheel *wheel) {
+    free(wheel->slots);
+    wheel->slots = NULL;
+}
+
+/* Initializes a Timer that is neither armed nor expired */
+void init_timer(Timer *timer) {
+    timer->prev = NULL;
+    timer->next = NULL;
+    timer->expiry = 0;
+    timer->isArmed = false;
+    timer->hasExpired = false;
+}
+
+/* Arms a timer of a TimerWheel to expire delayMs milliseconds from now. A
+ * timer that was already armed (or expired) is rearmed.
+ */
+void arm_timer(TimerWheel *wheel, Timer *timer, int delayMs) {
+    cancel_timer(wheel, timer);
+
+    long long nowMs = current_time_ms();
+    if (wheel->slots == NULL) {
+        wheel->slots = malloc(sizeof(Timer) * TIMER_WHEEL_SLOTS);
+        for (int i = 0; i < TIMER_WHEEL_SLOTS; ++i) {
+            init_timer_list(&wheel->slots[i]);
+        }
+    }
+    // An empty wheel's slots are all up to date, so it can skip ahead
+    if (wheel->numArmed == 0) {
+        wheel->now = nowMs;
+    }
+
+    // Slots up to wheel->now have been passed over already
+    timer->expiry = nowMs + delayMs;
+    if (timer->expiry <= wheel->now) {
+        timer->expiry = wheel->now + 1;
+    }
+    int slotNo = timer->expiry & (TIMER_WHEEL_SLOTS - 1);
+    link_timer(&wheel->slots[slotNo], timer);
+    wheel->occupied[slotNo / 64] |= 1ULL << (slotNo % 64);
+    timer->isArmed = true;
+    wheel->numArmed++;
+}
+
+/* Disarms a timer of a TimerWheel and clears its expired flag. Does nothing
+ * to a timer that is neither armed nor expired.
+ */
+void cancel_timer(TimerWheel *wheel, Timer *timer) {
+    if (timer->isArmed) {
+        wheel->numArmed--;
+        unlink_timer(timer);
+        clear_if_empty(wheel, timer->expiry & (TIMER_WHEEL_SLOTS - 1));
+    } else if (timer->next != NULL) {
+        unlink_timer(timer);
+    }
+    timer->isArmed = false;
+    timer->hasExpired = false;
+}
+
+/* Advances a TimerWheel to the time nowMs, expiring every armed timer due by
+ * then. Expired timers are flagged as such and can be taken with
+ * pop_expired_timer().
+ */
+void advance_timer_wheel(TimerWheel *wheel, long long nowMs) {
+    if (wheel->numArmed == 0 || nowMs <= wheel->now) {
+        return;
+    }
+
+    // A full revolution visits every slot, however long it has been
+    long long lastTick = nowMs - wheel->now < TIMER_WHEEL_SLOTS ?
+            nowMs : wheel->now + TIMER_WHEEL_SLOTS;
+    for (long long tick = next_occupied_tick(wheel, wheel->now + 1,
+            lastTick); tick <= lastTick;
+            tick = next_occupied_tick(wheel, tick + 1, lastTick)) {
+        int slotNo = tick & (TIMER_WHEEL_SLOTS - 1);
+        Timer *slot = &wheel->slots[slotNo];
+        Timer *timer = slot->next;
+        while (timer != slot) {
+            Timer *next = timer->next;
+            // Timers due in later revolutions stay where they are
+            if (timer->expiry <= nowMs) {
+                unlink_timer(timer);
+                link_timer(&wheel->expired, timer);
+                timer->isArmed = false;
+                timer->hasExpired = true;
+                wheel->numArmed--;
+            }
+            timer = next;
+        }
+        clear_if_empty(wheel, slotNo);
+    }
+    wheel->now = nowMs;
+}
+
+/* Returns the number of milliseconds from nowMs until the next armed timer
+ * of a TimerWheel expires, or -1 if no timers are armed.
+ *
+ * Only one revolution of the wheel from the time it was last advanced to
+ * is searched, so the wheel should first be advanced to nowMs. If every
+ * timer is due in a later revolution the length of a revolution is returned
+ * instead. The caller then advances the wheel and asks again.
+ */
+int next_timer_timeout(TimerWheel *wheel, long long nowMs) {
+    if (wheel->numArmed == 0) {
+        return -1;
+    }
+
+    long long lastTick = wheel->now + TIMER_WHEEL_SLOTS;
+    for (long long tick = next_occupied_tick(wheel, wheel->now + 1,
+            lastTick); tick <= lastTick;
+            tick = next_occupied_tick(wheel, tick + 1, lastTick)) {
+        Timer *slot = &wheel->slots[tick & (TIMER_WHEEL_SLOTS - 1)];
+        for (Timer *timer = slot->next; timer != slot; timer = timer->next) {
+            if (timer->expiry == tick) {
+                return tick > nowMs ? tick - nowMs : 0;
+            }
+        }
+    }
+
+    return TIMER_WHEEL_SLOTS;
+}
+
+/* Removes a timer from a TimerWheel's list of expired timers and returns it,
+ * still flagged as expired. Returns NULL if no timers have expired.
+ */
+Timer *pop_expired_timer(TimerWheel *wheel) {
+    Timer *timer = wheel->expired.next;
+    if (timer == &wheel->expired) {
+        return NULL;
+    }
+
+    unlink_timer(timer);
+    return timer;
+}
+
+/* Initializes the head of an empty circular list of timers */
+static void init_timer_list(Timer *head) {
+    head->prev = head;
+    head->next = head;
+}
+
+/* Adds a timer to the end of the circular list with the given head */
+static void link_timer(Timer *head, Timer *timer) {
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+/* Removes a timer from the circular list it is in */
+static void unlink_timer(Timer *timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->prev = NULL;
+    timer->next = NULL;
+}
+
+/* Returns the first tick from tick to lastTick (at most one revolution on)
+ * whose slot of a TimerWheel holds any timers, or a tick past lastTick if
+ * none do.
+ */
+static long long next_occupied_tick(TimerWheel *wheel, long long tick,
+        long long lastTick) {
+    while (tick <= lastTick) {
+        int slotNo = tick & (TIMER_WHEEL_SLOTS - 1);
+        uint64_t bits = wheel->occupied[slotNo / 64] >> (slotNo % 64);
+        if (bits != 0) {
+            return tick + __builtin_ctzll(bits);
+        }
+        // Skip to the first slot of the next word
+        tick += 64 - slotNo % 64;
+    }
+    return tick;
+}
+
+/* Clears the bit of a slot of a TimerWheel in its occupancy bitmap if the
+ * slot no longer holds any timers
+ */
+static void clear_if_empty(TimerWheel *wheel, int slotNo) {
+    if (wheel->slots[slotNo].next == &wheel->slots[slotNo]) {
+        wheel->occupied[slotNo / 64] &= ~(1ULL << (slotNo % 64));
+    }
+}
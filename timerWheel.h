@@ -0,0 +1,75 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Number of slots of a TimerWheel, a power of two. Each slot covers one
+ * millisecond, so a full revolution of the wheel takes this many ms.
+ */
+#define TIMER_WHEEL_SLOTS 512
+
+/* Returns a pointer to the struct of the given type whose member (a Timer)
+ * timer points to.
+ */
+#define TIMER_ENTRY(timer, type, member) \
+        ((type *) ((char *) (timer) - offsetof(type, member)))
+
+typedef struct Timer Timer;
+
+/* A single deadline. Structs with deadlines embed one of these per deadline
+ * and are recovered from it with TIMER_ENTRY().
+ *
+ * A timer is in at most one circular list at a time: the slot of its wheel
+ * its expiry hashes to while armed, or the wheel's list of expired timers
+ * once it has expired and until it is taken. prev and next are NULL while
+ * it is in neither.
+ */
+struct Timer {
+    /* Previous and next timers of the list the timer is in */
+    Timer *prev;
+    Timer *next;
+    /* Time the timer expires at, in ms (see current_time_ms()) */
+    long long expiry;
+    /* Whether the timer is waiting to expire */
+    bool isArmed;
+    /* Whether the timer has expired since it was last armed */
+    bool hasExpired;
+};
+
+/* Hashed timer wheel with a resolution of one millisecond.
+ *
+ * An armed timer sits in the slot its expiry hashes to, whether that is in
+ * this revolution of the wheel or a later one, so arming and cancelling a
+ * timer take O(1) time however many timers are armed. Advancing the wheel
+ * only visits the slots it passes over, moving every timer that is due onto
+ * the list of expired timers.
+ *
+ * A bitmap of the slots holding any timers lets both advancing the wheel and
+ * finding the next timer to expire skip empty slots 64 at a time.
+ */
+typedef struct {
+    /* Circular list heads of each slot, allocated once a timer is armed */
+    Timer *slots;
+    /* Bit i % 64 of word i / 64 is set if slot i holds any timers */
+    uint64_t occupied[TIMER_WHEEL_SLOTS / 64];
+    /* Time up to which the wheel has been advanced, in ms */
+    long long now;
+    /* Number of armed timers */
+    int numArmed;
+    /* Circular list head of timers that expired and weren't yet taken */
+    Timer expired;
+} TimerWheel;
+
+long long current_time_ms();
+void init_timer_wheel(TimerWheel *wheel);
+void free_timer_wheel(TimerWheel *wheel);
+void init_timer(Timer *timer);
+void arm_timer(TimerWheel *wheel, Timer *timer, int delayMs);
+void cancel_timer(TimerWheel *wheel, Timer *timer);
+void advance_timer_wheel(TimerWheel *wheel, long long nowMs);
+int next_timer_timeout(TimerWheel *wheel, long long nowMs);
+Timer *pop_expired_timer(TimerWheel *wheel);
+
+#endif
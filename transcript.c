@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include "mpscQueue.h"
+#include "timerWheel.h"
+#include "transcript.h"
+
+static void *run_transcript(void *arg);
+static void take_line(Transcript *transcript, TranscriptLine *line);
+static void write_batch(Transcript *transcript);
+static void wait_for_lines(Transcript *transcript);
+static long long get_batch_deadline(Transcript *transcript);
+
+/* Starts a writer thread writing the transcript of a server to outFd as per
+ * policy and returns a pointer to a newly allocated Transcript struct for
+ * it. Exits with code 1 if the thread can't be started.
+ */
+Transcript *start_transcript(int outFd, TranscriptPolicy policy,
+        int flushEvery) {
+    Transcript *transcript = malloc(sizeof(Transcript));
+    init_mpsc_queue(&transcript->lines);
+    transcript->outFd = outFd;
+    transcript->policy = policy;
+    transcript->flushEvery = flushEvery;
+    transcript->batch = NULL;
+    transcript->batchLen = 0;
+    transcript->batchCap = 0;
+    transcript->batchLines = 0;
+    transcript->batchStart = 0;
+    transcript->isSleeping = false;
+    transcript->isStopped = false;
+
+    if ((transcript->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        perror("eventfd");
+        exit(1);
+    }
+    if (pthread_create(&transcript->thread, NULL, run_transcript,
+            transcript)) {
+        perror("pthread_create");
+        exit(1);
+    }
+
+    return transcript;
+}
+
+/* Stops a transcript's writer thread once it has written every line already
+ * emitted, then frees the Transcript struct.
+ */
+void stop_transcript(Transcript *transcript) {
+    uint64_t count = 1;
+    __atomic_store_n(&transcript->isStopped, true, __ATOMIC_SEQ_CST);
+    write(transcript->wakeFd, &count, sizeof(uint64_t));
+    pthread_join(transcript->thread, NULL);
+
+    close(transcript->wakeFd);
+    free(transcript->batch);
+    free(transcript);
+}
+
+/* Emits a line of a server's transcript, formatted as per printf(). If
+ * transcript is NULL, i.e. the server wasn't started with --transcript, the
+ * line is printed to stdout straight away. Else it is queued for the writer
+ * thread. Only ever called by the main thread, so lines are written in the
+ * order they are emitted either way.
+ */
+void emit_transcript(Transcript *transcript, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    if (transcript == NULL) {
+        vprintf(format, args);
+        va_end(args);
+        return;
+    }
+    int len = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    TranscriptLine *line = malloc(sizeof(TranscriptLine) + len + 1);
+    line->len = len;
+    va_start(args, format);
+    vsnprintf(line->data, len + 1, format, args);
+    va_end(args);
+
+    push_mpsc(&transcript->lines, &line->node);
+    if (__atomic_load_n(&transcript->isSleeping, __ATOMIC_SEQ_CST)) {
+        uint64_t count = 1;
+        write(transcript->wakeFd, &count, sizeof(uint64_t));
+    }
+}
+
+/* Makes the lines of a server's transcript emitted so far visible, if it is
+ * printed to stdout. A writer thread writes them as per its own policy
+ * instead, so this does nothing for one.
+ */
+void flush_transcript(Transcript *transcript) {
+    if (transcript == NULL) {
+        fflush(stdout);
+    }
+}
+
+/* Body of a transcript's writer thread. Takes lines from the transcript's
+ * queue into its batch, writes the batch as per the transcript's policy and
+ * otherwise waits for more lines, until it is told to stop.
+ */
+static void *run_transcript(void *arg) {
+    Transcript *transcript = arg;
+
+    while (1) {
+        // Every line emitted before the writer was stopped is taken below
+        bool isStopped = __atomic_load_n(&transcript->isStopped,
+                __ATOMIC_SEQ_CST);
+        MpscNode *node;
+        while ((node = pop_mpsc(&transcript->lines)) != NULL) {
+            take_line(transcript, MPSC_ENTRY(node, TranscriptLine, node));
+        }
+
+        if (isStopped) {
+            write_batch(transcript);
+            break;
+        } else if (transcript->batchLines > 0 &&
+                current_time_ms() >= get_batch_deadline(transcript)) {
+            write_batch(transcript);
+        }
+        wait_for_lines(transcript);
+    }
+
+    return NULL;
+}
+
+/* Appends a line to a transcript's batch and frees it. The batch is written
+ * once it holds flushEvery lines under TRANSCRIPT_EVERY_LINES, or once it
+ * grows past TRANSCRIPT_BATCH_LIMIT bytes. (see get_batch_deadline() for
+ * when it is written otherwise)
+ */
+static void take_line(Transcript *transcript, TranscriptLine *line) {
+    if (transcript->batchLen + line->len > transcript->batchCap) {
+        size_t newCap = transcript->batchCap < TRANSCRIPT_BATCH_LIMIT ?
+                TRANSCRIPT_BATCH_LIMIT : transcript->batchCap;
+        while (newCap < transcript->batchLen + line->len) {
+            newCap *= 2;
+        }
+        transcript->batch = realloc(transcript->batch, newCap);
+        transcript->batchCap = newCap;
+    }
+
+    if (transcript->batchLines++ == 0) {
+        transcript->batchStart = current_time_ms();
+    }
+    memcpy(transcript->batch + transcript->batchLen, line->data, line->len);
+    transcript->batchLen += line->len;
+    free(line);
+
+    if (transcript->batchLen >= TRANSCRIPT_BATCH_LIMIT ||
+            (transcript->policy == TRANSCRIPT_EVERY_LINES &&
+            transcript->batchLines >= transcript->flushEvery)) {
+        write_batch(transcript);
+    }
+}
+
+/* Writes all of a transcript's batch and empties it. A batch that can't be
+ * written, e.g. if stdout was closed, is dropped as stdio would.
+ */
+static void write_batch(Transcript *transcript) {
+    size_t numWritten = 0;
+
+    while (numWritten < transcript->batchLen) {
+        ssize_t written = write(transcript->outFd,
+                transcript->batch + numWritten,
+                transcript->batchLen - numWritten);
+        if (written < 0 && errno != EINTR) {
+            break;
+        }
+        numWritten += written < 0 ? 0 : written;
+    }
+
+    transcript->batchLen = 0;
+    transcript->batchLines = 0;
+}
+
+/* Waits for the main thread to emit a line or stop a transcript's writer.
+ * If the batch holds any lines, the wait also ends once it is due to be
+ * written.
+ */
+static void wait_for_lines(Transcript *transcript) {
+    int timeoutMs = -1;
+    if (transcript->batchLines > 0) {
+        long long remaining = get_batch_deadline(transcript) -
+                current_time_ms();
+        timeoutMs = remaining < 0 ? 0 : remaining;
+    }
+
+    /* The main thread checks isSleeping after pushing, so either it sees it
+     * set and wakes the writer, or the queue is seen to be non-empty here.
+     */
+    __atomic_store_n(&transcript->isSleeping, true, __ATOMIC_SEQ_CST);
+    if (is_mpsc_empty(&transcript->lines) &&
+            !__atomic_load_n(&transcript->isStopped, __ATOMIC_SEQ_CST)) {
+        struct pollfd wakePoll = {transcript->wakeFd, POLLIN, 0};
+        poll(&wakePoll, 1, timeoutMs);
+    }
+    __atomic_store_n(&transcript->isSleeping, false, __ATOMIC_SEQ_CST);
+
+    uint64_t count;
+    read(transcript->wakeFd, &count, sizeof(uint64_t));
+}
+
+/* Returns the time a transcript's batch is due to be written by, in ms (see
+ * current_time_ms()): flushEvery milliseconds after its oldest line was
+ * taken under TRANSCRIPT_EVERY_MS, else TRANSCRIPT_MAX_AGE_MS after, so the
+ * last lines of a chat that has gone quiet aren't held indefinitely.
+ */
+static long long get_batch_deadline(Transcript *transcript) {
+    return transcript->batchStart +
+            (transcript->policy == TRANSCRIPT_EVERY_MS ?
+            transcript->flushEvery : TRANSCRIPT_MAX_AGE_MS);
+}
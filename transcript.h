@@ -0,0 +1,76 @@
+#ifndef TRANSCRIPT_H
+#define TRANSCRIPT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "mpscQueue.h"
+#include "serverOptions.h"
+
+/* Number of bytes of the transcript a writer thread holds at most before
+ * writing them, whatever its policy
+ */
+#define TRANSCRIPT_BATCH_LIMIT (1 << 16)
+
+/* Milliseconds a line is held by a writer thread at most under
+ * TRANSCRIPT_EVERY_LINES, so a batch that never fills is still written
+ */
+#define TRANSCRIPT_MAX_AGE_MS 100
+
+/* A single line of the transcript, formatted by the main thread and queued
+ * for the writer thread
+ */
+typedef struct {
+    /* Node linking the line into the transcript's queue */
+    MpscNode node;
+    /* Length of the line in bytes */
+    size_t len;
+    /* The line itself */
+    char data[];
+} TranscriptLine;
+
+/* Struct for a thread writing a server's transcript to its stdout, so the
+ * main thread never waits on a slow file or pipe. (see --transcript)
+ *
+ * The main thread formats each line and pushes it onto a lock-free queue,
+ * and the writer appends lines to batch in the order they were pushed,
+ * writing the whole batch with a single write() once its policy says to.
+ * The writer is only woken (costing a syscall) if it may be asleep.
+ */
+typedef struct {
+    /* Writer thread */
+    pthread_t thread;
+    /* Lines not yet taken by the writer */
+    MpscQueue lines;
+    /* eventfd the writer waits on */
+    int wakeFd;
+    /* File descriptor the transcript is written to */
+    int outFd;
+    /* When the batch is written */
+    TranscriptPolicy policy;
+    /* Number of lines or milliseconds of policy */
+    int flushEvery;
+    /* Lines taken by the writer and not yet written */
+    char *batch;
+    /* Number of bytes in batch and allocated to it */
+    size_t batchLen;
+    size_t batchCap;
+    /* Number of lines in batch */
+    int batchLines;
+    /* Time the oldest line in batch was taken, in ms (see
+     * current_time_ms())
+     */
+    long long batchStart;
+    /* Whether the writer is (about to be) waiting for lines */
+    bool isSleeping;
+    /* Whether the writer has been told to stop */
+    bool isStopped;
+} Transcript;
+
+Transcript *start_transcript(int outFd, TranscriptPolicy policy,
+        int flushEvery);
+void stop_transcript(Transcript *transcript);
+void emit_transcript(Transcript *transcript, const char *format, ...);
+void flush_transcript(Transcript *transcript);
+
+#endif